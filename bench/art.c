@@ -0,0 +1,122 @@
+// Art against Map on two key sets: the symbols of the Scheme standard
+// library (scheme_stdlib/core.scm, or the file given as the second
+// argument) and n synthetic keys with long shared prefixes. For each, the
+// bytes the structure holds once filled and the time for random hits.
+#include <ctype.h>
+
+#include "bench.h"
+#include "cart.h"
+#include "cmap.h"
+
+static volatile long sink;
+
+// Every distinct token of the file that is not a number, in the order
+// they first appear.
+char **read_symbols(const char *path, size_t *n) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    Map *seen = m_make(0);
+    size_t capacity = 64;
+    char **symbols = (char **) malloc(capacity * sizeof(char *));
+    char token[256];
+    size_t len = 0;
+    *n = 0;
+    for (int c = fgetc(f);; c = fgetc(f)) {
+        bool delimiter = c == EOF || isspace(c) || c == '(' || c == ')' || c == '\'';
+        if (!delimiter && len < sizeof(token) - 1) {
+            token[len++] = (char) c;
+            continue;
+        }
+        token[len] = '\0';
+        if (len > 0 && !isdigit((unsigned char) token[0]) && m_get(seen, token) == NULL) {
+            m_insert(seen, token, NULL);
+            if (*n == capacity) {
+                capacity *= 2;
+                symbols = (char **) realloc(symbols, capacity * sizeof(char *));
+            }
+            symbols[(*n)++] = strdup(token);
+        }
+        len = 0;
+        if (c == EOF) break;
+    }
+    fclose(f);
+    m_free(seen);
+    return symbols;
+}
+
+char **make_keys(size_t n) {
+    char **keys = (char **) malloc(n * sizeof(char *));
+    char buf[64];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "user/%08zu/name", i * 2654435761u % 100000000);
+        keys[i] = strdup(buf);
+    }
+    return keys;
+}
+
+void report_bytes(const char *structure, const char *label, size_t bytes, size_t n_keys) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s bytes, %s", structure, label);
+    printf("%-44s %10zu (%.1f per key)\n", name, bytes, (double) bytes / (double) n_keys);
+}
+
+void run(const char *label, char **keys, size_t n_keys, size_t n_gets) {
+    CountingAllocator ca;
+    char name[64];
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    long sum = 0;
+
+    size_t *queries = (size_t *) malloc(n_gets * sizeof(size_t));
+    for (size_t q_idx = 0; q_idx < n_gets; q_idx++)
+        queries[q_idx] = (size_t) (next_random(&state) % n_keys);
+
+    counting_init(&ca);
+    Art *t = art_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    for (size_t i = 0; i < n_keys; i++) art_insert(t, keys[i], &i);
+    report_bytes("Art", label, ca._live, n_keys);
+    double t0 = bench_now();
+    for (size_t q_idx = 0; q_idx < n_gets; q_idx++) sum += *(long *) art_get(t, keys[queries[q_idx]]);
+    snprintf(name, sizeof(name), "Art get, %s", label);
+    bench_report(name, n_gets, bench_now() - t0);
+    art_free(t);
+
+    counting_init(&ca);
+    Map *m = m_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    for (size_t i = 0; i < n_keys; i++) m_insert(m, keys[i], &i);
+    report_bytes("Map", label, ca._live, n_keys);
+    t0 = bench_now();
+    for (size_t q_idx = 0; q_idx < n_gets; q_idx++) sum += *(long *) m_get(m, keys[queries[q_idx]]);
+    snprintf(name, sizeof(name), "Map get, %s", label);
+    bench_report(name, n_gets, bench_now() - t0);
+    m_free(m);
+
+    sink = sum;
+    free(queries);
+}
+
+void free_keys(char **keys, size_t n) {
+    for (size_t i = 0; i < n; i++) free(keys[i]);
+    free(keys);
+}
+
+int main(int argc, char **argv) {
+    size_t n = bench_count(argc, argv, 1000000);
+    const char *path = argc > 2 ? argv[2] : "../scheme_stdlib/core.scm";
+
+    size_t n_symbols;
+    char **symbols = read_symbols(path, &n_symbols);
+    char label[64];
+    snprintf(label, sizeof(label), "%zu stdlib symbols", n_symbols);
+    run(label, symbols, n_symbols, n);
+    free_keys(symbols, n_symbols);
+
+    char **keys = make_keys(n);
+    snprintf(label, sizeof(label), "%zu synthetic keys", n);
+    run(label, keys, n, n);
+    free_keys(keys, n);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "callocator.h"
+
+// Shared by the benchmarks and tests: a monotonic clock, a report line, a
+// small random number generator, and an Allocator that counts what the
+// containers ask of it.
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+size_t bench_count(int argc, char **argv, size_t fallback) {
+    if (argc > 1) return (size_t) strtoull(argv[1], NULL, 10);
+    return fallback;
+}
+
+void bench_report(const char *name, size_t n_ops, double seconds) {
+    printf("%-44s %10.2f ns/op\n", name, seconds * 1e9 / (double) n_ops);
+}
+
+// xorshift64: fast, reproducible from its seed, and good enough to pick
+// keys. The state must not be 0.
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Passes everything on to malloc. _copied counts the bytes a realloc may
+// have had to move (the smaller of the old and new sizes), an upper bound
+// since realloc sometimes grows in place. _live and _peak track the bytes
+// handed out and not yet freed.
+typedef struct {
+    Allocator _allocator;
+    size_t _allocs;
+    size_t _reallocs;
+    size_t _frees;
+    size_t _copied;
+    size_t _live;
+    size_t _peak;
+} CountingAllocator;
+
+void counting_note_live(CountingAllocator *ca) {
+    if (ca->_live > ca->_peak) ca->_peak = ca->_live;
+}
+
+void *counting_alloc(size_t n, void *ctx) {
+    CountingAllocator *ca = (CountingAllocator *) ctx;
+    ca->_allocs++;
+    ca->_live += n;
+    counting_note_live(ca);
+    return malloc(n);
+}
+
+void *counting_realloc(void *p, size_t old_n, size_t new_n, void *ctx) {
+    CountingAllocator *ca = (CountingAllocator *) ctx;
+    ca->_reallocs++;
+    if (p != NULL) ca->_copied += old_n < new_n ? old_n : new_n;
+    ca->_live += new_n;
+    ca->_live -= p != NULL ? old_n : 0;
+    counting_note_live(ca);
+    return realloc(p, new_n);
+}
+
+void counting_free(void *p, size_t n, void *ctx) {
+    CountingAllocator *ca = (CountingAllocator *) ctx;
+    if (p == NULL) return;
+    ca->_frees++;
+    ca->_live -= n;
+    free(p);
+}
+
+void counting_init(CountingAllocator *ca) {
+    ca->_allocator._alloc = counting_alloc;
+    ca->_allocator._realloc = counting_realloc;
+    ca->_allocator._free = counting_free;
+    ca->_allocator._ctx = ca;
+    ca->_allocs = ca->_reallocs = ca->_frees = 0;
+    ca->_copied = ca->_live = ca->_peak = 0;
+}
+
+const Allocator *counting_allocator(CountingAllocator *ca) {
+    return &ca->_allocator;
+}
+
+#endif
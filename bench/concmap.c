@@ -0,0 +1,98 @@
+// ConcurrentMap throughput on 1..N threads, all reads and 90% reads, with
+// the default 64 shards and with a single shard (one global rwlock). A
+// plain Map lookup on one thread gives the cost of the work the locks
+// wrap.
+//
+//   ./concmap [ops per thread] [max threads]
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "cconcmap.h"
+
+#define N_KEYS 100000
+
+static char keys[N_KEYS][16];
+static volatile long sink;
+
+typedef struct {
+    ConcurrentMap *_map;
+    size_t _n_ops;
+    unsigned _write_percent;
+    uint64_t _seed;
+} Worker;
+
+void *run_worker(void *p) {
+    Worker *w = (Worker *) p;
+    long sum = 0, value;
+    for (size_t op = 0; op < w->_n_ops; op++) {
+        uint64_t r = next_random(&w->_seed);
+        const char *k = keys[r % N_KEYS];
+        if ((r >> 32) % 100 < w->_write_percent) {
+            value = (long) op;
+            cm_insert(w->_map, k, &value);
+        } else if (cm_get(w->_map, k, &value)) {
+            sum += value;
+        }
+    }
+    sink = sum;
+    return NULL;
+}
+
+void run(size_t n_shards, unsigned write_percent, size_t n_ops, size_t max_threads) {
+    ConcurrentMap *cm = cm_make(sizeof(long), n_shards);
+    for (long i = 0; i < N_KEYS; i++) cm_insert(cm, keys[i], &i);
+
+    printf("\n%zu shard(s), %u%% writes\n", cm->_n_shards, write_percent);
+    printf("%8s %14s %12s\n", "threads", "Mops/s total", "ns/op/thread");
+    for (size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+        pthread_t threads[64];
+        Worker workers[64];
+
+        double t0 = bench_now();
+        for (size_t t_idx = 0; t_idx < n_threads; t_idx++) {
+            workers[t_idx]._map = cm;
+            workers[t_idx]._n_ops = n_ops;
+            workers[t_idx]._write_percent = write_percent;
+            workers[t_idx]._seed = 0x9e3779b97f4a7c15ULL * (t_idx + 1);
+            pthread_create(&threads[t_idx], NULL, run_worker, &workers[t_idx]);
+        }
+        for (size_t t_idx = 0; t_idx < n_threads; t_idx++)
+            pthread_join(threads[t_idx], NULL);
+        double seconds = bench_now() - t0;
+
+        printf("%8zu %14.2f %12.2f\n", n_threads,
+               (double) (n_ops * n_threads) / seconds * 1e-6,
+               seconds * 1e9 / (double) n_ops);
+    }
+    cm_free(cm);
+}
+
+int main(int argc, char **argv) {
+    size_t n_ops = bench_count(argc, argv, 2000000);
+    size_t n_cpus = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 2 ? (size_t) strtoull(argv[2], NULL, 10) : n_cpus;
+    if (max_threads < 8) max_threads = 8;
+    if (max_threads > 64) max_threads = 64;
+
+    for (size_t i = 0; i < N_KEYS; i++) snprintf(keys[i], sizeof(keys[i]), "key%zu", i);
+
+    // the same lookups without any locking
+    Map *m = m_make(sizeof(long));
+    for (long i = 0; i < N_KEYS; i++) m_insert(m, keys[i], &i);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    long sum = 0;
+    double t0 = bench_now();
+    for (size_t op = 0; op < n_ops; op++)
+        sum += *(long *) m_get(m, keys[next_random(&seed) % N_KEYS]);
+    sink = sum;
+    printf("%zu online cpus\n", n_cpus);
+    bench_report("Map get, one thread, no locks", n_ops, bench_now() - t0);
+    m_free(m);
+
+    run(0, 0, n_ops, max_threads);
+    run(0, 10, n_ops, max_threads);
+    run(1, 0, n_ops, max_threads);
+    run(1, 10, n_ops, max_threads);
+    return 0;
+}
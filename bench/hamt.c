@@ -0,0 +1,98 @@
+// Hamt against Map at several sizes. Functional update: starting from a
+// map of size keys, each step makes a new version that rebinds one key and
+// drops the old version, which for a Map means copying it first. Lookup:
+// n random hits on a map of size keys.
+#include "bench.h"
+#include "chamt.h"
+#include "cmap.h"
+
+static volatile long sink;
+
+char **make_keys(size_t n) {
+    char **keys = (char **) malloc(n * sizeof(char *));
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "sym%zu", i);
+        keys[i] = strdup(buf);
+    }
+    return keys;
+}
+
+void free_keys(char **keys, size_t n) {
+    for (size_t i = 0; i < n; i++) free(keys[i]);
+    free(keys);
+}
+
+Map *copy_map(Map *m) {
+    Map *copy = m_make(m->_stride);
+    m_map(m, map_union, copy);
+    return copy;
+}
+
+void run(size_t size, size_t n) {
+    size_t n_updates = n / size < 100 ? 100 : n / size;
+    char **keys = make_keys(size);
+    char name[64];
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    long sum = 0;
+
+    Hamt *h = hm_make(sizeof(long));
+    Map *m = m_make(sizeof(long));
+    for (size_t i = 0; i < size; i++) {
+        Hamt *next = hm_insert(h, keys[i], &i);
+        hm_release(h);
+        h = next;
+        m_insert(m, keys[i], &i);
+    }
+
+    double t0 = bench_now();
+    Hamt *hv = hm_retain(h);
+    for (size_t u_idx = 0; u_idx < n_updates; u_idx++) {
+        Hamt *next = hm_insert(hv, keys[u_idx % size], &u_idx);
+        hm_release(hv);
+        hv = next;
+    }
+    snprintf(name, sizeof(name), "%6zu keys: Hamt hm_insert version", size);
+    bench_report(name, n_updates, bench_now() - t0);
+    hm_release(hv);
+
+    t0 = bench_now();
+    Map *mv = copy_map(m);
+    for (size_t u_idx = 0; u_idx < n_updates; u_idx++) {
+        Map *next = copy_map(mv);
+        m_insert(next, keys[u_idx % size], &u_idx);
+        m_free(mv);
+        mv = next;
+    }
+    snprintf(name, sizeof(name), "%6zu keys: Map copy + m_insert", size);
+    bench_report(name, n_updates, bench_now() - t0);
+    m_free(mv);
+
+    size_t *queries = (size_t *) malloc(n * sizeof(size_t));
+    for (size_t q_idx = 0; q_idx < n; q_idx++)
+        queries[q_idx] = (size_t) (next_random(&state) % size);
+
+    t0 = bench_now();
+    for (size_t q_idx = 0; q_idx < n; q_idx++) sum += *(long *) hm_get(h, keys[queries[q_idx]]);
+    snprintf(name, sizeof(name), "%6zu keys: Hamt hm_get", size);
+    bench_report(name, n, bench_now() - t0);
+
+    t0 = bench_now();
+    for (size_t q_idx = 0; q_idx < n; q_idx++) sum += *(long *) m_get(m, keys[queries[q_idx]]);
+    snprintf(name, sizeof(name), "%6zu keys: Map m_get", size);
+    bench_report(name, n, bench_now() - t0);
+
+    sink = sum;
+    free(queries);
+    hm_release(h);
+    m_free(m);
+    free_keys(keys, size);
+}
+
+int main(int argc, char **argv) {
+    size_t n = bench_count(argc, argv, 1000000);
+    size_t sizes[] = {4, 16, 64, 1024, 16384, 262144};
+    for (size_t s_idx = 0; s_idx < sizeof(sizes) / sizeof(sizes[0]); s_idx++)
+        run(sizes[s_idx], n);
+    return 0;
+}
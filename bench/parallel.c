@@ -0,0 +1,90 @@
+// v_map_parallel and v_filter_parallel against v_map and v_filter on 1..N
+// threads, over vectors from 1K to 4M longs. The size threshold is turned
+// off here so the parallel paths run at every size: the smallest size at
+// which they beat the serial ones is what VECTOR_PARALLEL_MIN_CHUNK should
+// be. Also times an empty tp_run, the fixed cost a batch has to amortize.
+//
+//   ./parallel [max threads]
+#define VECTOR_PARALLEL_MIN_CHUNK 1
+#include "bench.h"
+#include "cthreadpool.h"
+
+static volatile long sink;
+
+// noinline: the serial loops would otherwise fold these in, which the
+// function pointer calls of the parallel tasks never do
+__attribute__((noinline)) void scramble(void *p, __attribute__((unused)) void *aux) {
+    long *x = (long *) p;
+    *x = *x * 6364136223846793005L + 1442695040888963407L;
+}
+
+__attribute__((noinline)) bool is_odd(const void *p, __attribute__((unused)) const void *aux) {
+    return (*(const long *) p & 1) != 0;
+}
+
+void nothing(__attribute__((unused)) size_t task_idx, __attribute__((unused)) void *aux) {}
+
+// Repeats each measurement until it has run for a few milliseconds.
+size_t rounds_for(size_t n) {
+    size_t rounds = (1 << 24) / n;
+    return rounds ? rounds : 1;
+}
+
+int main(int argc, char **argv) {
+    size_t n_cpus = tp_default_thread_count() + 1;
+    size_t max_threads = bench_count(argc, argv, n_cpus < 8 ? 8 : n_cpus);
+    double t0;
+
+    printf("%zu online cpus\n", n_cpus);
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        ThreadPool *tp = tp_make(threads - 1);
+
+        size_t batches = 10000;
+        t0 = bench_now();
+        for (size_t b_idx = 0; b_idx < batches; b_idx++)
+            tp_run(tp, tp_size(tp) * VECTOR_PARALLEL_CHUNKS_PER_THREAD, nothing, NULL);
+        printf("\n%zu threads: empty tp_run %.2f us\n", threads,
+               (bench_now() - t0) * 1e6 / (double) batches);
+        printf("%10s %12s %12s %12s %12s\n", "n", "map ns/el", "par ns/el",
+               "filter ns/el", "par ns/el");
+
+        for (size_t n = 1 << 10; n <= 1 << 22; n <<= 2) {
+            Vector *v = v_make(sizeof(long));
+            for (long i = 0; i < (long) n; i++) v_push_back(v, &i);
+            size_t rounds = rounds_for(n);
+            v_map(v, scramble, NULL); // warm up the pages and caches
+            double el = (double) (n * rounds);
+
+            t0 = bench_now();
+            for (size_t r = 0; r < rounds; r++) v_map(v, scramble, NULL);
+            double map_s = bench_now() - t0;
+
+            t0 = bench_now();
+            for (size_t r = 0; r < rounds; r++) v_map_parallel(tp, v, scramble, NULL);
+            double map_par_s = bench_now() - t0;
+
+            t0 = bench_now();
+            for (size_t r = 0; r < rounds; r++) {
+                Vector *o = v_filter(v, is_odd, NULL);
+                sink += (long) v_size(o);
+                v_free(o);
+            }
+            double filter_s = bench_now() - t0;
+
+            t0 = bench_now();
+            for (size_t r = 0; r < rounds; r++) {
+                Vector *o = v_filter_parallel(tp, v, is_odd, NULL);
+                sink += (long) v_size(o);
+                v_free(o);
+            }
+            double filter_par_s = bench_now() - t0;
+
+            printf("%10zu %12.2f %12.2f %12.2f %12.2f\n", n,
+                   map_s * 1e9 / el, map_par_s * 1e9 / el,
+                   filter_s * 1e9 / el, filter_par_s * 1e9 / el);
+            v_free(v);
+        }
+        tp_free(tp);
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+// The life of a small Map: make, k inserts, k hits and k misses, free. For
+// k up to MAP_SMALL_CAPACITY the map never leaves its inline array; k = 16
+// spills into buckets. This is the cycle a per-call environment frame goes
+// through.
+#include "bench.h"
+#include "cmap.h"
+
+static volatile long sink;
+
+int main(int argc, char **argv) {
+    size_t n = bench_count(argc, argv, 1000000);
+    static const char *names[] = {"a", "acc", "lst", "f", "n", "init", "x", "rest",
+                                  "y", "z", "k", "v", "ks", "vs", "env", "tail"};
+    static const char *misses[] = {"car", "cdr", "cons", "null?", "+", "-", "apply", "eval",
+                                   "map", "id", "not", "list", "pair?", "eq?", "if", "let"};
+    size_t sizes[] = {1, 2, 4, 8, 16};
+    char name[64];
+
+    for (size_t s_idx = 0; s_idx < sizeof(sizes) / sizeof(sizes[0]); s_idx++) {
+        size_t k = sizes[s_idx];
+        long sum = 0;
+        double t0 = bench_now();
+        for (size_t r = 0; r < n; r++) {
+            Map *m = m_make(sizeof(long));
+            for (size_t i = 0; i < k; i++) m_insert(m, names[i], &r);
+            for (size_t i = 0; i < k; i++) sum += *(long *) m_get(m, names[i]);
+            for (size_t i = 0; i < k; i++) sum += m_get(m, misses[i]) != NULL;
+            m_free(m);
+        }
+        sink = sum;
+        snprintf(name, sizeof(name), "%zu bindings: make, insert, hit, miss, free", k);
+        bench_report(name, n, bench_now() - t0);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// SplayTree against BTree: n keys inserted in sorted order, then n
+// lookups that are sorted, uniformly random, or Zipfian (exponent 1, the
+// hottest keys scattered over the key range). Query streams are made up
+// front so that only the trees are timed.
+#include "bench.h"
+#include "cbtree.h"
+#include "csplaytree.h"
+
+static volatile long sink;
+
+int compare_longs(void *a, void *b) {
+    long x = *(long *) a;
+    long y = *(long *) b;
+    return (x > y) - (x < y);
+}
+
+// Rank r (from 0) is drawn with probability proportional to 1 / (r + 1),
+// and ranks map to keys through a shuffle.
+void make_zipf(long *queries, size_t n, uint64_t *state) {
+    double *cdf = (double *) malloc(n * sizeof(double));
+    long *key_of_rank = (long *) malloc(n * sizeof(long));
+    double total = 0;
+    for (size_t r = 0; r < n; r++) {
+        total += 1.0 / (double) (r + 1);
+        cdf[r] = total;
+        key_of_rank[r] = (long) r;
+    }
+    for (size_t r = n - 1; r > 0; r--) {
+        size_t other = (size_t) (next_random(state) % (r + 1));
+        long t = key_of_rank[r];
+        key_of_rank[r] = key_of_rank[other];
+        key_of_rank[other] = t;
+    }
+
+    for (size_t q_idx = 0; q_idx < n; q_idx++) {
+        double u = (double) (next_random(state) >> 11) / 9007199254740992.0 * total;
+        size_t lo = 0, hi = n - 1;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u) lo = mid + 1;
+            else hi = mid;
+        }
+        queries[q_idx] = key_of_rank[lo];
+    }
+    free(cdf);
+    free(key_of_rank);
+}
+
+void run(const char *pattern, long *queries, size_t n) {
+    char name[64];
+    long sum = 0;
+
+    SplayTree *st = st_make(sizeof(long), compare_longs);
+    for (long k = 0; k < (long) n; k++) st_insert(st, &k);
+    double t0 = bench_now();
+    for (size_t q_idx = 0; q_idx < n; q_idx++) sum += *(long *) st_find(st, queries + q_idx);
+    snprintf(name, sizeof(name), "SplayTree find, %s", pattern);
+    bench_report(name, n, bench_now() - t0);
+    st_free(st);
+
+    BTree *bt = t_make(sizeof(long), compare_longs);
+    for (long k = 0; k < (long) n; k++) t_insert(bt, &k);
+    t0 = bench_now();
+    for (size_t q_idx = 0; q_idx < n; q_idx++) sum += *(long *) t_find(bt, queries + q_idx);
+    snprintf(name, sizeof(name), "BTree find, %s", pattern);
+    bench_report(name, n, bench_now() - t0);
+    t_free(bt);
+
+    sink = sum;
+}
+
+int main(int argc, char **argv) {
+    size_t n = bench_count(argc, argv, 1000000);
+    long *queries = (long *) malloc(n * sizeof(long));
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    double t0 = bench_now();
+    SplayTree *st = st_make(sizeof(long), compare_longs);
+    for (long k = 0; k < (long) n; k++) st_insert(st, &k);
+    bench_report("SplayTree insert, sorted", n, bench_now() - t0);
+    st_free(st);
+    t0 = bench_now();
+    BTree *bt = t_make(sizeof(long), compare_longs);
+    for (long k = 0; k < (long) n; k++) t_insert(bt, &k);
+    bench_report("BTree insert, sorted", n, bench_now() - t0);
+    t_free(bt);
+
+    for (size_t q_idx = 0; q_idx < n; q_idx++) queries[q_idx] = (long) q_idx;
+    run("sorted", queries, n);
+    for (size_t q_idx = 0; q_idx < n; q_idx++) queries[q_idx] = (long) (next_random(&state) % n);
+    run("random", queries, n);
+    make_zipf(queries, n, &state);
+    run("Zipfian", queries, n);
+
+    free(queries);
+    return 0;
+}
@@ -0,0 +1,87 @@
+// SwissMap against Map: inserting n keys, then looking up every key and
+// n keys that are not there, with short keys that fit in a SwissMap slot
+// and long ones that do not. The allocation counts are for the inserts.
+#include "bench.h"
+#include "cmap.h"
+#include "cswissmap.h"
+
+static volatile long sink;
+
+char **make_keys(size_t n, const char *format) {
+    char **keys = (char **) malloc(n * sizeof(char *));
+    char buf[64];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), format, i);
+        keys[i] = strdup(buf);
+    }
+    return keys;
+}
+
+void free_keys(char **keys, size_t n) {
+    for (size_t i = 0; i < n; i++) free(keys[i]);
+    free(keys);
+}
+
+void run(const char *label, size_t n, char **hits, char **misses) {
+    CountingAllocator ca;
+    char name[64];
+    double t0;
+    long sum;
+
+    counting_init(&ca);
+    Map *m = m_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    t0 = bench_now();
+    for (size_t i = 0; i < n; i++) m_insert(m, hits[i], &i);
+    snprintf(name, sizeof(name), "Map insert, %s", label);
+    bench_report(name, n, bench_now() - t0);
+    printf("%44s %10zu allocs\n", "", ca._allocs + ca._reallocs);
+
+    sum = 0;
+    t0 = bench_now();
+    for (size_t i = 0; i < n; i++) sum += *(long *) m_get(m, hits[i]);
+    snprintf(name, sizeof(name), "Map get hit, %s", label);
+    bench_report(name, n, bench_now() - t0);
+    t0 = bench_now();
+    for (size_t i = 0; i < n; i++) sum += m_get(m, misses[i]) != NULL;
+    snprintf(name, sizeof(name), "Map get miss, %s", label);
+    bench_report(name, n, bench_now() - t0);
+    sink = sum;
+    m_free(m);
+
+    counting_init(&ca);
+    SwissMap *sm = sm_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    t0 = bench_now();
+    for (size_t i = 0; i < n; i++) sm_insert(sm, hits[i], &i);
+    snprintf(name, sizeof(name), "SwissMap insert, %s", label);
+    bench_report(name, n, bench_now() - t0);
+    printf("%44s %10zu allocs\n", "", ca._allocs + ca._reallocs);
+
+    sum = 0;
+    t0 = bench_now();
+    for (size_t i = 0; i < n; i++) sum += *(long *) sm_get(sm, hits[i]);
+    snprintf(name, sizeof(name), "SwissMap get hit, %s", label);
+    bench_report(name, n, bench_now() - t0);
+    t0 = bench_now();
+    for (size_t i = 0; i < n; i++) sum += sm_get(sm, misses[i]) != NULL;
+    snprintf(name, sizeof(name), "SwissMap get miss, %s", label);
+    bench_report(name, n, bench_now() - t0);
+    sink = sum;
+    sm_free(sm);
+}
+
+int main(int argc, char **argv) {
+    size_t n = bench_count(argc, argv, 1000000);
+
+    char **hits = make_keys(n, "k%zu");
+    char **misses = make_keys(n, "m%zu");
+    run("short keys", n, hits, misses);
+    free_keys(hits, n);
+    free_keys(misses, n);
+
+    hits = make_keys(n, "a-longer-key-%zu");
+    misses = make_keys(n, "a-longer-miss-%zu");
+    run("long keys", n, hits, misses);
+    free_keys(hits, n);
+    free_keys(misses, n);
+    return 0;
+}
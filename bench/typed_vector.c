@@ -0,0 +1,64 @@
+// DEFINE_TYPED_VECTOR against the generic Vector: pushing, iterating and
+// filtering n longs.
+#include "bench.h"
+#include "cvector.h"
+
+DEFINE_TYPED_VECTOR(LongVector, lv, long)
+
+static volatile long sink;
+
+bool long_is_even(const void *p, __attribute__((unused)) const void *aux) {
+    return (*(const long *) p & 1) == 0;
+}
+
+bool lv_is_even(const long *p, __attribute__((unused)) const void *aux) {
+    return (*p & 1) == 0;
+}
+
+int main(int argc, char **argv) {
+    size_t n = bench_count(argc, argv, 10000000);
+    double t0, t1;
+
+    Vector *v = v_make(sizeof(long));
+    t0 = bench_now();
+    for (long i = 0; i < (long) n; i++) v_push_back(v, &i);
+    t1 = bench_now();
+    bench_report("Vector push_back", n, t1 - t0);
+
+    LongVector *lv = lv_make();
+    t0 = bench_now();
+    for (long i = 0; i < (long) n; i++) lv_push_back(lv, i);
+    t1 = bench_now();
+    bench_report("LongVector push_back", n, t1 - t0);
+
+    long sum = 0;
+    t0 = bench_now();
+    for (size_t i = 0; i < v_size(v); i++) sum += *(long *) v_at(v, i);
+    t1 = bench_now();
+    sink = sum;
+    bench_report("Vector iterate (v_at)", n, t1 - t0);
+
+    sum = 0;
+    t0 = bench_now();
+    for (size_t i = 0; i < lv_size(lv); i++) sum += lv_get(lv, i);
+    t1 = bench_now();
+    sink = sum;
+    bench_report("LongVector iterate (lv_get)", n, t1 - t0);
+
+    t0 = bench_now();
+    Vector *vf = v_filter(v, long_is_even, NULL);
+    t1 = bench_now();
+    bench_report("Vector filter", n, t1 - t0);
+
+    t0 = bench_now();
+    LongVector *lvf = lv_filter(lv, lv_is_even, NULL);
+    t1 = bench_now();
+    bench_report("LongVector filter", n, t1 - t0);
+
+    if (v_size(vf) != lv_size(lvf)) return 1;
+    v_free(vf);
+    lv_free(lvf);
+    v_free(v);
+    lv_free(lv);
+    return 0;
+}
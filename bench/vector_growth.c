@@ -0,0 +1,63 @@
+// Reallocations and bytes moved while building a Vector of n longs, one
+// element at a time (the only way before v_reserve, v_push_back_n and
+// v_append existed) and with the bulk growth API.
+#include "bench.h"
+#include "cvector.h"
+
+#define CHUNK 100
+
+void report(const char *name, CountingAllocator *ca, size_t n, double seconds) {
+    printf("%-36s %8zu reallocs %12zu bytes moved %8.2f ns/elem\n",
+           name, ca->_reallocs, ca->_copied, seconds * 1e9 / (double) n);
+}
+
+int main(int argc, char **argv) {
+    size_t n = bench_count(argc, argv, 10000000);
+    long *src = (long *) malloc(CHUNK * sizeof(long));
+    for (long i = 0; i < CHUNK; i++) src[i] = i;
+    CountingAllocator ca;
+    double t0;
+
+    counting_init(&ca);
+    Vector *v = v_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    t0 = bench_now();
+    for (long i = 0; i < (long) n; i++) v_push_back(v, &i);
+    report("push_back one at a time", &ca, n, bench_now() - t0);
+    v_free(v);
+
+    counting_init(&ca);
+    v = v_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    t0 = bench_now();
+    v_reserve(v, n);
+    for (long i = 0; i < (long) n; i++) v_push_back(v, &i);
+    report("v_reserve, then push_back", &ca, n, bench_now() - t0);
+    v_free(v);
+
+    counting_init(&ca);
+    v = v_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    t0 = bench_now();
+    for (size_t done = 0; done < n; done += CHUNK)
+        for (size_t i = 0; i < CHUNK; i++) v_push_back(v, src + i);
+    report("chunks of 100, element by element", &ca, n, bench_now() - t0);
+    v_free(v);
+
+    counting_init(&ca);
+    v = v_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    t0 = bench_now();
+    for (size_t done = 0; done < n; done += CHUNK) v_push_back_n(v, src, CHUNK);
+    report("chunks of 100, v_push_back_n", &ca, n, bench_now() - t0);
+    v_free(v);
+
+    Vector *chunk = v_make(sizeof(long));
+    v_push_back_n(chunk, src, CHUNK);
+    counting_init(&ca);
+    v = v_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    t0 = bench_now();
+    for (size_t done = 0; done < n; done += CHUNK) v_append(v, chunk);
+    report("chunks of 100, v_append", &ca, n, bench_now() - t0);
+    v_free(v);
+    v_free(chunk);
+
+    free(src);
+    return 0;
+}
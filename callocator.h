@@ -0,0 +1,170 @@
+#ifndef CALLOCATOR_H
+#define CALLOCATOR_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Containers that take an Allocator route every allocation of their own
+// storage through it. Sizes are passed back on realloc and free so that
+// allocators which do not track block sizes (arenas, pools) can use them.
+// A NULL Allocator pointer means plain malloc/realloc/free.
+
+typedef void *(*AllocatorAllocFn)(size_t, void *);
+typedef void *(*AllocatorReallocFn)(void *, size_t, size_t, void *);
+typedef void (*AllocatorFreeFn)(void *, size_t, void *);
+
+typedef struct {
+    AllocatorAllocFn _alloc;
+    AllocatorReallocFn _realloc;
+    AllocatorFreeFn _free;
+    void *_ctx;
+} Allocator;
+
+void *a_alloc(const Allocator *a, size_t n) {
+    if (a == NULL) return malloc(n);
+    return a->_alloc(n, a->_ctx);
+}
+
+void *a_realloc(const Allocator *a, void *p, size_t old_n, size_t new_n) {
+    if (a == NULL) return realloc(p, new_n);
+    return a->_realloc(p, old_n, new_n, a->_ctx);
+}
+
+void a_free(const Allocator *a, void *p, size_t n) {
+    if (a == NULL) {
+        free(p);
+        return;
+    }
+    a->_free(p, n, a->_ctx);
+}
+
+void *a_calloc(const Allocator *a, size_t count, size_t n) {
+    if (a == NULL) return calloc(count, n);
+    void *p = a_alloc(a, count * n);
+    if (p != NULL) memset(p, 0, count * n);
+    return p;
+}
+
+// An Arena hands out memory by bumping a pointer through large chunks.
+// Individual frees are no-ops (except for the most recent block, which is
+// reclaimed) and arena_free releases everything at once, so a whole parse
+// or evaluation can be dropped in one call.
+#define ARENA_DEFAULT_CHUNK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaChunkStruct {
+    struct ArenaChunkStruct *_next;
+    size_t _size;
+    size_t _used;
+} ArenaChunk;
+
+typedef struct {
+    Allocator _allocator;
+    ArenaChunk *_chunks;
+    size_t _chunk_size;
+    void *_last;
+} Arena;
+
+size_t arena_align(size_t n) {
+    return (n + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+}
+
+char *arena_chunk_data(ArenaChunk *c) {
+    return ((char *) c) + arena_align(sizeof(ArenaChunk));
+}
+
+void *arena_alloc(size_t n, void *ctx) {
+    Arena *arena = (Arena *) ctx;
+    n = arena_align(n ? n : 1);
+
+    ArenaChunk *c = arena->_chunks;
+    if (c == NULL || c->_size - c->_used < n) {
+        size_t size = n > arena->_chunk_size ? n : arena->_chunk_size;
+        c = (ArenaChunk *) malloc(arena_align(sizeof(ArenaChunk)) + size);
+        if (c == NULL) return NULL;
+        c->_size = size;
+        c->_used = 0;
+
+        // an oversized block gets its own chunk behind the current one, so
+        // the space left in the current chunk is not thrown away
+        if (size > arena->_chunk_size && arena->_chunks != NULL) {
+            c->_next = arena->_chunks->_next;
+            arena->_chunks->_next = c;
+        } else {
+            c->_next = arena->_chunks;
+            arena->_chunks = c;
+        }
+    }
+
+    void *p = arena_chunk_data(c) + c->_used;
+    c->_used += n;
+    arena->_last = p;
+    return p;
+}
+
+void arena_release(void *p, size_t n, void *ctx) {
+    Arena *arena = (Arena *) ctx;
+    ArenaChunk *c = arena->_chunks;
+    if (p == NULL || p != arena->_last || c == NULL) return;
+    if (arena_chunk_data(c) + c->_used != ((char *) p) + arena_align(n ? n : 1)) return;
+
+    c->_used -= arena_align(n ? n : 1);
+    arena->_last = NULL;
+}
+
+void *arena_realloc(void *p, size_t old_n, size_t new_n, void *ctx) {
+    Arena *arena = (Arena *) ctx;
+    ArenaChunk *c = arena->_chunks;
+
+    // grow the most recent block in place when it still fits
+    if (p != NULL && p == arena->_last && c != NULL
+        && arena_chunk_data(c) + c->_used == ((char *) p) + arena_align(old_n ? old_n : 1)
+        && (char *) p + arena_align(new_n ? new_n : 1) <= arena_chunk_data(c) + c->_size) {
+        c->_used = (((char *) p) - arena_chunk_data(c)) + arena_align(new_n ? new_n : 1);
+        return p;
+    }
+
+    void *new_p = arena_alloc(new_n, ctx);
+    if (new_p != NULL && p != NULL)
+        memcpy(new_p, p, old_n < new_n ? old_n : new_n);
+    return new_p;
+}
+
+Arena *arena_make(size_t chunk_size) {
+    Arena *arena = (Arena *) malloc(sizeof(Arena));
+    assert(arena != NULL);
+
+    arena->_chunks = NULL;
+    arena->_chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    arena->_last = NULL;
+
+    arena->_allocator._alloc = arena_alloc;
+    arena->_allocator._realloc = arena_realloc;
+    arena->_allocator._free = arena_release;
+    arena->_allocator._ctx = arena;
+    return arena;
+}
+
+const Allocator *arena_allocator(Arena *arena) {
+    return &arena->_allocator;
+}
+
+// Releases every block handed out by the arena, keeping the arena usable.
+void arena_reset(Arena *arena) {
+    ArenaChunk *c = arena->_chunks;
+    while (c != NULL) {
+        ArenaChunk *next = c->_next;
+        free(c);
+        c = next;
+    }
+    arena->_chunks = NULL;
+    arena->_last = NULL;
+}
+
+void arena_free(Arena *arena) {
+    arena_reset(arena);
+    free(arena);
+}
+
+#endif
@@ -0,0 +1,716 @@
+#ifndef CART_H
+#define CART_H
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "callocator.h"
+#include "cmap.h"
+
+// An Art is an adaptive radix tree keyed on strings: a trie that consumes
+// one key byte per inner node, where each inner node is sized to its
+// number of children (4, 16, 48 or 256) and grows or shrinks as they come
+// and go. Runs of bytes shared by every key below a node are stored once
+// in the node as its prefix rather than as a chain of one-child nodes, so
+// keys with long common prefixes (cadr, caddr, cadadr) cost little more
+// than their distinct suffixes.
+//
+// Keys are compared with their terminating NUL, which makes every key end
+// in a leaf of its own. Iteration visits keys in byte-wise lexicographic
+// order, and art_prefix_map visits just the keys that start with a prefix.
+//
+// Only the first ART_MAX_PREFIX bytes of a prefix are stored. Lookups
+// skip the rest and compare the whole key at the leaf; inserts and
+// removes recover the skipped bytes from a leaf below the node.
+#define ART_MAX_PREFIX 8
+#define ART_NODE48_EMPTY 0
+
+typedef enum {
+    ART_LEAF,
+    ART_NODE4,
+    ART_NODE16,
+    ART_NODE48,
+    ART_NODE256,
+} ArtNodeKind;
+
+typedef struct {
+    uint8_t _kind;
+    uint16_t _n_children;
+    uint32_t _prefix_length;
+    unsigned char _prefix[ART_MAX_PREFIX];
+} ArtNode;
+
+// Node4 and Node16 keep their key bytes sorted.
+typedef struct {
+    ArtNode _node;
+    unsigned char _keys[4];
+    ArtNode *_children[4];
+} ArtNode4;
+
+typedef struct {
+    ArtNode _node;
+    unsigned char _keys[16];
+    ArtNode *_children[16];
+} ArtNode16;
+
+// _index maps a key byte to its slot in _children plus one.
+typedef struct {
+    ArtNode _node;
+    unsigned char _index[256];
+    ArtNode *_children[48];
+} ArtNode48;
+
+typedef struct {
+    ArtNode _node;
+    ArtNode *_children[256];
+} ArtNode256;
+
+// The value (stride bytes) and the key follow the leaf.
+typedef struct {
+    uint8_t _kind;
+    size_t _key_length;
+} ArtLeaf;
+
+typedef struct {
+    size_t _length;
+    size_t _stride;
+    ArtNode *_root;
+
+    // Runs on every value the tree drops: replaced, removed or freed
+    // values. It is passed the key.
+    MapMappableFn _cleanup_fn;
+
+    const Allocator *_allocator;
+} Art;
+
+void art_init_with_allocator(Art *t, size_t stride, const Allocator *a) {
+    t->_length = 0;
+    t->_stride = stride;
+    t->_root = NULL;
+    t->_cleanup_fn = NULL;
+    t->_allocator = a;
+}
+
+void art_init(Art *t, size_t stride) {
+    art_init_with_allocator(t, stride, NULL);
+}
+
+Art *art_make_with_allocator(size_t stride, const Allocator *a) {
+    Art *t = (Art *) a_alloc(a, sizeof(Art));
+    assert(t != NULL);
+
+    art_init_with_allocator(t, stride, a);
+    return t;
+}
+
+Art *art_make(size_t stride) {
+    return art_make_with_allocator(stride, NULL);
+}
+
+size_t art_size(Art *t) {
+    return t->_length;
+}
+
+bool art_is_leaf(ArtNode *node) {
+    return node->_kind == ART_LEAF;
+}
+
+void *art_leaf_value(ArtLeaf *leaf) {
+    return leaf + 1;
+}
+
+char *art_leaf_key(Art *t, ArtLeaf *leaf) {
+    return ((char *) (leaf + 1)) + t->_stride;
+}
+
+size_t art_leaf_size(Art *t, size_t key_length) {
+    return sizeof(ArtLeaf) + t->_stride + key_length + 1;
+}
+
+bool art_leaf_matches(Art *t, ArtLeaf *leaf, const char *k, size_t len) {
+    return leaf->_key_length == len && memcmp(art_leaf_key(t, leaf), k, len) == 0;
+}
+
+ArtLeaf *art_make_leaf(Art *t, const char *k, size_t len, void *data) {
+    ArtLeaf *leaf = (ArtLeaf *) a_alloc(t->_allocator, art_leaf_size(t, len));
+    assert(leaf != NULL);
+
+    leaf->_kind = ART_LEAF;
+    leaf->_key_length = len;
+    memcpy(art_leaf_value(leaf), data, t->_stride);
+    memcpy(art_leaf_key(t, leaf), k, len + 1);
+    return leaf;
+}
+
+void art_drop_leaf(Art *t, ArtLeaf *leaf) {
+    if (t->_cleanup_fn != NULL)
+        t->_cleanup_fn(art_leaf_key(t, leaf), art_leaf_value(leaf), NULL);
+    a_free(t->_allocator, leaf, art_leaf_size(t, leaf->_key_length));
+}
+
+size_t art_node_size(uint8_t kind) {
+    switch (kind) {
+    case ART_NODE4: return sizeof(ArtNode4);
+    case ART_NODE16: return sizeof(ArtNode16);
+    case ART_NODE48: return sizeof(ArtNode48);
+    default: return sizeof(ArtNode256);
+    }
+}
+
+ArtNode *art_make_node(Art *t, uint8_t kind) {
+    ArtNode *node = (ArtNode *) a_calloc(t->_allocator, 1, art_node_size(kind));
+    assert(node != NULL);
+    node->_kind = kind;
+    return node;
+}
+
+void art_free_node(Art *t, ArtNode *node) {
+    a_free(t->_allocator, node, art_node_size(node->_kind));
+}
+
+// Moves the header of from, prefix included, to a node of another size.
+void art_copy_header(ArtNode *to, ArtNode *from) {
+    to->_n_children = from->_n_children;
+    to->_prefix_length = from->_prefix_length;
+    memcpy(to->_prefix, from->_prefix, ART_MAX_PREFIX);
+}
+
+size_t art_min(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+ArtNode **art_find_child(ArtNode *node, unsigned char c) {
+    switch (node->_kind) {
+    case ART_NODE4: {
+        ArtNode4 *n = (ArtNode4 *) node;
+        for (int c_idx = 0; c_idx < node->_n_children; c_idx++)
+            if (n->_keys[c_idx] == c) return n->_children + c_idx;
+        return NULL;
+    }
+    case ART_NODE16: {
+        ArtNode16 *n = (ArtNode16 *) node;
+#if defined(__SSE2__)
+        __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char) c),
+                                     _mm_loadu_si128((const __m128i *) n->_keys));
+        unsigned mask = (unsigned) _mm_movemask_epi8(cmp) & ((1u << node->_n_children) - 1);
+        return mask ? n->_children + __builtin_ctz(mask) : NULL;
+#else
+        for (int c_idx = 0; c_idx < node->_n_children; c_idx++)
+            if (n->_keys[c_idx] == c) return n->_children + c_idx;
+        return NULL;
+#endif
+    }
+    case ART_NODE48: {
+        ArtNode48 *n = (ArtNode48 *) node;
+        if (n->_index[c] == ART_NODE48_EMPTY) return NULL;
+        return n->_children + n->_index[c] - 1;
+    }
+    default: {
+        ArtNode256 *n = (ArtNode256 *) node;
+        return n->_children[c] ? n->_children + c : NULL;
+    }
+    }
+}
+
+// The leaf with the smallest key below node.
+ArtLeaf *art_minimum(ArtNode *node) {
+    while (node != NULL && !art_is_leaf(node)) {
+        switch (node->_kind) {
+        case ART_NODE4:
+            node = ((ArtNode4 *) node)->_children[0];
+            break;
+        case ART_NODE16:
+            node = ((ArtNode16 *) node)->_children[0];
+            break;
+        case ART_NODE48: {
+            ArtNode48 *n = (ArtNode48 *) node;
+            int c = 0;
+            while (n->_index[c] == ART_NODE48_EMPTY) c++;
+            node = n->_children[n->_index[c] - 1];
+            break;
+        }
+        default: {
+            ArtNode256 *n = (ArtNode256 *) node;
+            int c = 0;
+            while (n->_children[c] == NULL) c++;
+            node = n->_children[c];
+            break;
+        }
+        }
+    }
+    return (ArtLeaf *) node;
+}
+
+// The number of bytes of node's prefix that k (n bytes, looked at from
+// depth on) matches, up to the whole prefix. Bytes past the stored part of
+// the prefix are read from a leaf below the node.
+size_t art_prefix_mismatch(Art *t, ArtNode *node, const unsigned char *k,
+                           size_t n, size_t depth) {
+    size_t max_cmp = art_min(node->_prefix_length, n - depth);
+    size_t stored = art_min(max_cmp, ART_MAX_PREFIX);
+    size_t idx = 0;
+    for (; idx < stored; idx++)
+        if (node->_prefix[idx] != k[depth + idx]) return idx;
+
+    if (max_cmp > ART_MAX_PREFIX) {
+        const unsigned char *leaf_key =
+            (const unsigned char *) art_leaf_key(t, art_minimum(node));
+        for (; idx < max_cmp; idx++)
+            if (leaf_key[depth + idx] != k[depth + idx]) return idx;
+    }
+    return idx;
+}
+
+void *art_get(Art *t, const char *k) {
+    size_t len = strlen(k);
+    const unsigned char *key = (const unsigned char *) k;
+    ArtNode *node = t->_root;
+    size_t depth = 0;
+
+    while (node != NULL) {
+        if (art_is_leaf(node)) {
+            ArtLeaf *leaf = (ArtLeaf *) node;
+            return art_leaf_matches(t, leaf, k, len) ? art_leaf_value(leaf) : NULL;
+        }
+
+        // optimistic: only the stored part of the prefix is checked here,
+        // the leaf comparison catches the rest
+        if (node->_prefix_length) {
+            size_t stored = art_min(node->_prefix_length, ART_MAX_PREFIX);
+            if (depth + stored > len + 1) return NULL;
+            if (memcmp(node->_prefix, key + depth, stored) != 0) return NULL;
+            depth += node->_prefix_length;
+            if (depth > len) return NULL;
+        }
+
+        ArtNode **child = art_find_child(node, key[depth]);
+        node = child ? *child : NULL;
+        depth++;
+    }
+    return NULL;
+}
+
+void art_add_child(Art *t, ArtNode **ref, ArtNode *node, unsigned char c, ArtNode *child);
+
+void art_add_child4(Art *t, ArtNode **ref, ArtNode4 *n, unsigned char c, ArtNode *child) {
+    if (n->_node._n_children < 4) {
+        int pos = 0;
+        while (pos < n->_node._n_children && n->_keys[pos] < c) pos++;
+        memmove(n->_keys + pos + 1, n->_keys + pos, n->_node._n_children - pos);
+        memmove(n->_children + pos + 1, n->_children + pos,
+                (n->_node._n_children - pos) * sizeof(ArtNode *));
+        n->_keys[pos] = c;
+        n->_children[pos] = child;
+        n->_node._n_children++;
+        return;
+    }
+
+    ArtNode16 *grown = (ArtNode16 *) art_make_node(t, ART_NODE16);
+    art_copy_header(&grown->_node, &n->_node);
+    memcpy(grown->_keys, n->_keys, 4);
+    memcpy(grown->_children, n->_children, 4 * sizeof(ArtNode *));
+    *ref = (ArtNode *) grown;
+    art_free_node(t, (ArtNode *) n);
+    art_add_child(t, ref, (ArtNode *) grown, c, child);
+}
+
+void art_add_child16(Art *t, ArtNode **ref, ArtNode16 *n, unsigned char c, ArtNode *child) {
+    if (n->_node._n_children < 16) {
+        int pos = 0;
+        while (pos < n->_node._n_children && n->_keys[pos] < c) pos++;
+        memmove(n->_keys + pos + 1, n->_keys + pos, n->_node._n_children - pos);
+        memmove(n->_children + pos + 1, n->_children + pos,
+                (n->_node._n_children - pos) * sizeof(ArtNode *));
+        n->_keys[pos] = c;
+        n->_children[pos] = child;
+        n->_node._n_children++;
+        return;
+    }
+
+    ArtNode48 *grown = (ArtNode48 *) art_make_node(t, ART_NODE48);
+    art_copy_header(&grown->_node, &n->_node);
+    for (int c_idx = 0; c_idx < 16; c_idx++) {
+        grown->_index[n->_keys[c_idx]] = (unsigned char) (c_idx + 1);
+        grown->_children[c_idx] = n->_children[c_idx];
+    }
+    *ref = (ArtNode *) grown;
+    art_free_node(t, (ArtNode *) n);
+    art_add_child(t, ref, (ArtNode *) grown, c, child);
+}
+
+void art_add_child48(Art *t, ArtNode **ref, ArtNode48 *n, unsigned char c, ArtNode *child) {
+    if (n->_node._n_children < 48) {
+        // removals leave holes, so the free slot is not always the last
+        int pos = 0;
+        while (n->_children[pos] != NULL) pos++;
+        n->_children[pos] = child;
+        n->_index[c] = (unsigned char) (pos + 1);
+        n->_node._n_children++;
+        return;
+    }
+
+    ArtNode256 *grown = (ArtNode256 *) art_make_node(t, ART_NODE256);
+    art_copy_header(&grown->_node, &n->_node);
+    for (int b = 0; b < 256; b++) {
+        if (n->_index[b] != ART_NODE48_EMPTY)
+            grown->_children[b] = n->_children[n->_index[b] - 1];
+    }
+    *ref = (ArtNode *) grown;
+    art_free_node(t, (ArtNode *) n);
+    art_add_child(t, ref, (ArtNode *) grown, c, child);
+}
+
+void art_add_child(Art *t, ArtNode **ref, ArtNode *node, unsigned char c, ArtNode *child) {
+    switch (node->_kind) {
+    case ART_NODE4:
+        art_add_child4(t, ref, (ArtNode4 *) node, c, child);
+        break;
+    case ART_NODE16:
+        art_add_child16(t, ref, (ArtNode16 *) node, c, child);
+        break;
+    case ART_NODE48:
+        art_add_child48(t, ref, (ArtNode48 *) node, c, child);
+        break;
+    default:
+        ((ArtNode256 *) node)->_children[c] = child;
+        node->_n_children++;
+        break;
+    }
+}
+
+void art_insert_at(Art *t, ArtNode **ref, const char *k, size_t len, size_t depth,
+                   void *data) {
+    const unsigned char *key = (const unsigned char *) k;
+    ArtNode *node = *ref;
+
+    if (node == NULL) {
+        *ref = (ArtNode *) art_make_leaf(t, k, len, data);
+        t->_length++;
+        return;
+    }
+
+    if (art_is_leaf(node)) {
+        ArtLeaf *leaf = (ArtLeaf *) node;
+        if (art_leaf_matches(t, leaf, k, len)) {
+            if (t->_cleanup_fn != NULL)
+                t->_cleanup_fn(art_leaf_key(t, leaf), art_leaf_value(leaf), NULL);
+            memcpy(art_leaf_value(leaf), data, t->_stride);
+            return;
+        }
+
+        // split the leaf: a Node4 holding the bytes both keys share, with
+        // the old and the new leaf below it
+        const unsigned char *leaf_key = (const unsigned char *) art_leaf_key(t, leaf);
+        size_t lcp = 0;
+        while (leaf_key[depth + lcp] == key[depth + lcp]) lcp++;
+
+        ArtNode *split = art_make_node(t, ART_NODE4);
+        split->_prefix_length = (uint32_t) lcp;
+        memcpy(split->_prefix, key + depth, art_min(lcp, ART_MAX_PREFIX));
+        *ref = split;
+        art_add_child(t, ref, split, leaf_key[depth + lcp], node);
+        art_add_child(t, ref, split, key[depth + lcp],
+                      (ArtNode *) art_make_leaf(t, k, len, data));
+        t->_length++;
+        return;
+    }
+
+    if (node->_prefix_length) {
+        size_t diff = art_prefix_mismatch(t, node, key, len + 1, depth);
+        if (diff < node->_prefix_length) {
+            // the key leaves the prefix part way: a Node4 takes the shared
+            // part and node keeps what follows the byte they differ on
+            ArtNode *split = art_make_node(t, ART_NODE4);
+            split->_prefix_length = (uint32_t) diff;
+            memcpy(split->_prefix, key + depth, art_min(diff, ART_MAX_PREFIX));
+            *ref = split;
+
+            unsigned char c;
+            if (node->_prefix_length <= ART_MAX_PREFIX) {
+                c = node->_prefix[diff];
+                node->_prefix_length -= (uint32_t) (diff + 1);
+                memmove(node->_prefix, node->_prefix + diff + 1,
+                        art_min(node->_prefix_length, ART_MAX_PREFIX));
+            } else {
+                const unsigned char *leaf_key =
+                    (const unsigned char *) art_leaf_key(t, art_minimum(node));
+                c = leaf_key[depth + diff];
+                node->_prefix_length -= (uint32_t) (diff + 1);
+                memcpy(node->_prefix, leaf_key + depth + diff + 1,
+                       art_min(node->_prefix_length, ART_MAX_PREFIX));
+            }
+
+            art_add_child(t, ref, split, c, node);
+            art_add_child(t, ref, split, key[depth + diff],
+                          (ArtNode *) art_make_leaf(t, k, len, data));
+            t->_length++;
+            return;
+        }
+        depth += node->_prefix_length;
+    }
+
+    ArtNode **child = art_find_child(node, key[depth]);
+    if (child != NULL) {
+        art_insert_at(t, child, k, len, depth + 1, data);
+        return;
+    }
+
+    art_add_child(t, ref, node, key[depth], (ArtNode *) art_make_leaf(t, k, len, data));
+    t->_length++;
+}
+
+void art_insert(Art *t, const char *k, void *data) {
+    art_insert_at(t, &t->_root, k, strlen(k), 0, data);
+}
+
+// A Node4 left with one child is replaced by that child, folding the
+// Node4's prefix and the child's key byte into the child's prefix.
+void art_collapse4(Art *t, ArtNode **ref, ArtNode4 *n) {
+    ArtNode *child = n->_children[0];
+    if (!art_is_leaf(child)) {
+        unsigned char prefix[ART_MAX_PREFIX];
+        size_t p_idx = art_min(n->_node._prefix_length, ART_MAX_PREFIX);
+        memcpy(prefix, n->_node._prefix, p_idx);
+        if (p_idx < ART_MAX_PREFIX) prefix[p_idx++] = n->_keys[0];
+        size_t from_child = art_min(child->_prefix_length, ART_MAX_PREFIX - p_idx);
+        memcpy(prefix + p_idx, child->_prefix, from_child);
+
+        memcpy(child->_prefix, prefix, p_idx + from_child);
+        child->_prefix_length += n->_node._prefix_length + 1;
+    }
+    *ref = child;
+    art_free_node(t, (ArtNode *) n);
+}
+
+void art_remove_child(Art *t, ArtNode **ref, ArtNode *node, unsigned char c,
+                      ArtNode **child) {
+    switch (node->_kind) {
+    case ART_NODE4: {
+        ArtNode4 *n = (ArtNode4 *) node;
+        int pos = (int) (child - n->_children);
+        memmove(n->_keys + pos, n->_keys + pos + 1, node->_n_children - pos - 1);
+        memmove(n->_children + pos, n->_children + pos + 1,
+                (node->_n_children - pos - 1) * sizeof(ArtNode *));
+        node->_n_children--;
+        if (node->_n_children == 1) art_collapse4(t, ref, n);
+        break;
+    }
+    case ART_NODE16: {
+        ArtNode16 *n = (ArtNode16 *) node;
+        int pos = (int) (child - n->_children);
+        memmove(n->_keys + pos, n->_keys + pos + 1, node->_n_children - pos - 1);
+        memmove(n->_children + pos, n->_children + pos + 1,
+                (node->_n_children - pos - 1) * sizeof(ArtNode *));
+        node->_n_children--;
+        if (node->_n_children == 3) {
+            ArtNode4 *shrunk = (ArtNode4 *) art_make_node(t, ART_NODE4);
+            art_copy_header(&shrunk->_node, node);
+            memcpy(shrunk->_keys, n->_keys, 3);
+            memcpy(shrunk->_children, n->_children, 3 * sizeof(ArtNode *));
+            *ref = (ArtNode *) shrunk;
+            art_free_node(t, node);
+        }
+        break;
+    }
+    case ART_NODE48: {
+        ArtNode48 *n = (ArtNode48 *) node;
+        n->_children[n->_index[c] - 1] = NULL;
+        n->_index[c] = ART_NODE48_EMPTY;
+        node->_n_children--;
+        if (node->_n_children == 12) {
+            ArtNode16 *shrunk = (ArtNode16 *) art_make_node(t, ART_NODE16);
+            art_copy_header(&shrunk->_node, node);
+            int pos = 0;
+            for (int b = 0; b < 256; b++) {
+                if (n->_index[b] == ART_NODE48_EMPTY) continue;
+                shrunk->_keys[pos] = (unsigned char) b;
+                shrunk->_children[pos++] = n->_children[n->_index[b] - 1];
+            }
+            *ref = (ArtNode *) shrunk;
+            art_free_node(t, node);
+        }
+        break;
+    }
+    default: {
+        ArtNode256 *n = (ArtNode256 *) node;
+        n->_children[c] = NULL;
+        node->_n_children--;
+        if (node->_n_children == 37) {
+            ArtNode48 *shrunk = (ArtNode48 *) art_make_node(t, ART_NODE48);
+            art_copy_header(&shrunk->_node, node);
+            int pos = 0;
+            for (int b = 0; b < 256; b++) {
+                if (n->_children[b] == NULL) continue;
+                shrunk->_children[pos] = n->_children[b];
+                shrunk->_index[b] = (unsigned char) ++pos;
+            }
+            *ref = (ArtNode *) shrunk;
+            art_free_node(t, node);
+        }
+        break;
+    }
+    }
+}
+
+void art_remove_at(Art *t, ArtNode **ref, const char *k, size_t len, size_t depth) {
+    const unsigned char *key = (const unsigned char *) k;
+    ArtNode *node = *ref;
+    if (node == NULL) return;
+
+    if (art_is_leaf(node)) {
+        // only reached for a leaf at the root
+        if (art_leaf_matches(t, (ArtLeaf *) node, k, len)) {
+            art_drop_leaf(t, (ArtLeaf *) node);
+            *ref = NULL;
+            t->_length--;
+        }
+        return;
+    }
+
+    if (node->_prefix_length) {
+        if (art_prefix_mismatch(t, node, key, len + 1, depth) != node->_prefix_length)
+            return;
+        depth += node->_prefix_length;
+        if (depth > len) return;
+    }
+
+    ArtNode **child = art_find_child(node, key[depth]);
+    if (child == NULL) return;
+
+    if (!art_is_leaf(*child)) {
+        art_remove_at(t, child, k, len, depth + 1);
+        return;
+    }
+    if (!art_leaf_matches(t, (ArtLeaf *) *child, k, len)) return;
+
+    art_drop_leaf(t, (ArtLeaf *) *child);
+    art_remove_child(t, ref, node, key[depth], child);
+    t->_length--;
+}
+
+void art_remove(Art *t, const char *k) {
+    art_remove_at(t, &t->_root, k, strlen(k), 0);
+}
+
+void art_map_node(Art *t, ArtNode *node, MapMappableFn f, void *aux) {
+    if (art_is_leaf(node)) {
+        ArtLeaf *leaf = (ArtLeaf *) node;
+        f(art_leaf_key(t, leaf), art_leaf_value(leaf), aux);
+        return;
+    }
+
+    switch (node->_kind) {
+    case ART_NODE4:
+        for (int c_idx = 0; c_idx < node->_n_children; c_idx++)
+            art_map_node(t, ((ArtNode4 *) node)->_children[c_idx], f, aux);
+        break;
+    case ART_NODE16:
+        for (int c_idx = 0; c_idx < node->_n_children; c_idx++)
+            art_map_node(t, ((ArtNode16 *) node)->_children[c_idx], f, aux);
+        break;
+    case ART_NODE48: {
+        ArtNode48 *n = (ArtNode48 *) node;
+        for (int b = 0; b < 256; b++) {
+            if (n->_index[b] != ART_NODE48_EMPTY)
+                art_map_node(t, n->_children[n->_index[b] - 1], f, aux);
+        }
+        break;
+    }
+    default: {
+        ArtNode256 *n = (ArtNode256 *) node;
+        for (int b = 0; b < 256; b++) {
+            if (n->_children[b] != NULL) art_map_node(t, n->_children[b], f, aux);
+        }
+        break;
+    }
+    }
+}
+
+// Visits every binding in key order. f must not modify the tree.
+void art_map(Art *t, MapMappableFn f, void *aux) {
+    if (t->_root != NULL) art_map_node(t, t->_root, f, aux);
+}
+
+// Visits, in key order, every binding whose key starts with prefix.
+void art_prefix_map(Art *t, const char *prefix, MapMappableFn f, void *aux) {
+    size_t len = strlen(prefix);
+    const unsigned char *key = (const unsigned char *) prefix;
+    ArtNode *node = t->_root;
+    size_t depth = 0;
+
+    while (node != NULL) {
+        if (art_is_leaf(node)) {
+            ArtLeaf *leaf = (ArtLeaf *) node;
+            if (leaf->_key_length >= len && memcmp(art_leaf_key(t, leaf), prefix, len) == 0)
+                f(art_leaf_key(t, leaf), art_leaf_value(leaf), aux);
+            return;
+        }
+
+        // everything below shares the bytes consumed so far
+        if (depth == len) {
+            art_map_node(t, node, f, aux);
+            return;
+        }
+
+        if (node->_prefix_length) {
+            size_t matched = art_prefix_mismatch(t, node, key, len, depth);
+            if (depth + matched == len) {
+                art_map_node(t, node, f, aux);
+                return;
+            }
+            if (matched < node->_prefix_length) return;
+            depth += node->_prefix_length;
+        }
+
+        ArtNode **child = art_find_child(node, key[depth]);
+        node = child ? *child : NULL;
+        depth++;
+    }
+}
+
+void art_free_subtree(Art *t, ArtNode *node) {
+    if (art_is_leaf(node)) {
+        art_drop_leaf(t, (ArtLeaf *) node);
+        return;
+    }
+
+    switch (node->_kind) {
+    case ART_NODE4:
+        for (int c_idx = 0; c_idx < node->_n_children; c_idx++)
+            art_free_subtree(t, ((ArtNode4 *) node)->_children[c_idx]);
+        break;
+    case ART_NODE16:
+        for (int c_idx = 0; c_idx < node->_n_children; c_idx++)
+            art_free_subtree(t, ((ArtNode16 *) node)->_children[c_idx]);
+        break;
+    case ART_NODE48: {
+        ArtNode48 *n = (ArtNode48 *) node;
+        for (int c_idx = 0; c_idx < 48; c_idx++) {
+            if (n->_children[c_idx] != NULL) art_free_subtree(t, n->_children[c_idx]);
+        }
+        break;
+    }
+    default: {
+        ArtNode256 *n = (ArtNode256 *) node;
+        for (int b = 0; b < 256; b++) {
+            if (n->_children[b] != NULL) art_free_subtree(t, n->_children[b]);
+        }
+        break;
+    }
+    }
+    art_free_node(t, node);
+}
+
+void art_free(Art *t) {
+    if (t->_root != NULL) art_free_subtree(t, t->_root);
+    a_free(t->_allocator, t, sizeof(Art));
+}
+
+#endif
@@ -4,32 +4,44 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-typedef struct SplayTreeStruct {
-    struct SplayTreeStruct *_p_tree;
-
-    struct SplayTreeStruct *_l_tree;
-    struct SplayTreeStruct *_r_tree;
-
-    void *_data;
-} SplayTree;
-
-static bool cbtree_leaf_initialized;
-static SplayTree cbtree_static_leaf;
-
-void initialize_static_leaf() {
-    if (!cbtree_leaf_initialized) {
-        cbtree_static_leaf._p_tree = NULL;
-        cbtree_static_leaf._l_tree = NULL;
-        cbtree_static_leaf._r_tree = NULL;
-        cbtree_static_leaf._data = NULL;
-        cbtree_leaf_initialized = true;
-    }
-}
-
+// A BTree keeps its values (stride bytes each) sorted by a comparator in a
+// B+tree. Nodes are sized to about BTREE_NODE_SIZE bytes and hold their
+// values in a sorted array, searched by bisection, so a lookup touches one
+// node per level instead of one per comparison. All values live in the
+// leaves, which are linked in order for scans; inner nodes hold copies of
+// values as separators. Every leaf is at the same depth.
+//
+// Values that compare equal are all kept; a new one goes after the ones
+// already in the tree. Child i of an inner node holds values between
+// separators i - 1 and i, both inclusive, since equal values may sit on
+// either side of a separator.
+//
+// The splay tree that used to live here is SplayTree in csplaytree.h.
+#define BTREE_NODE_SIZE 256
+#define BTREE_MIN_CAPACITY 4
+
+// shared with csplaytree.h
+#ifndef TREE_FN_TYPES
+#define TREE_FN_TYPES
 typedef void (*TreeMappableFn)(void *, void*);
+// Called as comp(a, b) with pointers to two values; returns a negative
+// number, zero or a positive number as a sorts before, with or after b.
 typedef int (*TreeComparatorFn)(void *, void*);
+#endif
+
+// Leaves are followed by their values. Inner nodes are followed by their
+// children (one more than _n) and then their separators.
+typedef struct BTreeNodeStruct {
+    bool _leaf;
+    uint16_t _n;
+
+    // leaves only
+    struct BTreeNodeStruct *_prev;
+    struct BTreeNodeStruct *_next;
+} BTreeNode;
 
 typedef struct {
     size_t _stride;
@@ -38,136 +50,424 @@ typedef struct {
     TreeMappableFn _cleanup_fn;
     TreeComparatorFn _comp;
 
-    SplayTree *_tree;
+    // values per leaf and separators per inner node
+    size_t _leaf_capacity;
+    size_t _inner_capacity;
+
+    // NULL while the tree is empty
+    BTreeNode *_root;
 } BTree;
 
-BTree *t_make(size_t stride) {
+size_t t_max(size_t a, size_t b) {
+    return a > b ? a : b;
+}
+
+BTree *t_make(size_t stride, TreeComparatorFn comp) {
     assert(stride);
+    assert(comp != NULL);
 
     BTree *t = (BTree *) malloc(sizeof(BTree));
     assert(t != NULL);
     t->_stride = stride;
     t->_length = 0;
 
-    SplayTree *s = (SplayTree *) malloc(sizeof(SplayTree));
-    assert(s != NULL);
-    s->_p_tree = NULL;
-    s->_l_tree = NULL;
-    s->_r_tree = NULL;
-
-    t->_tree = s;
     t->_cleanup_fn = NULL;
+    t->_comp = comp;
+
+    size_t space = BTREE_NODE_SIZE - sizeof(BTreeNode);
+    t->_leaf_capacity = t_max(BTREE_MIN_CAPACITY, space / stride);
+    t->_inner_capacity = t_max(BTREE_MIN_CAPACITY,
+                               (space - sizeof(BTreeNode *)) / (stride + sizeof(BTreeNode *)));
+    assert(t->_leaf_capacity <= UINT16_MAX && t->_inner_capacity <= UINT16_MAX);
 
+    t->_root = NULL;
     return t;
 }
 
-void t_write_value(BTree *t, SplayTree *n, void *data) {
-    memcpy(n->_data, data, t->_stride);
+size_t t_size(BTree *t) {
+    return t->_length;
 }
 
-void t_map_node(SplayTree *s, TreeMappableFn f, void *aux) {
-    if (s == NULL) return;
+// Nodes may not go below these, other than the root.
+size_t t_min_fill(BTree *t, BTreeNode *n) {
+    return n->_leaf ? t->_leaf_capacity / 2 : (t->_inner_capacity - 1) / 2;
+}
 
-    f(s->_data, aux);
-    t_map_node(s->_l_tree, f, aux);
-    t_map_node(s->_r_tree, f, aux);
+BTreeNode **t_children(BTreeNode *n) {
+    return (BTreeNode **) (n + 1);
 }
 
-void t_map(BTree *t, TreeMappableFn f, void *aux) {
-    t_map_node(t->_tree, f, aux);
+// The idx-th value of a leaf or separator of an inner node.
+char *t_value_at(BTree *t, BTreeNode *n, size_t idx) {
+    if (n->_leaf) return ((char *) (n + 1)) + idx * t->_stride;
+    return ((char *) (t_children(n) + t->_inner_capacity + 1)) + idx * t->_stride;
 }
 
-bool t_find_node(BTree *t, SplayTree **n, void *data) {
-    SplayTree *search = t->_tree;
-    *n = NULL;
+size_t t_node_size(BTree *t, bool leaf) {
+    if (leaf) return sizeof(BTreeNode) + t->_leaf_capacity * t->_stride;
+    return sizeof(BTreeNode) + (t->_inner_capacity + 1) * sizeof(BTreeNode *)
+        + t->_inner_capacity * t->_stride;
+}
 
-    while(search) {
-        *n = search;
-        int c = t->_comp(data, &(search->_data));
-        if (c == 0) return true;
-        else if (c < 0) search = search->_l_tree;
-        else search = search->_r_tree;
-    }
-    return false;
+BTreeNode *t_make_node(BTree *t, bool leaf) {
+    BTreeNode *n = (BTreeNode *) malloc(t_node_size(t, leaf));
+    assert(n != NULL);
+    n->_leaf = leaf;
+    n->_n = 0;
+    n->_prev = NULL;
+    n->_next = NULL;
+    return n;
 }
 
-void t_free_node(SplayTree *s, TreeMappableFn cleanup) {
-    if (s == NULL) return;
-    if (cleanup != NULL) cleanup(s->_data, NULL);
+size_t t_capacity(BTree *t, BTreeNode *n) {
+    return n->_leaf ? t->_leaf_capacity : t->_inner_capacity;
+}
 
-    t_free_node(s->_l_tree, cleanup);
-    t_free_node(s->_r_tree, cleanup);
+// The first index in n whose value is not before data (lower bound), or
+// with strict, the first whose value is after it (upper bound).
+size_t t_search(BTree *t, BTreeNode *n, void *data, bool strict) {
+    size_t lo = 0, hi = n->_n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = t->_comp(t_value_at(t, n, mid), data);
+        if (c < 0 || (strict && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
 
-    free(s->_data);
-    free(s);
+// Move count values or separators, and count children, within or between
+// nodes. The child to the right of separator i is child i + 1.
+void t_move_values(BTree *t, BTreeNode *to, size_t to_idx,
+                   BTreeNode *from, size_t from_idx, size_t count) {
+    memmove(t_value_at(t, to, to_idx), t_value_at(t, from, from_idx), count * t->_stride);
 }
 
-void *t_find(BTree *t, void *data) {
-    SplayTree *s = NULL;
-    return NULL;
-    // UNFINISHED
+void t_move_children(BTreeNode *to, size_t to_idx,
+                     BTreeNode *from, size_t from_idx, size_t count) {
+    memmove(t_children(to) + to_idx, t_children(from) + from_idx, count * sizeof(BTreeNode *));
 }
 
-void t_free(BTree *t) {
-    t_free_node(t->_tree, t->_cleanup_fn);
-    free(t);
+// Splits the full child at idx of parent in two, adding the separator for
+// the new right half to parent.
+void t_split_child(BTree *t, BTreeNode *parent, size_t idx) {
+    BTreeNode *left = t_children(parent)[idx];
+    BTreeNode *right = t_make_node(t, left->_leaf);
+    size_t half = left->_n / 2;
+
+    // make room in the parent for the separator and the new child
+    t_move_values(t, parent, idx + 1, parent, idx, parent->_n - idx);
+    t_move_children(parent, idx + 2, parent, idx + 1, parent->_n - idx);
+
+    if (left->_leaf) {
+        right->_n = (uint16_t) (left->_n - half);
+        t_move_values(t, right, 0, left, half, right->_n);
+        left->_n = (uint16_t) half;
+        memcpy(t_value_at(t, parent, idx), t_value_at(t, right, 0), t->_stride);
+
+        right->_next = left->_next;
+        right->_prev = left;
+        if (left->_next) left->_next->_prev = right;
+        left->_next = right;
+    } else {
+        // the middle separator moves up rather than being copied
+        right->_n = (uint16_t) (left->_n - half - 1);
+        t_move_values(t, right, 0, left, half + 1, right->_n);
+        t_move_children(right, 0, left, half + 1, right->_n + 1);
+        memcpy(t_value_at(t, parent, idx), t_value_at(t, left, half), t->_stride);
+        left->_n = (uint16_t) half;
+    }
+
+    t_children(parent)[idx + 1] = right;
+    parent->_n++;
 }
 
+// Full nodes are split on the way down, so there is always room for the
+// separator a split passes up.
 void t_insert(BTree *t, void *data) {
-    if (t->_length == 0) {
-        t->_length++;
-        t->_tree->_data = malloc(t->_stride);
-        assert(t->_tree->_data);
-        t_write_value(t, t->_tree, data);
-        return;
+    if (t->_root == NULL) t->_root = t_make_node(t, true);
+
+    if (t->_root->_n == t_capacity(t, t->_root)) {
+        BTreeNode *root = t_make_node(t, false);
+        t_children(root)[0] = t->_root;
+        t->_root = root;
+        t_split_child(t, root, 0);
+    }
+
+    BTreeNode *n = t->_root;
+    while (!n->_leaf) {
+        size_t idx = t_search(t, n, data, true);
+        BTreeNode *child = t_children(n)[idx];
+        if (child->_n == t_capacity(t, child)) {
+            t_split_child(t, n, idx);
+            if (t->_comp(data, t_value_at(t, n, idx)) >= 0) idx++;
+        }
+        n = t_children(n)[idx];
     }
 
+    size_t idx = t_search(t, n, data, true);
+    t_move_values(t, n, idx + 1, n, idx, n->_n - idx);
+    memcpy(t_value_at(t, n, idx), data, t->_stride);
+    n->_n++;
     t->_length++;
-    // else
-    SplayTree *n;
-    if(t_find_node(t, &n, data)) {
-        SplayTree *old_l = n->_l_tree;
+}
 
-        SplayTree *new_node = (SplayTree *) malloc(sizeof(SplayTree));
-        assert(new_node);
-        new_node->_data = malloc(t->_stride);
-        assert(new_node->_data);
+// The leaf and index of the first value not before data, or with strict
+// of the first value after it. NULL when there is no such value.
+BTreeNode *t_bound_leaf(BTree *t, void *data, bool strict, size_t *idx) {
+    BTreeNode *n = t->_root;
+    if (n == NULL) return NULL;
+
+    while (!n->_leaf)
+        n = t_children(n)[t_search(t, n, data, strict)];
+
+    *idx = t_search(t, n, data, strict);
+    // equal values can end the previous subtree, so the bound may be the
+    // first value of the next leaf
+    if (*idx == n->_n) {
+        n = n->_next;
+        *idx = 0;
+    }
+    return n;
+}
 
-        n->_l_tree = new_node;
-        new_node->_p_tree = n;
+// Returns a value that compares equal to data, or NULL.
+void *t_find(BTree *t, void *data) {
+    size_t idx;
+    BTreeNode *n = t_bound_leaf(t, data, false, &idx);
+    if (n == NULL || t->_comp(t_value_at(t, n, idx), data) != 0) return NULL;
+    return t_value_at(t, n, idx);
+}
 
-        new_node->_l_tree = old_l;
-        new_node->_r_tree = NULL;
+// Visits every value in order.
+void t_map(BTree *t, TreeMappableFn f, void *aux) {
+    BTreeNode *n = t->_root;
+    if (n == NULL) return;
+    while (!n->_leaf) n = t_children(n)[0];
 
-        old_l->_p_tree = new_node;
+    for (; n != NULL; n = n->_next)
+        for (size_t v_idx = 0; v_idx < n->_n; v_idx++)
+            f(t_value_at(t, n, v_idx), aux);
+}
 
-        t_write_value(t, new_node, data);
+// A BTreeCursor is a position in the sorted sequence of values: a leaf
+// and an index into it, or the end, past the last value. Cursors step in
+// either direction along the leaf links. Any insert or remove invalidates
+// every cursor on the tree.
+typedef struct {
+    BTree *_tree;
+    // NULL at the end
+    BTreeNode *_leaf;
+    size_t _idx;
+} BTreeCursor;
+
+BTreeCursor t_cursor_at(BTree *t, BTreeNode *leaf, size_t idx) {
+    BTreeCursor c;
+    c._tree = t;
+    c._leaf = leaf;
+    c._idx = idx;
+    return c;
+}
 
-        //t_splay(t, new_node);
-    } else {
+BTreeCursor t_end(BTree *t) {
+    return t_cursor_at(t, NULL, 0);
+}
+
+BTreeCursor t_first(BTree *t) {
+    BTreeNode *n = t->_root;
+    if (n == NULL) return t_end(t);
+    while (!n->_leaf) n = t_children(n)[0];
+    return t_cursor_at(t, n, 0);
+}
 
-        int c = t->_comp(data, &(n->_data));
+// The end cursor when the tree is empty.
+BTreeCursor t_last(BTree *t) {
+    BTreeNode *n = t->_root;
+    if (n == NULL) return t_end(t);
+    while (!n->_leaf) n = t_children(n)[n->_n];
+    return t_cursor_at(t, n, n->_n - 1);
+}
+
+// The first value not before data.
+BTreeCursor t_lower_bound(BTree *t, void *data) {
+    size_t idx = 0;
+    BTreeNode *n = t_bound_leaf(t, data, false, &idx);
+    return t_cursor_at(t, n, idx);
+}
+
+// The first value after data.
+BTreeCursor t_upper_bound(BTree *t, void *data) {
+    size_t idx = 0;
+    BTreeNode *n = t_bound_leaf(t, data, true, &idx);
+    return t_cursor_at(t, n, idx);
+}
+
+bool t_cursor_valid(BTreeCursor *c) {
+    return c->_leaf != NULL;
+}
+
+void *t_cursor_value(BTreeCursor *c) {
+    assert(t_cursor_valid(c));
+    return t_value_at(c->_tree, c->_leaf, c->_idx);
+}
 
-        SplayTree *new_node = (SplayTree *) malloc(sizeof(SplayTree));
-        assert(new_node);
-        new_node->_data = malloc(t->_stride);
-        assert(new_node->_data);
+// Stepping past the last value gives the end cursor.
+void t_cursor_next(BTreeCursor *c) {
+    assert(t_cursor_valid(c));
+    if (++c->_idx < c->_leaf->_n) return;
+    c->_leaf = c->_leaf->_next;
+    c->_idx = 0;
+}
+
+// Stepping back from the end gives the last value, and stepping back from
+// the first value gives the end cursor.
+void t_cursor_prev(BTreeCursor *c) {
+    if (!t_cursor_valid(c)) {
+        *c = t_last(c->_tree);
+        return;
+    }
+    if (c->_idx > 0) {
+        c->_idx--;
+        return;
+    }
+    c->_leaf = c->_leaf->_prev;
+    c->_idx = c->_leaf ? c->_leaf->_n - 1u : 0;
+}
 
-        new_node->_l_tree = NULL;
-        new_node->_r_tree = NULL;
-        new_node->_p_tree = n;
-        t_write_value(t, new_node, data);
+// Visits, in order, the values from lo up to but not including hi. Only
+// the leaves holding them are read, after one descent to find lo.
+void t_range_map(BTree *t, void *lo, void *hi, TreeMappableFn f, void *aux) {
+    size_t idx = 0;
+    BTreeNode *n = t_bound_leaf(t, lo, false, &idx);
+
+    for (; n != NULL; n = n->_next, idx = 0) {
+        for (; idx < n->_n; idx++) {
+            void *value = t_value_at(t, n, idx);
+            if (t->_comp(value, hi) >= 0) return;
+            f(value, aux);
+        }
+    }
+}
 
-        if (c < 0) {
-            n->_l_tree = new_node;
+// Refills the child at idx of parent, which has fallen below its minimum,
+// by taking a value from a sibling or else merging with one.
+void t_rebalance_child(BTree *t, BTreeNode *parent, size_t idx) {
+    BTreeNode *child = t_children(parent)[idx];
+    BTreeNode *left = idx > 0 ? t_children(parent)[idx - 1] : NULL;
+    BTreeNode *right = idx < parent->_n ? t_children(parent)[idx + 1] : NULL;
+
+    if (left != NULL && left->_n > t_min_fill(t, left)) {
+        t_move_values(t, child, 1, child, 0, child->_n);
+        if (child->_leaf) {
+            memcpy(t_value_at(t, child, 0), t_value_at(t, left, left->_n - 1), t->_stride);
+            memcpy(t_value_at(t, parent, idx - 1), t_value_at(t, child, 0), t->_stride);
         } else {
-            n->_r_tree = new_node;
+            // rotate through the separator
+            t_move_children(child, 1, child, 0, child->_n + 1);
+            memcpy(t_value_at(t, child, 0), t_value_at(t, parent, idx - 1), t->_stride);
+            t_children(child)[0] = t_children(left)[left->_n];
+            memcpy(t_value_at(t, parent, idx - 1), t_value_at(t, left, left->_n - 1), t->_stride);
         }
+        left->_n--;
+        child->_n++;
+        return;
+    }
 
-        //t_splay(t, new_node);
+    if (right != NULL && right->_n > t_min_fill(t, right)) {
+        if (child->_leaf) {
+            memcpy(t_value_at(t, child, child->_n), t_value_at(t, right, 0), t->_stride);
+            t_move_values(t, right, 0, right, 1, right->_n - 1);
+            memcpy(t_value_at(t, parent, idx), t_value_at(t, right, 0), t->_stride);
+        } else {
+            memcpy(t_value_at(t, child, child->_n), t_value_at(t, parent, idx), t->_stride);
+            t_children(child)[child->_n + 1] = t_children(right)[0];
+            memcpy(t_value_at(t, parent, idx), t_value_at(t, right, 0), t->_stride);
+            t_move_values(t, right, 0, right, 1, right->_n - 1);
+            t_move_children(right, 0, right, 1, right->_n);
+        }
+        right->_n--;
+        child->_n++;
+        return;
     }
+
+    // neither sibling can spare a value: merge the child with one of them,
+    // always folding the right node of the pair into the left one
+    if (left == NULL) {
+        left = child;
+        idx++;
+    }
+    right = t_children(parent)[idx];
+
+    if (left->_leaf) {
+        t_move_values(t, left, left->_n, right, 0, right->_n);
+        left->_n = (uint16_t) (left->_n + right->_n);
+        left->_next = right->_next;
+        if (right->_next) right->_next->_prev = left;
+    } else {
+        memcpy(t_value_at(t, left, left->_n), t_value_at(t, parent, idx - 1), t->_stride);
+        t_move_values(t, left, left->_n + 1, right, 0, right->_n);
+        t_move_children(left, left->_n + 1, right, 0, right->_n + 1);
+        left->_n = (uint16_t) (left->_n + right->_n + 1);
+    }
+
+    t_move_values(t, parent, idx - 1, parent, idx, parent->_n - idx);
+    t_move_children(parent, idx, parent, idx + 1, parent->_n - idx);
+    parent->_n--;
+    free(right);
 }
 
+bool t_remove_from(BTree *t, BTreeNode *n, void *data) {
+    if (n->_leaf) {
+        size_t idx = t_search(t, n, data, false);
+        if (idx == n->_n || t->_comp(t_value_at(t, n, idx), data) != 0) return false;
 
+        if (t->_cleanup_fn != NULL) t->_cleanup_fn(t_value_at(t, n, idx), NULL);
+        t_move_values(t, n, idx, n, idx + 1, n->_n - idx - 1);
+        n->_n--;
+        return true;
+    }
+
+    // the equal values can run on past the first child that may hold them
+    for (size_t idx = t_search(t, n, data, false); idx <= n->_n; idx++) {
+        BTreeNode *child = t_children(n)[idx];
+        if (t_remove_from(t, child, data)) {
+            if (child->_n < t_min_fill(t, child)) t_rebalance_child(t, n, idx);
+            return true;
+        }
+        if (idx == n->_n || t->_comp(t_value_at(t, n, idx), data) != 0) break;
+    }
+    return false;
+}
+
+// Removes one value that compares equal to data, if there is one.
+void t_remove(BTree *t, void *data) {
+    if (t->_root == NULL || !t_remove_from(t, t->_root, data)) return;
+    t->_length--;
+
+    BTreeNode *root = t->_root;
+    if (root->_leaf && root->_n == 0) {
+        free(root);
+        t->_root = NULL;
+    } else if (!root->_leaf && root->_n == 0) {
+        t->_root = t_children(root)[0];
+        free(root);
+    }
+}
+
+void t_free_node(BTree *t, BTreeNode *n) {
+    if (n->_leaf) {
+        for (size_t v_idx = 0; t->_cleanup_fn && v_idx < n->_n; v_idx++)
+            t->_cleanup_fn(t_value_at(t, n, v_idx), NULL);
+    } else {
+        for (size_t c_idx = 0; c_idx <= n->_n; c_idx++)
+            t_free_node(t, t_children(n)[c_idx]);
+    }
+    free(n);
+}
+
+void t_free(BTree *t) {
+    if (t->_root != NULL) t_free_node(t, t->_root);
+    free(t);
+}
 
 #endif
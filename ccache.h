@@ -0,0 +1,266 @@
+#ifndef CCACHE_H
+#define CCACHE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "callocator.h"
+#include "cmap.h"
+
+// A Cache is a Map with a bound on its size, in entries, in bytes, or in
+// both, that evicts entries to stay within it. Eviction is either LRU or
+// CLOCK: LRU moves an entry to the front of a list on every hit and evicts
+// from the back, CLOCK only sets a reference bit on a hit and sweeps a hand
+// around the entries, evicting the first one whose bit is clear.
+//
+// Every entry of the underlying Map holds a CacheNode followed by the
+// value, and the nodes link the entries into a ring. Map elements never
+// move, so the ring links them directly. Hits do not allocate, and an
+// insert into a full cache takes its element from the blocks evicted
+// entries left on the Map's slab free lists.
+//
+// The byte size of an entry is the slab block its element takes up:
+// header, node, value and key, rounded up to the block's size class.
+// max_bytes bounds the blocks live entries hold. Freed blocks stay on
+// the slab for later entries of the same class, so when the mix of entry
+// sizes shifts the map can also hold free blocks of classes no longer in
+// use, up to what those classes held at their peak.
+typedef enum {
+    CACHE_LRU,
+    CACHE_CLOCK,
+} CachePolicy;
+
+typedef struct CacheNodeStruct {
+    struct CacheNodeStruct *_prev;
+    struct CacheNodeStruct *_next;
+    size_t _charge;
+    bool _referenced;
+} CacheNode;
+
+typedef struct {
+    Map *_map;
+    size_t _stride;
+    CachePolicy _policy;
+
+    // 0 leaves that dimension unbounded
+    size_t _max_entries;
+    size_t _max_bytes;
+    size_t _bytes;
+
+    // Sentinel of the ring. Under LRU the most recently used entry is
+    // _ring._next; under CLOCK new entries go just behind the hand.
+    CacheNode _ring;
+    CacheNode *_hand;
+
+    // Runs on every value the cache drops: evicted, replaced, removed or
+    // freed values. Unlike a Map's cleanup function it is passed the key.
+    MapMappableFn _cleanup_fn;
+
+    size_t _hits;
+    size_t _misses;
+    size_t _evictions;
+} Cache;
+
+void ca_init_with_allocator(Cache *c, size_t stride, CachePolicy policy,
+                            size_t max_entries, size_t max_bytes,
+                            const Allocator *a) {
+    c->_map = m_make_with_allocator(sizeof(CacheNode) + stride, a);
+    c->_stride = stride;
+    c->_policy = policy;
+
+    c->_max_entries = max_entries;
+    c->_max_bytes = max_bytes;
+    c->_bytes = 0;
+
+    c->_ring._prev = &c->_ring;
+    c->_ring._next = &c->_ring;
+    c->_hand = &c->_ring;
+
+    c->_cleanup_fn = NULL;
+    c->_hits = 0;
+    c->_misses = 0;
+    c->_evictions = 0;
+}
+
+void ca_init(Cache *c, size_t stride, CachePolicy policy,
+             size_t max_entries, size_t max_bytes) {
+    ca_init_with_allocator(c, stride, policy, max_entries, max_bytes, NULL);
+}
+
+Cache *ca_make_with_allocator(size_t stride, CachePolicy policy,
+                              size_t max_entries, size_t max_bytes,
+                              const Allocator *a) {
+    Cache *c = (Cache *) a_alloc(a, sizeof(Cache));
+    assert(c != NULL);
+
+    ca_init_with_allocator(c, stride, policy, max_entries, max_bytes, a);
+    return c;
+}
+
+Cache *ca_make(size_t stride, CachePolicy policy,
+               size_t max_entries, size_t max_bytes) {
+    return ca_make_with_allocator(stride, policy, max_entries, max_bytes, NULL);
+}
+
+size_t ca_size(Cache *c) {
+    return m_size(c->_map);
+}
+
+size_t ca_bytes(Cache *c) {
+    return c->_bytes;
+}
+
+void *ca_value_from_node(__attribute__((unused)) Cache *c, CacheNode *node) {
+    return node + 1;
+}
+
+char *ca_key_from_node(Cache *c, CacheNode *node) {
+    return m_key_from_elem(c->_map, m_elem_from_value(c->_map, node));
+}
+
+void ca_unlink(CacheNode *node) {
+    node->_prev->_next = node->_next;
+    node->_next->_prev = node->_prev;
+}
+
+void ca_link_before(CacheNode *node, CacheNode *at) {
+    node->_prev = at->_prev;
+    node->_next = at;
+    at->_prev->_next = node;
+    at->_prev = node;
+}
+
+void ca_touch(Cache *c, CacheNode *node) {
+    if (c->_policy == CACHE_CLOCK) {
+        node->_referenced = true;
+        return;
+    }
+    ca_unlink(node);
+    ca_link_before(node, c->_ring._next);
+}
+
+// Unlinks node, runs the cleanup function and removes its element.
+void ca_drop(Cache *c, CacheNode *node) {
+    MapElem *elem = m_elem_from_value(c->_map, node);
+    char *k = m_key_from_elem(c->_map, elem);
+
+    if (c->_hand == node) c->_hand = node->_next;
+    ca_unlink(node);
+    c->_bytes -= node->_charge;
+
+    if (c->_cleanup_fn != NULL)
+        c->_cleanup_fn(k, ca_value_from_node(c, node), NULL);
+    m_remove_prehashed(c->_map, k, elem->_key_length, elem->_hash);
+}
+
+CacheNode *ca_victim(Cache *c) {
+    if (c->_policy == CACHE_LRU) return c->_ring._prev;
+
+    // every entry is passed at most once with its bit set, so this ends
+    // within two turns of the ring
+    for (;;) {
+        CacheNode *node = c->_hand;
+        c->_hand = node->_next;
+        if (node == &c->_ring) continue;
+        if (!node->_referenced) return node;
+        node->_referenced = false;
+    }
+}
+
+bool ca_over_limit(Cache *c, size_t extra_entries, size_t extra_bytes) {
+    if (c->_max_entries && ca_size(c) + extra_entries > c->_max_entries) return true;
+    return c->_max_bytes && c->_bytes + extra_bytes > c->_max_bytes;
+}
+
+void ca_evict_for(Cache *c, size_t extra_entries, size_t extra_bytes) {
+    while (ca_size(c) > 0 && ca_over_limit(c, extra_entries, extra_bytes)) {
+        ca_drop(c, ca_victim(c));
+        c->_evictions++;
+    }
+}
+
+CacheNode *ca_find(Cache *c, const char *k) {
+    size_t len = strlen(k);
+    return (CacheNode *) m_get_prehashed(c->_map, k, len, m_hash(k, len));
+}
+
+// Returns the value bound to k, counting a hit or a miss and marking the
+// entry as used.
+void *ca_get(Cache *c, const char *k) {
+    CacheNode *node = ca_find(c, k);
+    if (node == NULL) {
+        c->_misses++;
+        return NULL;
+    }
+    c->_hits++;
+    ca_touch(c, node);
+    return ca_value_from_node(c, node);
+}
+
+// Like ca_get, but leaves the counters and the eviction order alone.
+void *ca_peek(Cache *c, const char *k) {
+    CacheNode *node = ca_find(c, k);
+    return node ? ca_value_from_node(c, node) : NULL;
+}
+
+// Binds k to a copy of data, evicting entries as needed to make room. An
+// entry bigger than max_bytes on its own is still kept, as the only one.
+void ca_insert(Cache *c, const char *k, void *data) {
+    size_t len = strlen(k);
+    uint64_t hash = m_hash(k, len);
+
+    CacheNode *node = (CacheNode *) m_get_prehashed(c->_map, k, len, hash);
+    if (node != NULL) {
+        if (c->_cleanup_fn != NULL)
+            c->_cleanup_fn(ca_key_from_node(c, node), ca_value_from_node(c, node), NULL);
+        memcpy(ca_value_from_node(c, node), data, c->_stride);
+        ca_touch(c, node);
+        return;
+    }
+
+    size_t charge = m_slab_block_size(m_elem_size(c->_map, len));
+    ca_evict_for(c, 1, charge);
+
+    MapElem *elem = (MapElem *) m_insert_hashed_unsafe(c->_map, k, len, hash, NULL);
+    node = (CacheNode *) m_value_from_elem(c->_map, elem);
+    node->_charge = charge;
+    node->_referenced = false;
+    memcpy(ca_value_from_node(c, node), data, c->_stride);
+    c->_bytes += charge;
+
+    if (c->_policy == CACHE_LRU)
+        ca_link_before(node, c->_ring._next);
+    else
+        ca_link_before(node, c->_hand);
+}
+
+void ca_remove(Cache *c, const char *k) {
+    CacheNode *node = ca_find(c, k);
+    if (node != NULL) ca_drop(c, node);
+}
+
+// Visits every entry, most recently used first under LRU and in ring
+// order under CLOCK. f must not insert into or remove from the cache.
+void ca_map(Cache *c, MapMappableFn f, void *aux) {
+    for (CacheNode *node = c->_ring._next; node != &c->_ring; node = node->_next)
+        f(ca_key_from_node(c, node), ca_value_from_node(c, node), aux);
+}
+
+void ca_reset_counters(Cache *c) {
+    c->_hits = 0;
+    c->_misses = 0;
+    c->_evictions = 0;
+}
+
+void ca_free(Cache *c) {
+    if (c->_cleanup_fn != NULL) ca_map(c, c->_cleanup_fn, NULL);
+
+    const Allocator *a = c->_map->_allocator;
+    m_free(c->_map);
+    a_free(a, c, sizeof(Cache));
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef CCONCMAP_H
+#define CCONCMAP_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "cmap.h"
+
+// A ConcurrentMap is a Map that can be shared between threads. Keys are
+// spread over independent shards by the high bits of their hash (the low
+// bits pick the bucket within a shard), and each shard has its own
+// reader-writer lock, so writers only block operations on the same shard.
+//
+// Lookups do not take the lock at all. Each shard also has a sequence
+// count that writers make odd while they change the shard, and cm_get
+// reads the shard optimistically and keeps the result only if the count
+// was even and unchanged throughout; after a few failed attempts it falls
+// back to the read lock. Readers thus write no shared memory, so they do
+// not bounce cache lines between cores.
+//
+// An optimistic reader may follow pointers into a shard that is being
+// changed, so nothing it can reach is ever handed back to the system
+// while the map lives: elements stay in the Map's slab, whose chunks are
+// zeroed so that any word a reader loads is either 0 or something a
+// writer stored, and bucket arrays a resize replaces are retired until
+// cm_free rather than freed.
+//
+// Values are copied out rather than returned by pointer, since another
+// thread may replace or remove the element right after the lookup.
+#define CONCURRENT_MAP_DEFAULT_SHARDS 64
+#define CONCURRENT_MAP_CACHE_LINE 64
+#define CONCURRENT_MAP_OPTIMISTIC_TRIES 4
+// a chain walked while a writer relinks it can loop; no real chain at
+// REBALANCE_LOAD_FACTOR is anywhere near this long
+#define CONCURRENT_MAP_MAX_CHAIN 64
+
+typedef struct ConcurrentMapRetiredStruct {
+    struct ConcurrentMapRetiredStruct *_next;
+    void *_block;
+} ConcurrentMapRetired;
+
+typedef struct {
+    pthread_rwlock_t _lock;
+    // odd while a writer is changing _map
+    uint64_t _seq;
+    Map *_map;
+
+    // the shard map's allocator: zeroed allocations, and frees retired
+    // onto _retired until cm_free turns _retiring off
+    Allocator _allocator;
+    ConcurrentMapRetired *_retired;
+    bool _retiring;
+} __attribute__((aligned(CONCURRENT_MAP_CACHE_LINE))) ConcurrentMapShard;
+
+typedef struct {
+    size_t _stride;
+    size_t _n_shards;
+    unsigned _shard_shift;
+    ConcurrentMapShard *_shards;
+} ConcurrentMap;
+
+void *cm_shard_alloc(size_t n, __attribute__((unused)) void *ctx) {
+    return calloc(1, n);
+}
+
+void *cm_shard_realloc(void *p, size_t old_n, size_t new_n, void *ctx) {
+    void *q = cm_shard_alloc(new_n, ctx);
+    if (q == NULL) return NULL;
+    if (p != NULL) {
+        memcpy(q, p, old_n < new_n ? old_n : new_n);
+        a_free(&((ConcurrentMapShard *) ctx)->_allocator, p, old_n);
+    }
+    return q;
+}
+
+void cm_shard_free(void *p, __attribute__((unused)) size_t n, void *ctx) {
+    ConcurrentMapShard *shard = (ConcurrentMapShard *) ctx;
+    if (p == NULL) return;
+    if (!shard->_retiring) {
+        free(p);
+        return;
+    }
+
+    ConcurrentMapRetired *r = (ConcurrentMapRetired *) malloc(sizeof(ConcurrentMapRetired));
+    assert(r != NULL);
+    r->_block = p;
+    r->_next = shard->_retired;
+    shard->_retired = r;
+}
+
+void cm_shard_init(ConcurrentMapShard *shard, size_t stride) {
+    pthread_rwlock_init(&shard->_lock, NULL);
+    shard->_seq = 0;
+    shard->_allocator._alloc = cm_shard_alloc;
+    shard->_allocator._realloc = cm_shard_realloc;
+    shard->_allocator._free = cm_shard_free;
+    shard->_allocator._ctx = shard;
+    shard->_retired = NULL;
+    shard->_retiring = true;
+    // shards must stay plain Maps: an incremental resize would make
+    // lookups write to the map
+    shard->_map = m_make_with_allocator(stride, &shard->_allocator);
+}
+
+// n_shards is rounded up to a power of two; 0 picks the default.
+ConcurrentMap *cm_make(size_t stride, size_t n_shards) {
+    ConcurrentMap *cm = (ConcurrentMap *) malloc(sizeof(ConcurrentMap));
+    assert(cm != NULL);
+
+    if (n_shards == 0) n_shards = CONCURRENT_MAP_DEFAULT_SHARDS;
+    size_t shard_bits = 0;
+    while ((((size_t) 1) << shard_bits) < n_shards) shard_bits++;
+
+    cm->_stride = stride;
+    cm->_n_shards = ((size_t) 1) << shard_bits;
+    cm->_shard_shift = 64 - (unsigned) shard_bits;
+
+    void *shards = NULL;
+    int result = posix_memalign(&shards, CONCURRENT_MAP_CACHE_LINE,
+                                cm->_n_shards * sizeof(ConcurrentMapShard));
+    assert(result == 0);
+    (void) result;
+    cm->_shards = (ConcurrentMapShard *) shards;
+
+    for (size_t s_idx = 0; s_idx < cm->_n_shards; s_idx++)
+        cm_shard_init(cm->_shards + s_idx, stride);
+    return cm;
+}
+
+ConcurrentMapShard *cm_shard_for(ConcurrentMap *cm, uint64_t hash) {
+    if (cm->_n_shards == 1) return cm->_shards;
+    return cm->_shards + (size_t) (hash >> cm->_shard_shift);
+}
+
+// Runs on every value the map drops: replaced, removed or freed values.
+// Set it before the map is shared.
+void cm_set_cleanup_fn(ConcurrentMap *cm, MapMappableFn f) {
+    for (size_t s_idx = 0; s_idx < cm->_n_shards; s_idx++)
+        cm->_shards[s_idx]._map->_cleanup_fn = f;
+}
+
+// Writers hold the write lock and keep the sequence count odd while they
+// change the shard.
+void cm_write_begin(ConcurrentMapShard *shard) {
+    pthread_rwlock_wrlock(&shard->_lock);
+    __atomic_store_n(&shard->_seq, shard->_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void cm_write_end(ConcurrentMapShard *shard) {
+    __atomic_store_n(&shard->_seq, shard->_seq + 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&shard->_lock);
+}
+
+// Whether no writer has touched the shard since the count read seq.
+bool cm_seq_unchanged(ConcurrentMapShard *shard, uint64_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shard->_seq, __ATOMIC_RELAXED) == seq;
+}
+
+// One optimistic lookup of k in a shard whose count read seq. Returns 1 or
+// 0 for found or not, with the value copied into out, or -1 when a writer
+// got in the way and nothing read can be trusted.
+int cm_get_optimistic(ConcurrentMap *cm, ConcurrentMapShard *shard, const char *k,
+                      size_t len, uint64_t hash, uint64_t seq, void *out) {
+    Map *m = shard->_map;
+    size_t length = m->_length;
+    size_t bucket_count = m->_bucket_count;
+    void **buckets = (void **) m->_buckets;
+    // these three have to belong together before they index anything
+    if (!cm_seq_unchanged(shard, seq)) return -1;
+
+    MapElem *elem = NULL;
+    if (buckets == NULL) {
+        uint8_t tag = m_small_tag(hash);
+        for (size_t s_idx = 0; s_idx < length; s_idx++) {
+            if (m->_small_tags[s_idx] == tag
+                && m_elem_matches(m, m->_small_elems[s_idx], k, len, hash)) {
+                elem = m->_small_elems[s_idx];
+                break;
+            }
+        }
+    } else {
+        elem = (MapElem *) buckets[(size_t) hash & (bucket_count - 1)];
+        for (size_t hops = 0; elem != NULL && !m_elem_matches(m, elem, k, len, hash); hops++) {
+            if (hops == CONCURRENT_MAP_MAX_CHAIN) return -1;
+            elem = elem->_next;
+        }
+    }
+
+    if (elem != NULL && out != NULL)
+        memcpy(out, m_value_from_elem(m, elem), cm->_stride);
+    if (!cm_seq_unchanged(shard, seq)) return -1;
+    return elem != NULL;
+}
+
+// Copies the value bound to k into out (if out is not NULL). Returns
+// whether k was bound; when it was not, out may still have been written.
+bool cm_get(ConcurrentMap *cm, const char *k, void *out) {
+    size_t len = strlen(k);
+    uint64_t hash = m_hash(k, len);
+    ConcurrentMapShard *shard = cm_shard_for(cm, hash);
+
+    for (size_t t_idx = 0; t_idx < CONCURRENT_MAP_OPTIMISTIC_TRIES; t_idx++) {
+        uint64_t seq = __atomic_load_n(&shard->_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        int found = cm_get_optimistic(cm, shard, k, len, hash, seq, out);
+        if (found >= 0) return found;
+    }
+
+    pthread_rwlock_rdlock(&shard->_lock);
+    void *value = m_get_prehashed(shard->_map, k, len, hash);
+    if (value != NULL && out != NULL)
+        memcpy(out, value, cm->_stride);
+    pthread_rwlock_unlock(&shard->_lock);
+    return value != NULL;
+}
+
+bool cm_contains(ConcurrentMap *cm, const char *k) {
+    return cm_get(cm, k, NULL);
+}
+
+void cm_insert(ConcurrentMap *cm, const char *k, void *data) {
+    size_t len = strlen(k);
+    uint64_t hash = m_hash(k, len);
+    ConcurrentMapShard *shard = cm_shard_for(cm, hash);
+
+    cm_write_begin(shard);
+    m_insert_prehashed(shard->_map, k, len, hash, data);
+    cm_write_end(shard);
+}
+
+void cm_remove(ConcurrentMap *cm, const char *k) {
+    size_t len = strlen(k);
+    uint64_t hash = m_hash(k, len);
+    ConcurrentMapShard *shard = cm_shard_for(cm, hash);
+
+    cm_write_begin(shard);
+    m_remove_prehashed(shard->_map, k, len, hash);
+    cm_write_end(shard);
+}
+
+// Not a snapshot: shards are counted one at a time.
+size_t cm_size(ConcurrentMap *cm) {
+    size_t total = 0;
+    for (size_t s_idx = 0; s_idx < cm->_n_shards; s_idx++) {
+        ConcurrentMapShard *shard = cm->_shards + s_idx;
+        pthread_rwlock_rdlock(&shard->_lock);
+        total += m_size(shard->_map);
+        pthread_rwlock_unlock(&shard->_lock);
+    }
+    return total;
+}
+
+// Visits every binding, holding the read lock of one shard at a time. f
+// must not call back into the same map for writing.
+void cm_map(ConcurrentMap *cm, MapMappableFn f, void *aux) {
+    for (size_t s_idx = 0; s_idx < cm->_n_shards; s_idx++) {
+        ConcurrentMapShard *shard = cm->_shards + s_idx;
+        // m_map_elems rather than m_map, which writes to the map
+        pthread_rwlock_rdlock(&shard->_lock);
+        m_map_elems(shard->_map, f, aux);
+        pthread_rwlock_unlock(&shard->_lock);
+    }
+}
+
+// Not thread safe: no other thread may be using the map.
+void cm_free(ConcurrentMap *cm) {
+    for (size_t s_idx = 0; s_idx < cm->_n_shards; s_idx++) {
+        ConcurrentMapShard *shard = cm->_shards + s_idx;
+        pthread_rwlock_destroy(&shard->_lock);
+        shard->_retiring = false;
+        m_free(shard->_map);
+
+        while (shard->_retired != NULL) {
+            ConcurrentMapRetired *next = shard->_retired->_next;
+            free(shard->_retired->_block);
+            free(shard->_retired);
+            shard->_retired = next;
+        }
+    }
+    free(cm->_shards);
+    free(cm);
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef CGMAP_H
+#define CGMAP_H
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "callocator.h"
+#include "cmap.h"
+
+// A GenericMap is a chained hash map like Map whose keys are fixed-size
+// blobs of key_size bytes instead of strings. Hashing and equality are
+// supplied by the user. Maps made with gm_make_u64 or gm_make_ptr key on
+// 8-byte integers or pointers, hash with a single multiply and compare
+// keys as words, without calling through the function pointers.
+//
+// Elements are laid out as [GenericMapElem][value stride][key key_size].
+typedef uint64_t (*GenericMapHashFn)(const void *, size_t);
+typedef bool (*GenericMapEqualFn)(const void *, const void *, size_t);
+typedef void (*GenericMapMappableFn)(void *, void *, void *);
+
+typedef struct GenericMapElemStruct {
+    struct GenericMapElemStruct *_next;
+    uint64_t _hash;
+} GenericMapElem;
+
+typedef struct {
+    size_t _length;
+    size_t _stride;
+    size_t _key_size;
+
+    GenericMapHashFn _hash_fn;
+    GenericMapEqualFn _equal_fn;
+    // set for 8-byte integer and pointer keys
+    bool _word_keys;
+
+    GenericMapMappableFn _cleanup_fn;
+
+    size_t _bucket_count;
+    GenericMapElem **_buckets;
+
+    const Allocator *_allocator;
+} GenericMap;
+
+uint64_t gm_hash_bytes(const void *k, size_t key_size) {
+    return m_hash((const char *) k, key_size);
+}
+
+bool gm_equal_bytes(const void *a, const void *b, size_t key_size) {
+    return memcmp(a, b, key_size) == 0;
+}
+
+// A multiply-xorshift finalizer. Good enough to spread sequential integers
+// and aligned pointers over the low bits used for bucket selection.
+uint64_t gm_hash_word(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    return k;
+}
+
+uint64_t gm_hash_u64(const void *k, __attribute__((unused)) size_t key_size) {
+    uint64_t word;
+    memcpy(&word, k, sizeof(word));
+    return gm_hash_word(word);
+}
+
+bool gm_equal_u64(const void *a, const void *b, __attribute__((unused)) size_t key_size) {
+    return memcmp(a, b, sizeof(uint64_t)) == 0;
+}
+
+void gm_init_with_allocator(GenericMap *m, size_t key_size, size_t stride,
+                            GenericMapHashFn hash_fn, GenericMapEqualFn equal_fn,
+                            const Allocator *a) {
+    assert(key_size > 0);
+
+    m->_allocator = a;
+    m->_cleanup_fn = NULL;
+    m->_key_size = key_size;
+    m->_stride = stride;
+    m->_length = 0;
+
+    m->_hash_fn = hash_fn ? hash_fn : gm_hash_bytes;
+    m->_equal_fn = equal_fn ? equal_fn : gm_equal_bytes;
+    m->_word_keys = false;
+
+    m->_bucket_count = DEFAULT_BUCKET_COUNT;
+    m->_buckets = (GenericMapElem **) a_calloc(a, m->_bucket_count, sizeof(GenericMapElem *));
+    assert(m->_buckets != NULL);
+}
+
+// A NULL hash_fn or equal_fn hashes or compares the raw key bytes.
+GenericMap *gm_make_with_allocator(size_t key_size, size_t stride,
+                                   GenericMapHashFn hash_fn, GenericMapEqualFn equal_fn,
+                                   const Allocator *a) {
+    GenericMap *m = (GenericMap *) a_alloc(a, sizeof(GenericMap));
+    assert(m != NULL);
+
+    gm_init_with_allocator(m, key_size, stride, hash_fn, equal_fn, a);
+    return m;
+}
+
+GenericMap *gm_make(size_t key_size, size_t stride,
+                    GenericMapHashFn hash_fn, GenericMapEqualFn equal_fn) {
+    return gm_make_with_allocator(key_size, stride, hash_fn, equal_fn, NULL);
+}
+
+GenericMap *gm_make_u64(size_t stride) {
+    GenericMap *m = gm_make(sizeof(uint64_t), stride, gm_hash_u64, gm_equal_u64);
+    m->_word_keys = true;
+    return m;
+}
+
+GenericMap *gm_make_ptr(size_t stride) {
+    assert(sizeof(void *) <= sizeof(uint64_t));
+    return gm_make_u64(stride);
+}
+
+size_t gm_size(GenericMap *m) {
+    return m->_length;
+}
+
+void *gm_value_from_elem(__attribute__((unused)) GenericMap *m, GenericMapElem *elem) {
+    return elem + 1;
+}
+
+void *gm_key_from_elem(GenericMap *m, GenericMapElem *elem) {
+    return ((char *) (elem + 1)) + m->_stride;
+}
+
+size_t gm_elem_size(GenericMap *m) {
+    return sizeof(GenericMapElem) + m->_stride + m->_key_size;
+}
+
+uint64_t gm_hash_key(GenericMap *m, const void *k) {
+    if (m->_word_keys) return gm_hash_u64(k, sizeof(uint64_t));
+    return m->_hash_fn(k, m->_key_size);
+}
+
+bool gm_elem_matches(GenericMap *m, GenericMapElem *elem, const void *k, uint64_t hash) {
+    if (elem->_hash != hash) return false;
+    if (m->_word_keys) {
+        uint64_t a, b;
+        memcpy(&a, gm_key_from_elem(m, elem), sizeof(a));
+        memcpy(&b, k, sizeof(b));
+        return a == b;
+    }
+    return m->_equal_fn(gm_key_from_elem(m, elem), k, m->_key_size);
+}
+
+// The link that points at the matching element (or at the NULL that ends
+// the chain), so that removal can unlink through it.
+GenericMapElem **gm_find_link(GenericMap *m, const void *k, uint64_t hash) {
+    GenericMapElem **link = m->_buckets + ((size_t) hash & (m->_bucket_count - 1));
+    while (*link != NULL && !gm_elem_matches(m, *link, k, hash))
+        link = &(*link)->_next;
+    return link;
+}
+
+void *gm_get(GenericMap *m, const void *k) {
+    GenericMapElem *elem = *gm_find_link(m, k, gm_hash_key(m, k));
+    return elem ? gm_value_from_elem(m, elem) : NULL;
+}
+
+void gm_ensure_space(GenericMap *m) {
+    if (m->_length < (m->_bucket_count * REBALANCE_LOAD_FACTOR))
+        return;
+
+    size_t new_count = m->_bucket_count * 2;
+    GenericMapElem **new_buckets = (GenericMapElem **)
+        a_calloc(m->_allocator, new_count, sizeof(GenericMapElem *));
+    assert(new_buckets);
+
+    for (size_t b_idx = 0; b_idx < m->_bucket_count; b_idx++) {
+        GenericMapElem *c_elem = m->_buckets[b_idx];
+        while (c_elem != NULL) {
+            GenericMapElem *n_elem = c_elem->_next;
+            size_t b_new_idx = (size_t) c_elem->_hash & (new_count - 1);
+            c_elem->_next = new_buckets[b_new_idx];
+            new_buckets[b_new_idx] = c_elem;
+            c_elem = n_elem;
+        }
+    }
+
+    a_free(m->_allocator, m->_buckets, m->_bucket_count * sizeof(GenericMapElem *));
+    m->_buckets = new_buckets;
+    m->_bucket_count = new_count;
+}
+
+void gm_insert(GenericMap *m, const void *k, void *data) {
+    uint64_t hash = gm_hash_key(m, k);
+    GenericMapElem *elem = *gm_find_link(m, k, hash);
+    if (elem != NULL) {
+        if (m->_cleanup_fn != NULL)
+            m->_cleanup_fn(gm_key_from_elem(m, elem), gm_value_from_elem(m, elem), NULL);
+        memcpy(gm_value_from_elem(m, elem), data, m->_stride);
+        return;
+    }
+
+    gm_ensure_space(m);
+
+    elem = (GenericMapElem *) a_alloc(m->_allocator, gm_elem_size(m));
+    assert(elem != NULL);
+    elem->_hash = hash;
+    memcpy(gm_key_from_elem(m, elem), k, m->_key_size);
+    memcpy(gm_value_from_elem(m, elem), data, m->_stride);
+
+    GenericMapElem **bucket = m->_buckets + ((size_t) hash & (m->_bucket_count - 1));
+    elem->_next = *bucket;
+    *bucket = elem;
+    m->_length++;
+}
+
+void gm_remove(GenericMap *m, const void *k) {
+    GenericMapElem **link = gm_find_link(m, k, gm_hash_key(m, k));
+    GenericMapElem *elem = *link;
+    if (elem == NULL) return;
+
+    if (m->_cleanup_fn != NULL)
+        m->_cleanup_fn(gm_key_from_elem(m, elem), gm_value_from_elem(m, elem), NULL);
+
+    *link = elem->_next;
+    a_free(m->_allocator, elem, gm_elem_size(m));
+    m->_length--;
+}
+
+void gm_map(GenericMap *m, GenericMapMappableFn f, void *aux) {
+    for (size_t b_idx = 0; b_idx < m->_bucket_count; b_idx++) {
+        for (GenericMapElem *elem = m->_buckets[b_idx]; elem != NULL; elem = elem->_next)
+            f(gm_key_from_elem(m, elem), gm_value_from_elem(m, elem), aux);
+    }
+}
+
+void gm_free(GenericMap *m) {
+    for (size_t b_idx = 0; b_idx < m->_bucket_count; b_idx++) {
+        GenericMapElem *c_elem = m->_buckets[b_idx];
+        while (c_elem != NULL) {
+            GenericMapElem *n_elem = c_elem->_next;
+            if (m->_cleanup_fn)
+                m->_cleanup_fn(gm_key_from_elem(m, c_elem), gm_value_from_elem(m, c_elem), NULL);
+            a_free(m->_allocator, c_elem, gm_elem_size(m));
+            c_elem = n_elem;
+        }
+    }
+
+    a_free(m->_allocator, m->_buckets, m->_bucket_count * sizeof(GenericMapElem *));
+    a_free(m->_allocator, m, sizeof(GenericMap));
+}
+
+// Word-keyed convenience wrappers for maps made with gm_make_u64 and
+// gm_make_ptr.
+
+void *gm_get_u64(GenericMap *m, uint64_t k) {
+    return gm_get(m, &k);
+}
+
+void gm_insert_u64(GenericMap *m, uint64_t k, void *data) {
+    gm_insert(m, &k, data);
+}
+
+void gm_remove_u64(GenericMap *m, uint64_t k) {
+    gm_remove(m, &k);
+}
+
+void *gm_get_ptr(GenericMap *m, const void *k) {
+    return gm_get_u64(m, (uint64_t) (uintptr_t) k);
+}
+
+void gm_insert_ptr(GenericMap *m, const void *k, void *data) {
+    gm_insert_u64(m, (uint64_t) (uintptr_t) k, data);
+}
+
+void gm_remove_ptr(GenericMap *m, const void *k) {
+    gm_remove_u64(m, (uint64_t) (uintptr_t) k);
+}
+
+#endif
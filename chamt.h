@@ -0,0 +1,390 @@
+#ifndef CHAMT_H
+#define CHAMT_H
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cmap.h"
+
+// A Hamt is a persistent string map: a hash array mapped trie in which
+// every branch node consumes 5 bits of the key's hash and stores only the
+// children that exist, indexed through a 32-bit bitmap. hm_insert and
+// hm_remove never modify the map they are given. They return a new
+// version that copies the O(log32 n) nodes on the path to the key and
+// shares every other node with the old version.
+//
+// Versions and nodes are reference counted. Every Hamt returned by
+// hm_make, hm_insert, hm_remove or hm_retain must be given back with
+// hm_release. Values are copied in and never cleaned up, since any number
+// of versions may share them. Reference counts are not atomic.
+#define HAMT_BITS 5
+#define HAMT_BRANCH_WIDTH (1 << HAMT_BITS)
+#define HAMT_MASK (HAMT_BRANCH_WIDTH - 1)
+
+typedef enum {
+    HAMT_LEAF,
+    HAMT_BRANCH,
+    HAMT_COLLISION,
+} HamtNodeKind;
+
+typedef struct HamtNodeStruct {
+    size_t _refcount;
+    HamtNodeKind _kind;
+    // branches: which of the 32 slots are present
+    uint32_t _bitmap;
+    // branches and collisions: number of children
+    uint32_t _n_children;
+    // leaves and collisions
+    uint64_t _hash;
+    // leaves: key length; the value (stride bytes) and the key follow the
+    // node, children of branches and collisions follow it as pointers
+    size_t _key_length;
+} HamtNode;
+
+typedef struct {
+    size_t _refcount;
+    size_t _stride;
+    size_t _length;
+    HamtNode *_root;
+} Hamt;
+
+HamtNode **hm_children(HamtNode *node) {
+    return (HamtNode **) (node + 1);
+}
+
+void *hm_leaf_value(HamtNode *leaf) {
+    return leaf + 1;
+}
+
+char *hm_leaf_key(HamtNode *leaf, size_t stride) {
+    return ((char *) (leaf + 1)) + stride;
+}
+
+HamtNode *hm_node_retain(HamtNode *node) {
+    if (node != NULL) node->_refcount++;
+    return node;
+}
+
+void hm_node_release(HamtNode *node) {
+    if (node == NULL || --node->_refcount > 0) return;
+
+    if (node->_kind != HAMT_LEAF) {
+        for (uint32_t c_idx = 0; c_idx < node->_n_children; c_idx++)
+            hm_node_release(hm_children(node)[c_idx]);
+    }
+    free(node);
+}
+
+HamtNode *hm_node_alloc(HamtNodeKind kind, size_t extra) {
+    HamtNode *node = (HamtNode *) malloc(sizeof(HamtNode) + extra);
+    assert(node != NULL);
+
+    node->_refcount = 1;
+    node->_kind = kind;
+    node->_bitmap = 0;
+    node->_n_children = 0;
+    node->_hash = 0;
+    node->_key_length = 0;
+    return node;
+}
+
+HamtNode *hm_make_leaf(const char *k, size_t len, uint64_t hash,
+                       const void *data, size_t stride) {
+    HamtNode *leaf = hm_node_alloc(HAMT_LEAF, stride + len + 1);
+    leaf->_hash = hash;
+    leaf->_key_length = len;
+    memcpy(hm_leaf_value(leaf), data, stride);
+    memcpy(hm_leaf_key(leaf, stride), k, len + 1);
+    return leaf;
+}
+
+// A branch or collision node with room for n children, to be filled in by
+// the caller.
+HamtNode *hm_make_inner(HamtNodeKind kind, uint32_t n) {
+    HamtNode *node = hm_node_alloc(kind, n * sizeof(HamtNode *));
+    node->_n_children = n;
+    return node;
+}
+
+bool hm_leaf_matches(HamtNode *leaf, const char *k, size_t len, uint64_t hash,
+                     size_t stride) {
+    return leaf->_hash == hash && leaf->_key_length == len
+        && memcmp(hm_leaf_key(leaf, stride), k, len) == 0;
+}
+
+uint32_t hm_slot(uint64_t hash, unsigned shift) {
+    return (uint32_t) (hash >> shift) & HAMT_MASK;
+}
+
+uint32_t hm_child_index(HamtNode *branch, uint32_t bit) {
+    return (uint32_t) __builtin_popcount(branch->_bitmap & (bit - 1));
+}
+
+Hamt *hm_wrap(HamtNode *root, size_t stride, size_t length) {
+    Hamt *h = (Hamt *) malloc(sizeof(Hamt));
+    assert(h != NULL);
+
+    h->_refcount = 1;
+    h->_stride = stride;
+    h->_length = length;
+    h->_root = root;
+    return h;
+}
+
+Hamt *hm_make(size_t stride) {
+    return hm_wrap(NULL, stride, 0);
+}
+
+Hamt *hm_retain(Hamt *h) {
+    h->_refcount++;
+    return h;
+}
+
+void hm_release(Hamt *h) {
+    if (h == NULL || --h->_refcount > 0) return;
+    hm_node_release(h->_root);
+    free(h);
+}
+
+size_t hm_size(Hamt *h) {
+    return h->_length;
+}
+
+void *hm_get_prehashed(Hamt *h, const char *k, size_t len, uint64_t hash) {
+    HamtNode *node = h->_root;
+    for (unsigned shift = 0; node != NULL; shift += HAMT_BITS) {
+        switch (node->_kind) {
+        case HAMT_LEAF:
+            return hm_leaf_matches(node, k, len, hash, h->_stride)
+                ? hm_leaf_value(node) : NULL;
+        case HAMT_COLLISION:
+            for (uint32_t c_idx = 0; c_idx < node->_n_children; c_idx++) {
+                HamtNode *leaf = hm_children(node)[c_idx];
+                if (hm_leaf_matches(leaf, k, len, hash, h->_stride))
+                    return hm_leaf_value(leaf);
+            }
+            return NULL;
+        case HAMT_BRANCH: {
+            uint32_t bit = ((uint32_t) 1) << hm_slot(hash, shift);
+            if (!(node->_bitmap & bit)) return NULL;
+            node = hm_children(node)[hm_child_index(node, bit)];
+            break;
+        }
+        }
+    }
+    return NULL;
+}
+
+void *hm_get(Hamt *h, const char *k) {
+    size_t len = strlen(k);
+    return hm_get_prehashed(h, k, len, m_hash(k, len));
+}
+
+// Builds the smallest subtree holding two nodes with different hashes
+// (leaves or collisions), starting at the given depth. Takes ownership of
+// both.
+HamtNode *hm_merge(HamtNode *a, HamtNode *b, unsigned shift) {
+    uint32_t a_slot = hm_slot(a->_hash, shift), b_slot = hm_slot(b->_hash, shift);
+    if (a_slot == b_slot) {
+        HamtNode *branch = hm_make_inner(HAMT_BRANCH, 1);
+        branch->_bitmap = ((uint32_t) 1) << a_slot;
+        hm_children(branch)[0] = hm_merge(a, b, shift + HAMT_BITS);
+        return branch;
+    }
+
+    HamtNode *branch = hm_make_inner(HAMT_BRANCH, 2);
+    branch->_bitmap = (((uint32_t) 1) << a_slot) | (((uint32_t) 1) << b_slot);
+    hm_children(branch)[a_slot < b_slot ? 0 : 1] = a;
+    hm_children(branch)[a_slot < b_slot ? 1 : 0] = b;
+    return branch;
+}
+
+// Returns node with leaf added (or replacing the leaf with the same key),
+// without modifying node. Takes ownership of leaf, borrows node.
+HamtNode *hm_node_insert(HamtNode *node, HamtNode *leaf, unsigned shift,
+                         size_t stride, bool *added) {
+    if (node == NULL) {
+        *added = true;
+        return leaf;
+    }
+
+    if (node->_kind == HAMT_LEAF) {
+        if (hm_leaf_matches(node, hm_leaf_key(leaf, stride), leaf->_key_length,
+                            leaf->_hash, stride))
+            return leaf;
+
+        *added = true;
+        if (node->_hash == leaf->_hash) {
+            HamtNode *collision = hm_make_inner(HAMT_COLLISION, 2);
+            collision->_hash = leaf->_hash;
+            hm_children(collision)[0] = hm_node_retain(node);
+            hm_children(collision)[1] = leaf;
+            return collision;
+        }
+        return hm_merge(hm_node_retain(node), leaf, shift);
+    }
+
+    if (node->_kind == HAMT_COLLISION) {
+        if (node->_hash != leaf->_hash) {
+            *added = true;
+            return hm_merge(hm_node_retain(node), leaf, shift);
+        }
+
+        uint32_t n = node->_n_children, match = n;
+        for (uint32_t c_idx = 0; c_idx < n; c_idx++) {
+            HamtNode *other = hm_children(node)[c_idx];
+            if (hm_leaf_matches(other, hm_leaf_key(leaf, stride), leaf->_key_length,
+                                leaf->_hash, stride))
+                match = c_idx;
+        }
+
+        HamtNode *collision = hm_make_inner(HAMT_COLLISION, match == n ? n + 1 : n);
+        collision->_hash = node->_hash;
+        for (uint32_t c_idx = 0; c_idx < n; c_idx++) {
+            hm_children(collision)[c_idx] = c_idx == match
+                ? leaf : hm_node_retain(hm_children(node)[c_idx]);
+        }
+        if (match == n) {
+            hm_children(collision)[n] = leaf;
+            *added = true;
+        }
+        return collision;
+    }
+
+    uint32_t bit = ((uint32_t) 1) << hm_slot(leaf->_hash, shift);
+    uint32_t c_pos = hm_child_index(node, bit);
+    uint32_t n = node->_n_children;
+
+    if (!(node->_bitmap & bit)) {
+        HamtNode *branch = hm_make_inner(HAMT_BRANCH, n + 1);
+        branch->_bitmap = node->_bitmap | bit;
+        for (uint32_t c_idx = 0; c_idx < c_pos; c_idx++)
+            hm_children(branch)[c_idx] = hm_node_retain(hm_children(node)[c_idx]);
+        hm_children(branch)[c_pos] = leaf;
+        for (uint32_t c_idx = c_pos; c_idx < n; c_idx++)
+            hm_children(branch)[c_idx + 1] = hm_node_retain(hm_children(node)[c_idx]);
+        *added = true;
+        return branch;
+    }
+
+    HamtNode *branch = hm_make_inner(HAMT_BRANCH, n);
+    branch->_bitmap = node->_bitmap;
+    for (uint32_t c_idx = 0; c_idx < n; c_idx++) {
+        if (c_idx == c_pos) continue;
+        hm_children(branch)[c_idx] = hm_node_retain(hm_children(node)[c_idx]);
+    }
+    hm_children(branch)[c_pos] =
+        hm_node_insert(hm_children(node)[c_pos], leaf, shift + HAMT_BITS, stride, added);
+    return branch;
+}
+
+// Returns a new version with k bound to data. h is left as it was.
+Hamt *hm_insert_prehashed(Hamt *h, const char *k, size_t len, uint64_t hash,
+                          void *data) {
+    bool added = false;
+    HamtNode *leaf = hm_make_leaf(k, len, hash, data, h->_stride);
+    HamtNode *root = hm_node_insert(h->_root, leaf, 0, h->_stride, &added);
+    return hm_wrap(root, h->_stride, h->_length + (added ? 1 : 0));
+}
+
+Hamt *hm_insert(Hamt *h, const char *k, void *data) {
+    size_t len = strlen(k);
+    return hm_insert_prehashed(h, k, len, m_hash(k, len), data);
+}
+
+// Returns node without k, as a new reference. Borrows node. When k is not
+// present the result is node itself, retained.
+HamtNode *hm_node_remove(HamtNode *node, const char *k, size_t len, uint64_t hash,
+                         unsigned shift, size_t stride) {
+    if (node->_kind == HAMT_LEAF)
+        return hm_leaf_matches(node, k, len, hash, stride) ? NULL : hm_node_retain(node);
+
+    uint32_t n = node->_n_children;
+    if (node->_kind == HAMT_COLLISION) {
+        uint32_t match = n;
+        for (uint32_t c_idx = 0; c_idx < n; c_idx++) {
+            if (hm_leaf_matches(hm_children(node)[c_idx], k, len, hash, stride))
+                match = c_idx;
+        }
+        if (match == n) return hm_node_retain(node);
+        if (n == 2) return hm_node_retain(hm_children(node)[1 - match]);
+
+        HamtNode *collision = hm_make_inner(HAMT_COLLISION, n - 1);
+        collision->_hash = node->_hash;
+        for (uint32_t c_idx = 0, to = 0; c_idx < n; c_idx++) {
+            if (c_idx != match)
+                hm_children(collision)[to++] = hm_node_retain(hm_children(node)[c_idx]);
+        }
+        return collision;
+    }
+
+    uint32_t bit = ((uint32_t) 1) << hm_slot(hash, shift);
+    if (!(node->_bitmap & bit)) return hm_node_retain(node);
+
+    uint32_t c_pos = hm_child_index(node, bit);
+    HamtNode *child = hm_children(node)[c_pos];
+    HamtNode *new_child = hm_node_remove(child, k, len, hash, shift + HAMT_BITS, stride);
+    if (new_child == child) {
+        hm_node_release(new_child);
+        return hm_node_retain(node);
+    }
+
+    if (new_child == NULL) {
+        if (n == 1) return NULL;
+        // a lone leaf or collision can move up in place of this branch
+        if (n == 2 && hm_children(node)[1 - c_pos]->_kind != HAMT_BRANCH)
+            return hm_node_retain(hm_children(node)[1 - c_pos]);
+
+        HamtNode *branch = hm_make_inner(HAMT_BRANCH, n - 1);
+        branch->_bitmap = node->_bitmap & ~bit;
+        for (uint32_t c_idx = 0, to = 0; c_idx < n; c_idx++) {
+            if (c_idx != c_pos)
+                hm_children(branch)[to++] = hm_node_retain(hm_children(node)[c_idx]);
+        }
+        return branch;
+    }
+
+    if (n == 1 && new_child->_kind != HAMT_BRANCH) return new_child;
+
+    HamtNode *branch = hm_make_inner(HAMT_BRANCH, n);
+    branch->_bitmap = node->_bitmap;
+    for (uint32_t c_idx = 0; c_idx < n; c_idx++) {
+        hm_children(branch)[c_idx] = c_idx == c_pos
+            ? new_child : hm_node_retain(hm_children(node)[c_idx]);
+    }
+    return branch;
+}
+
+// Returns a new version without k. h is left as it was.
+Hamt *hm_remove(Hamt *h, const char *k) {
+    if (h->_root == NULL) return hm_retain(h);
+
+    size_t len = strlen(k);
+    HamtNode *root = hm_node_remove(h->_root, k, len, m_hash(k, len), 0, h->_stride);
+    if (root == h->_root) {
+        hm_node_release(root);
+        return hm_retain(h);
+    }
+    return hm_wrap(root, h->_stride, h->_length - 1);
+}
+
+void hm_node_map(HamtNode *node, size_t stride, MapMappableFn f, void *aux) {
+    if (node == NULL) return;
+    if (node->_kind == HAMT_LEAF) {
+        f(hm_leaf_key(node, stride), hm_leaf_value(node), aux);
+        return;
+    }
+    for (uint32_t c_idx = 0; c_idx < node->_n_children; c_idx++)
+        hm_node_map(hm_children(node)[c_idx], stride, f, aux);
+}
+
+// Values passed to f belong to every version sharing them and must not be
+// modified.
+void hm_map(Hamt *h, MapMappableFn f, void *aux) {
+    hm_node_map(h->_root, h->_stride, f, aux);
+}
+
+#endif
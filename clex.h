@@ -6,6 +6,7 @@
 #include <assert.h>
 
 #include "cvector.h"
+#include "csegvector.h"
 
 typedef struct {
     char * _category_label;
@@ -22,11 +23,14 @@ typedef struct {
     TokenCategory *_category;
 } Token;
 
+DEFINE_TYPED_VECTOR(TokenVector, tokv, Token)
+
 typedef struct {
-    Vector *_token_categories;
+    // segmented so that the category pointers held by rules and tokens stay
+    // valid as more categories are added
+    SegmentedVector *_token_categories;
     Vector *_rules;
 
-    bool _categories_initialized;
     bool _rules_initialized;
 } LexerEnv;
 
@@ -49,9 +53,8 @@ void token_category_cleanup_fn(void *p, __attribute__((unused)) void *aux) {
 
 LexerEnv *lexer_make() {
     LexerEnv *le = (LexerEnv *) malloc(sizeof(LexerEnv));
-    le->_categories_initialized = false;
     le->_rules_initialized = false;
-    le->_token_categories = v_make(sizeof(TokenCategory));
+    le->_token_categories = sv_make(sizeof(TokenCategory));
     le->_rules = v_make(sizeof(LexerRule));
 
     le->_rules->_cleanup_fn = rule_cleanup_fn;
@@ -60,19 +63,17 @@ LexerEnv *lexer_make() {
 }
 
 void lexer_free(LexerEnv *le) {
-    v_free(le->_token_categories);
+    sv_free(le->_token_categories);
     v_free(le->_rules);
     free(le);
 }
 
 void lexer_add_category(LexerEnv *le, const char *category_label) {
-    assert(!le->_categories_initialized);
-
     TokenCategory tc;
     char *new_label = strdup(category_label);
     tc._category_label = new_label;
-    tc._category_id = v_size(le->_token_categories);
-    v_push_back(le->_token_categories, &tc);
+    tc._category_id = sv_size(le->_token_categories);
+    sv_push_back(le->_token_categories, &tc);
 }
 
 bool token_category_matches_label(const void *p, const void *cat_label) {
@@ -81,12 +82,11 @@ bool token_category_matches_label(const void *p, const void *cat_label) {
 
 void lexer_add_rule(LexerEnv *le, const char *category_label, const char *rule_pattern) {
     assert(!le->_rules_initialized);
-    le->_categories_initialized = true;
 
     LexerRule rule;
-    TokenCategory *tc = (TokenCategory *) v_find(le->_token_categories,
-                                                 token_category_matches_label,
-                                                 category_label);
+    TokenCategory *tc = (TokenCategory *) sv_find(le->_token_categories,
+                                                  token_category_matches_label,
+                                                  category_label);
 
     assert(tc != NULL);
     rule._category = tc;
@@ -141,22 +141,22 @@ Vector *lexer_lex(LexerEnv *le, const char *input) {
     le->_rules_initialized = true;
     regmatch_t matches[1];
 
-    Vector *tokens = v_make(sizeof(Token));
-    tokens->_cleanup_fn = token_cleanup_fn;
+    TokenVector *tokens = tokv_make();
+    tokv_as_vector(tokens)->_cleanup_fn = token_cleanup_fn;
 
     Token t;
     while(input[0] != '\0') {
         input = lexer_read_token(le, input, &t, matches);
         if (input == NULL) {
             // could not lex further
-            v_map(tokens, print_token, NULL);
-            v_free(tokens);
+            v_map(tokv_as_vector(tokens), print_token, NULL);
+            tokv_free(tokens);
             return NULL;
         }
-        v_push_back(tokens, &t);
+        tokv_push_back(tokens, t);
     }
 
-    return tokens;
+    return tokv_as_vector(tokens);
 }
 
 #endif
@@ -4,12 +4,167 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "cvector.h"
+#include "callocator.h"
 
 #define DEFAULT_BUCKET_COUNT 32
 #define MIN_BUCKET_COUNT 8
 #define REBALANCE_LOAD_FACTOR 2
+// old buckets moved to the new bucket array per operation while an
+// incremental resize is in progress
+#define INCREMENTAL_RESIZE_BUCKETS_PER_OP 4
+// maps start out as a short array of elements and only allocate buckets
+// once they outgrow it
+#define MAP_SMALL_CAPACITY 8
+
+// Every element starts with this header, followed by the value (stride
+// bytes) and the NUL-terminated key. The full hash and the key length are
+// kept so that lookups can reject on them before comparing keys and so
+// that resizing never hashes a key again.
+typedef struct MapElemStruct {
+    struct MapElemStruct *_next;
+    uint64_t _hash;
+    size_t _key_length;
+} MapElem;
+
+// Elements are carved out of a per-Map slab: chunks taken from the Map's
+// allocator, growing geometrically, with free lists for elements that are
+// removed. Blocks up to MAP_SLAB_N_CLASSES * MAP_SLAB_ALIGNMENT bytes come
+// in 16-byte size classes; bigger ones are rounded up to a power of two,
+// with their free lists allocated the first time one is needed. A block
+// only ever goes back on its own class's list, so a map under insert and
+// remove churn reuses its blocks instead of growing. Freeing the map
+// releases the chunks, not the elements.
+#define MAP_SLAB_FIRST_CHUNK 512
+#define MAP_SLAB_MAX_CHUNK (((size_t) 1) << 20)
+#define MAP_SLAB_ALIGNMENT 16
+#define MAP_SLAB_N_CLASSES 16
+#define MAP_SLAB_SMALL_MAX (MAP_SLAB_N_CLASSES * MAP_SLAB_ALIGNMENT)
+// power of two classes from 2 * MAP_SLAB_SMALL_MAX (2^9) up to 2^56
+#define MAP_SLAB_LARGE_SHIFT 9
+#define MAP_SLAB_N_LARGE_CLASSES 48
+
+typedef struct MapSlabChunkStruct {
+    struct MapSlabChunkStruct *_next;
+    size_t _size;
+    size_t _used;
+} MapSlabChunk;
+
+typedef struct {
+    MapSlabChunk *_chunks;
+    size_t _next_chunk_size;
+    void *_free_lists[MAP_SLAB_N_CLASSES];
+    void **_large_free_lists;
+} MapSlab;
+
+size_t m_slab_align(size_t n) {
+    return (n + MAP_SLAB_ALIGNMENT - 1) & ~((size_t) MAP_SLAB_ALIGNMENT - 1);
+}
+
+char *m_slab_chunk_data(MapSlabChunk *c) {
+    return ((char *) c) + m_slab_align(sizeof(MapSlabChunk));
+}
+
+void m_slab_init(MapSlab *slab) {
+    slab->_chunks = NULL;
+    slab->_next_chunk_size = MAP_SLAB_FIRST_CHUNK;
+    for (size_t c_idx = 0; c_idx < MAP_SLAB_N_CLASSES; c_idx++)
+        slab->_free_lists[c_idx] = NULL;
+    slab->_large_free_lists = NULL;
+}
+
+// The size of the block an n byte element takes up.
+size_t m_slab_block_size(size_t n) {
+    n = m_slab_align(n);
+    if (n <= MAP_SLAB_SMALL_MAX) return n;
+    return ((size_t) 1) << (64 - __builtin_clzll((unsigned long long) n - 1));
+}
+
+void **m_slab_free_list(MapSlab *slab, size_t block_size) {
+    if (block_size <= MAP_SLAB_SMALL_MAX)
+        return slab->_free_lists + (block_size / MAP_SLAB_ALIGNMENT - 1);
+
+    size_t class_idx = (size_t) __builtin_ctzll(block_size) - MAP_SLAB_LARGE_SHIFT;
+    assert(class_idx < MAP_SLAB_N_LARGE_CLASSES);
+    return slab->_large_free_lists + class_idx;
+}
+
+void *m_slab_alloc(MapSlab *slab, const Allocator *a, size_t n) {
+    n = m_slab_block_size(n);
+    if (n > MAP_SLAB_SMALL_MAX && slab->_large_free_lists == NULL) {
+        slab->_large_free_lists = (void **) a_calloc(a, MAP_SLAB_N_LARGE_CLASSES, sizeof(void *));
+        if (slab->_large_free_lists == NULL) return NULL;
+    }
+
+    void **free_list = m_slab_free_list(slab, n);
+    if (*free_list != NULL) {
+        void *p = *free_list;
+        *free_list = *(void **) p;
+        return p;
+    }
+
+    MapSlabChunk *c = slab->_chunks;
+    if (c == NULL || c->_size - c->_used < n) {
+        size_t size = n > slab->_next_chunk_size ? n : slab->_next_chunk_size;
+        c = (MapSlabChunk *) a_alloc(a, m_slab_align(sizeof(MapSlabChunk)) + size);
+        if (c == NULL) return NULL;
+        c->_size = size;
+        c->_used = 0;
+        c->_next = slab->_chunks;
+        slab->_chunks = c;
+
+        if (slab->_next_chunk_size < MAP_SLAB_MAX_CHUNK)
+            slab->_next_chunk_size *= 2;
+    }
+
+    void *p = m_slab_chunk_data(c) + c->_used;
+    c->_used += n;
+    return p;
+}
+
+// n is the size the element was allocated with.
+void m_slab_release(MapSlab *slab, void *p, size_t n) {
+    void **free_list = m_slab_free_list(slab, m_slab_block_size(n));
+    *(void **) p = *free_list;
+    *free_list = p;
+}
+
+void m_slab_free(MapSlab *slab, const Allocator *a) {
+    MapSlabChunk *c = slab->_chunks;
+    while (c != NULL) {
+        MapSlabChunk *next = c->_next;
+        a_free(a, c, m_slab_align(sizeof(MapSlabChunk)) + c->_size);
+        c = next;
+    }
+    if (slab->_large_free_lists != NULL)
+        a_free(a, slab->_large_free_lists, MAP_SLAB_N_LARGE_CLASSES * sizeof(void *));
+    m_slab_init(slab);
+}
+
+// Snapshot files (see cmapfile.h) hold a read-only Map that is used in
+// place once mapped into memory. All offsets are from the start of the
+// file and all integers are in native byte order. The file is
+//   [MapSnapshotHeader]
+//   [bucket_count + 1 entry offsets, relative to entries_offset]
+//   [entries]
+// and bucket b's entries lie between offsets b and b + 1. An entry has
+// the same layout as an in-memory element (MapElem, value, key), with a
+// zero _next and padding to MAP_SNAPSHOT_ALIGNMENT, so lookups read it
+// with the same code as a live element.
+#define MAP_SNAPSHOT_MAGIC "CMAPSNP1"
+#define MAP_SNAPSHOT_ALIGNMENT 8
+
+typedef struct {
+    char _magic[8];
+    uint64_t _stride;
+    uint64_t _length;
+    uint64_t _bucket_count;
+    uint64_t _buckets_offset;
+    uint64_t _entries_offset;
+    uint64_t _size;
+} MapSnapshotHeader;
 
 typedef void (*MapMappableFn)(char *, void *, void*);
 
@@ -24,37 +179,145 @@ typedef struct {
 
     MapMappableFn _cleanup_fn;
 
+    // NULL while the map is small
     size_t _bucket_count;
     void *_buckets;
+
+    // Small maps keep their elements here, packed at the front, with a
+    // byte of each hash alongside so that a lookup compares keys only on a
+    // tag match.
+    MapElem *_small_elems[MAP_SMALL_CAPACITY];
+    uint8_t _small_tags[MAP_SMALL_CAPACITY];
+
+    // Incremental resizing (see m_set_incremental_resize). While a resize
+    // is in progress the old bucket array is kept alongside the new one,
+    // and buckets below _migrated_buckets have already been moved over.
+    bool _incremental_resize;
+    size_t _old_bucket_count;
+    void *_old_buckets;
+    size_t _migrated_buckets;
+    size_t _n_iterating;
+
+    MapSlab _slab;
+    const Allocator *_allocator;
+
+    // set when the map is a mapped snapshot, which is read only
+    const MapSnapshotHeader *_snapshot;
 } Map;
 
-void m_init(Map *m, size_t stride) {
+void m_init_with_allocator(Map *m, size_t stride, const Allocator *a) {
+    m->_allocator = a;
     m->_cleanup_fn = NULL;
     m->_stride = stride;
     m->_length = 0;
 
-    m->_bucket_count = DEFAULT_BUCKET_COUNT;
-    m->_buckets = malloc(m->_bucket_count * sizeof(void *));
-    assert(m->_buckets != NULL);
-    for (size_t b_idx = 0; b_idx < m->_bucket_count; b_idx++) {
-        ((void **)m->_buckets)[b_idx] = NULL;
-    }
+    m->_incremental_resize = false;
+    m->_old_bucket_count = 0;
+    m->_old_buckets = NULL;
+    m->_migrated_buckets = 0;
+    m->_n_iterating = 0;
+
+    m->_bucket_count = 0;
+    m->_buckets = NULL;
+
+    m_slab_init(&m->_slab);
+    m->_snapshot = NULL;
 }
 
-Map *m_make(size_t stride) {
-    Map *m = (Map *) malloc(sizeof(Map));
+void m_init(Map *m, size_t stride) {
+    m_init_with_allocator(m, stride, NULL);
+}
+
+Map *m_make_with_allocator(size_t stride, const Allocator *a) {
+    Map *m = (Map *) a_alloc(a, sizeof(Map));
     assert(m != NULL);
 
-    m_init(m, stride);
+    m_init_with_allocator(m, stride, a);
     return m;
 }
 
-static size_t m_default_hash(const char *s, size_t n) {
-    const unsigned long MULTIPLIER = 2630849305L; // magic prime number
-    size_t hashcode = 0;
-    for (size_t i = 0; s[i] != '\0'; i++)
-        hashcode = hashcode * MULTIPLIER + s[i];
-    return hashcode % n;
+Map *m_make(size_t stride) {
+    return m_make_with_allocator(stride, NULL);
+}
+
+// Word-at-a-time string hashing in the style of wyhash: 16 bytes are
+// folded in per round with a 64x64->128 bit multiply, and short keys are
+// read with (possibly overlapping) unaligned loads instead of byte loops.
+#define MAP_HASH_P0 0xa0761d6478bd642fULL
+#define MAP_HASH_P1 0xe7037ed1a0b428dbULL
+#define MAP_HASH_P2 0x8ebc6af09c88c6e3ULL
+
+uint64_t m_hash_mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+    return ((uint64_t) r) ^ ((uint64_t) (r >> 64));
+#else
+    uint64_t a_lo = (uint32_t) a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t) b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t) hi_lo + lo_hi;
+    uint64_t lo = (cross << 32) | (uint32_t) lo_lo;
+    uint64_t hi = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    return lo ^ hi;
+#endif
+}
+
+uint64_t m_hash_read64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t m_hash_read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t m_hash(const char *s, size_t n) {
+    uint64_t seed = MAP_HASH_P0 ^ m_hash_mix(n ^ MAP_HASH_P0, MAP_HASH_P1);
+    uint64_t a, b;
+
+    if (n <= 16) {
+        if (n >= 8) {
+            a = m_hash_read64(s);
+            b = m_hash_read64(s + n - 8);
+        } else if (n >= 4) {
+            a = m_hash_read32(s);
+            b = m_hash_read32(s + n - 4);
+        } else if (n > 0) {
+            a = (((uint64_t) (unsigned char) s[0]) << 16)
+                | (((uint64_t) (unsigned char) s[n >> 1]) << 8)
+                | ((uint64_t) (unsigned char) s[n - 1]);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        const char *p = s;
+        size_t remaining = n;
+        while (remaining > 16) {
+            seed = m_hash_mix(m_hash_read64(p) ^ MAP_HASH_P1,
+                              m_hash_read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        // the last 16 bytes, overlapping the final round if needed
+        a = m_hash_read64(s + n - 16);
+        b = m_hash_read64(s + n - 8);
+    }
+
+    return m_hash_mix(MAP_HASH_P1 ^ n, m_hash_mix(a ^ MAP_HASH_P1, b ^ seed) ^ MAP_HASH_P2);
+}
+
+uint64_t m_hash_string(const char *s) {
+    return m_hash(s, strlen(s));
+}
+
+// bucket counts are always powers of two
+size_t m_bucket_index(Map *m, uint64_t hash) {
+    return (size_t) hash & (m->_bucket_count - 1);
 }
 
 void *m_bucket_at(Map *m, size_t idx) {
@@ -67,17 +330,111 @@ size_t m_size(Map *m) {
 }
 
 void *m_value_from_elem(__attribute__((unused)) Map *m, void *elem) {
-    return ((void **) elem) + 1;
+    return ((MapElem *) elem) + 1;
+}
+
+// The element holding a value returned by m_get. Elements never move, so
+// this is valid until the binding is removed.
+MapElem *m_elem_from_value(__attribute__((unused)) Map *m, void *value) {
+    return ((MapElem *) value) - 1;
 }
 
 char *m_key_from_elem(Map *m, void *elem) {
-    return ((char *) elem) + (sizeof(char *) + m->_stride);
+    return ((char *) elem) + (sizeof(MapElem) + m->_stride);
+}
+
+size_t m_elem_size(Map *m, size_t key_length) {
+    return sizeof(MapElem) + (key_length + 1)*sizeof(char) + m->_stride;
 }
 
 void m_set_bucket(Map *m, void *elem, size_t idx) {
     *(void **) m_bucket_at(m, idx) = elem;
 }
 
+// Moves every element of a chain into the bucket array `to`, which has
+// to_count buckets.
+void m_rehash_chain(void *elem, void *to, size_t to_count) {
+    while (elem != NULL) {
+        void *n_elem = *(void **) elem;
+        size_t b_idx = (size_t) ((MapElem *) elem)->_hash & (to_count - 1);
+
+        *(void **) elem = *((void **) to + b_idx);
+        *((void **) to + b_idx) = elem;
+        elem = n_elem;
+    }
+}
+
+bool m_is_resizing(Map *m) {
+    return m->_old_buckets != NULL;
+}
+
+void m_finish_resize_step(Map *m) {
+    if (m->_migrated_buckets < m->_old_bucket_count) return;
+
+    a_free(m->_allocator, m->_old_buckets, m->_old_bucket_count * sizeof(void *));
+    m->_old_buckets = NULL;
+    m->_old_bucket_count = 0;
+    m->_migrated_buckets = 0;
+}
+
+// Moves up to n_buckets old buckets into the current bucket array. Nothing
+// moves while m_map is running, so that no element is visited twice.
+void m_resize_step(Map *m, size_t n_buckets) {
+    if (!m_is_resizing(m) || m->_n_iterating > 0) return;
+
+    for (; n_buckets > 0 && m->_migrated_buckets < m->_old_bucket_count; n_buckets--) {
+        void **old_bucket = ((void **) m->_old_buckets) + m->_migrated_buckets++;
+        m_rehash_chain(*old_bucket, m->_buckets, m->_bucket_count);
+        *old_bucket = NULL;
+    }
+    m_finish_resize_step(m);
+}
+
+void m_finish_resize(Map *m) {
+    if (!m_is_resizing(m)) return;
+
+    size_t n_iterating = m->_n_iterating;
+    m->_n_iterating = 0;
+    m_resize_step(m, m->_old_bucket_count);
+    m->_n_iterating = n_iterating;
+}
+
+// With incremental resizing on, growing the bucket array no longer moves
+// every element at once: each later m_get, m_insert and m_remove moves a
+// few buckets, so no single operation pays for the whole map. Turning it
+// off completes any resize in progress.
+void m_set_incremental_resize(Map *m, bool incremental) {
+    m->_incremental_resize = incremental;
+    if (!incremental) m_finish_resize(m);
+}
+
+void *m_old_bucket_for(Map *m, uint64_t hash) {
+    return ((void **) m->_old_buckets) + ((size_t) hash & (m->_old_bucket_count - 1));
+}
+
+bool m_is_small(Map *m) {
+    return m->_buckets == NULL;
+}
+
+// Bits 48-55: the top bits pick a ConcurrentMap's shard, so within one
+// shard they would be the same for every key, and the low bits pick the
+// bucket once the map spills.
+uint8_t m_small_tag(uint64_t hash) {
+    return (uint8_t) (hash >> 48);
+}
+
+// Moves the elements of a small map into buckets.
+void m_spill_small(Map *m) {
+    m->_bucket_count = MIN_BUCKET_COUNT;
+    m->_buckets = a_calloc(m->_allocator, m->_bucket_count, sizeof(void *));
+    assert(m->_buckets != NULL);
+
+    for (size_t s_idx = 0; s_idx < m->_length; s_idx++) {
+        m->_small_elems[s_idx]->_next = NULL;
+        m_rehash_chain(m->_small_elems[s_idx], m->_buckets, m->_bucket_count);
+    }
+}
+
 void m_ll_map(Map *m, void *elem, MapMappableFn f, void *aux) {
     if (elem == NULL) return;
 
@@ -85,23 +442,96 @@ void m_ll_map(Map *m, void *elem, MapMappableFn f, void *aux) {
     m_ll_map(m, *(void **) elem, f, aux);
 }
 
-void *m_ll_match(Map *m, void *elem, const char *k) {
-    if (elem == NULL) return NULL;
+bool m_elem_matches(Map *m, MapElem *elem, const char *k, size_t len, uint64_t hash) {
+    return elem->_hash == hash && elem->_key_length == len
+        && memcmp(m_key_from_elem(m, elem), k, len) == 0;
+}
+
+void *m_ll_match(Map *m, void *elem, const char *k, size_t len, uint64_t hash) {
+    while (elem != NULL) {
+        if (m_elem_matches(m, (MapElem *) elem, k, len, hash))
+            return elem;
+        elem = *(void **) elem;
+    }
+    return NULL;
+}
+
+size_t m_small_index(Map *m, const char *k, size_t len, uint64_t hash) {
+    uint8_t tag = m_small_tag(hash);
+    for (size_t s_idx = 0; s_idx < m->_length; s_idx++) {
+        if (m->_small_tags[s_idx] == tag
+            && m_elem_matches(m, m->_small_elems[s_idx], k, len, hash))
+            return s_idx;
+    }
+    return MAP_SMALL_CAPACITY;
+}
+
+size_t m_snapshot_entry_size(Map *m, MapElem *entry) {
+    size_t n = m_elem_size(m, entry->_key_length);
+    return (n + MAP_SNAPSHOT_ALIGNMENT - 1) & ~((size_t) MAP_SNAPSHOT_ALIGNMENT - 1);
+}
 
-    if (strcmp(m_key_from_elem(m, elem), k) == 0)
-        return elem;
+// Snapshots are checked only as far as they are read (see cmapfile.h).
+// Returns the entry at off if it is aligned, lies whole before end and
+// has its key NUL terminated, and NULL otherwise.
+MapElem *m_snapshot_entry(Map *m, const char *entries, uint64_t off, uint64_t end) {
+    if (off % MAP_SNAPSHOT_ALIGNMENT != 0 || off > end) return NULL;
+    if (end - off < sizeof(MapElem) + m->_stride) return NULL;
+    MapElem *entry = (MapElem *) (entries + off);
+    // room for the key and its NUL
+    if (entry->_key_length >= end - off - sizeof(MapElem) - m->_stride) return NULL;
+    if (m_key_from_elem(m, entry)[entry->_key_length] != '\0') return NULL;
+    return entry;
+}
 
-    return m_ll_match(m, *(void **) elem, k);
+// Where the entries end, relative to the first one. m_open_mapped has
+// checked that this lies within the file.
+uint64_t m_snapshot_entries_end(Map *m) {
+    const char *base = (const char *) m->_snapshot;
+    const uint64_t *buckets = (const uint64_t *) (base + m->_snapshot->_buckets_offset);
+    return buckets[m->_snapshot->_bucket_count];
 }
 
-void *m_match_from_bucket(Map *m, size_t b_idx, const char *k) {
-    void *fst = *(void **) m_bucket_at(m, b_idx);
-    return m_ll_match(m, fst, k);
+// A damaged bucket reads as holding nothing past the damage.
+void *m_snapshot_match(Map *m, const char *k, size_t len, uint64_t hash) {
+    const char *base = (const char *) m->_snapshot;
+    const uint64_t *buckets = (const uint64_t *) (base + m->_snapshot->_buckets_offset);
+    const char *entries = base + m->_snapshot->_entries_offset;
+
+    size_t b_idx = (size_t) hash & (m->_snapshot->_bucket_count - 1);
+    uint64_t end = buckets[b_idx + 1];
+    if (end > m_snapshot_entries_end(m)) return NULL;
+    for (uint64_t off = buckets[b_idx]; off < end;) {
+        MapElem *entry = m_snapshot_entry(m, entries, off, end);
+        if (entry == NULL) return NULL;
+        if (m_elem_matches(m, entry, k, len, hash))
+            return entry;
+        off += m_snapshot_entry_size(m, entry);
+    }
+    return NULL;
+}
+
+void *m_match_hashed(Map *m, const char *k, size_t len, uint64_t hash) {
+    if (m->_snapshot != NULL)
+        return m_snapshot_match(m, k, len, hash);
+
+    if (m_is_small(m)) {
+        size_t s_idx = m_small_index(m, k, len, hash);
+        return s_idx == MAP_SMALL_CAPACITY ? NULL : m->_small_elems[s_idx];
+    }
+
+    m_resize_step(m, INCREMENTAL_RESIZE_BUCKETS_PER_OP);
+
+    void *fst = *(void **) m_bucket_at(m, m_bucket_index(m, hash));
+    void *elem = m_ll_match(m, fst, k, len, hash);
+    if (elem == NULL && m_is_resizing(m))
+        elem = m_ll_match(m, *(void **) m_old_bucket_for(m, hash), k, len, hash);
+    return elem;
 }
 
 void *m_match(Map *m, const char *k) {
-    size_t b_idx = m_default_hash(k, m->_bucket_count);
-    return m_match_from_bucket(m, b_idx, k);
+    size_t len = strlen(k);
+    return m_match_hashed(m, k, len, m_hash(k, len));
 }
 
 void *m_get(Map *m, const char *k) {
@@ -109,98 +539,200 @@ void *m_get(Map *m, const char *k) {
     return (void *) (matched_elem ? m_value_from_elem(m, matched_elem) : NULL);
 }
 
+// Lookup with a hash computed once by the caller with m_hash(k, len), for
+// keys that are looked up over and over.
+void *m_get_prehashed(Map *m, const char *k, size_t len, uint64_t hash) {
+    void *matched_elem = m_match_hashed(m, k, len, hash);
+    return (void *) (matched_elem ? m_value_from_elem(m, matched_elem) : NULL);
+}
+
 void m_set_value_at_elem(Map *m, void *elem, void *data) {
     memcpy(m_value_from_elem(m, elem), data, m->_stride);
 }
 
-void *m_create_elem(Map *m, void *n_elem, const char *k, void *data) {
-    void *elem = malloc(sizeof(char *) + (strlen(k) + 1)*sizeof(char)
-                        + m->_stride);
+void m_free_elem(Map *m, void *elem) {
+    m_slab_release(&m->_slab, elem, m_elem_size(m, ((MapElem *) elem)->_key_length));
+}
+
+void *m_create_elem(Map *m, void *n_elem, const char *k, size_t len,
+                    uint64_t hash, void *data) {
+    MapElem *elem = (MapElem *) m_slab_alloc(&m->_slab, m->_allocator, m_elem_size(m, len));
     assert(elem != NULL);
 
-    *(void **)elem = n_elem;
-    strcpy(m_key_from_elem(m, elem), k);
-    m_set_value_at_elem(m, elem, data);
+    elem->_next = (MapElem *) n_elem;
+    elem->_hash = hash;
+    elem->_key_length = len;
+    memcpy(m_key_from_elem(m, elem), k, len + 1);
+    if (data != NULL) m_set_value_at_elem(m, elem, data);
 
     return elem;
 }
 
-void m_map(Map *m, MapMappableFn f, void *aux) {
+// Visits every element without any of m_map's bookkeeping, so it is safe
+// to call with other readers of the map running.
+void m_map_elems(Map *m, MapMappableFn f, void *aux) {
+    if (m->_snapshot != NULL) {
+        // entries lie back to back; the walk stops at the first damaged one
+        const char *entries = ((const char *) m->_snapshot) + m->_snapshot->_entries_offset;
+        uint64_t end = m_snapshot_entries_end(m);
+
+        for (uint64_t off = 0; off < end;) {
+            MapElem *entry = m_snapshot_entry(m, entries, off, end);
+            if (entry == NULL) return;
+            f(m_key_from_elem(m, entry), m_value_from_elem(m, entry), aux);
+            off += m_snapshot_entry_size(m, entry);
+        }
+        return;
+    }
+
+    if (m_is_small(m)) {
+        for (size_t s_idx = 0; s_idx < m->_length; s_idx++)
+            f(m_key_from_elem(m, m->_small_elems[s_idx]),
+              m_value_from_elem(m, m->_small_elems[s_idx]), aux);
+        return;
+    }
+
     for (size_t b_idx = 0; b_idx < m->_bucket_count; b_idx++) {
         void *fst = *(void **) m_bucket_at(m, b_idx);
         m_ll_map(m, fst, f, aux);
     }
+    // buckets that have not been migrated yet
+    for (size_t b_idx = m->_migrated_buckets; b_idx < m->_old_bucket_count; b_idx++) {
+        void *fst = *((void **) m->_old_buckets + b_idx);
+        m_ll_map(m, fst, f, aux);
+    }
+}
+
+void m_map(Map *m, MapMappableFn f, void *aux) {
+    m->_n_iterating++;
+    m_map_elems(m, f, aux);
+    m->_n_iterating--;
 }
 
 void m_ensure_space(Map *m) {
     if (m->_length < (m->_bucket_count * REBALANCE_LOAD_FACTOR))
         return;
 
+    // a previous resize has to be completed before another one starts
+    m_finish_resize(m);
+
     // allocate additional buckets
-    void *new_buckets = calloc(m->_bucket_count * 2, sizeof(void *));
+    void *new_buckets = a_calloc(m->_allocator, m->_bucket_count * 2, sizeof(void *));
     assert(new_buckets);
 
-    // migrate elements
-    for (size_t b_old_idx = 0; b_old_idx < m->_bucket_count; b_old_idx++) {
-        void *c_elem = *(void **) m_bucket_at(m, b_old_idx);
-        void *n_elem = NULL;
-
-        while (c_elem != NULL) {
-            n_elem = *(void **) c_elem;
+    if (m->_incremental_resize) {
+        m->_old_buckets = m->_buckets;
+        m->_old_bucket_count = m->_bucket_count;
+        m->_migrated_buckets = 0;
 
-            size_t b_new_idx =
-                m_default_hash(m_key_from_elem(m, c_elem), m->_bucket_count * 2);
-
-            *(void **) c_elem = *((void **) new_buckets + b_new_idx);
-            *((void **) new_buckets + b_new_idx) = c_elem;
-
-            c_elem = n_elem;
-        }
+        m->_buckets = new_buckets;
+        m->_bucket_count *= 2;
+        return;
     }
 
-    free(m->_buckets);
+    // migrate elements
+    for (size_t b_old_idx = 0; b_old_idx < m->_bucket_count; b_old_idx++)
+        m_rehash_chain(*(void **) m_bucket_at(m, b_old_idx),
+                       new_buckets, m->_bucket_count * 2);
+
+    a_free(m->_allocator, m->_buckets, m->_bucket_count * sizeof(void *));
     m->_buckets = new_buckets;
     m->_bucket_count *= 2;
 }
 
-void m_remove(Map *m, const char *k) {
-    size_t b_idx = m_default_hash(k, m->_bucket_count);
-
-    void *l_elem = m_bucket_at(m, b_idx);
-    if (!l_elem) return;
-
+bool m_remove_from_bucket(Map *m, void *bucket, const char *k, size_t len,
+                          uint64_t hash) {
+    void *l_elem = bucket;
     void *c_elem = *(void **) l_elem;
 
     while (c_elem != NULL) {
-        if (strcmp(m_key_from_elem(m, c_elem), k) == 0) {
+        if (m_elem_matches(m, (MapElem *) c_elem, k, len, hash)) {
             m->_length--;
 
             if (m->_cleanup_fn != NULL)
                 m->_cleanup_fn(NULL, m_value_from_elem(m, c_elem), NULL);
 
             *(void **) l_elem = *(void **) c_elem;
-            free(c_elem);
-            return;
+            m_free_elem(m, c_elem);
+            return true;
         }
         l_elem = c_elem;
         c_elem = *(void **) c_elem;
     }
+    return false;
 }
 
-void m_insert_unsafe(Map *m, const char *k, void *data) {
+void m_remove_small(Map *m, const char *k, size_t len, uint64_t hash) {
+    size_t s_idx = m_small_index(m, k, len, hash);
+    if (s_idx == MAP_SMALL_CAPACITY) return;
+
+    MapElem *elem = m->_small_elems[s_idx];
+    if (m->_cleanup_fn != NULL)
+        m->_cleanup_fn(NULL, m_value_from_elem(m, elem), NULL);
+    m_free_elem(m, elem);
+
+    // keep the array packed by moving the last element into the hole
+    m->_length--;
+    m->_small_elems[s_idx] = m->_small_elems[m->_length];
+    m->_small_tags[s_idx] = m->_small_tags[m->_length];
+}
+
+void m_remove_prehashed(Map *m, const char *k, size_t len, uint64_t hash) {
+    assert(m->_snapshot == NULL);
+    if (m_is_small(m)) {
+        m_remove_small(m, k, len, hash);
+        return;
+    }
+
+    m_resize_step(m, INCREMENTAL_RESIZE_BUCKETS_PER_OP);
+
+    if (m_remove_from_bucket(m, m_bucket_at(m, m_bucket_index(m, hash)), k, len, hash))
+        return;
+    if (m_is_resizing(m))
+        m_remove_from_bucket(m, m_old_bucket_for(m, hash), k, len, hash);
+}
+
+void m_remove(Map *m, const char *k) {
+    size_t len = strlen(k);
+    m_remove_prehashed(m, k, len, m_hash(k, len));
+}
+
+// Returns the new element. A NULL data leaves its value uninitialised for
+// the caller to fill in.
+void *m_insert_hashed_unsafe(Map *m, const char *k, size_t len, uint64_t hash,
+                             void *data) {
+    if (m_is_small(m)) {
+        if (m->_length < MAP_SMALL_CAPACITY) {
+            MapElem *elem = (MapElem *) m_create_elem(m, NULL, k, len, hash, data);
+            m->_small_elems[m->_length] = elem;
+            m->_small_tags[m->_length] = m_small_tag(hash);
+            m->_length++;
+            return elem;
+        }
+        m_spill_small(m);
+    }
+
     m_ensure_space(m);
 
-    size_t b_idx = m_default_hash(k, m->_bucket_count);
-    void *elem = m_create_elem(m, *(void **) m_bucket_at(m, b_idx), k, data);
+    size_t b_idx = m_bucket_index(m, hash);
+    void *elem = m_create_elem(m, *(void **) m_bucket_at(m, b_idx), k, len, hash, data);
 
     m_set_bucket(m, elem, b_idx);
     m->_length++;
+    return elem;
 }
 
-void m_insert(Map *m, const char *k, void *data) {
-    void *elem = m_match(m, k);
+void m_insert_unsafe(Map *m, const char *k, void *data) {
+    size_t len = strlen(k);
+    m_insert_hashed_unsafe(m, k, len, m_hash(k, len), data);
+}
+
+void m_insert_prehashed(Map *m, const char *k, size_t len, uint64_t hash,
+                        void *data) {
+    assert(m->_snapshot == NULL);
+    void *elem = m_match_hashed(m, k, len, hash);
     if (elem == NULL) {
-        m_insert_unsafe(m, k, data);
+        m_insert_hashed_unsafe(m, k, len, hash, data);
         return;
     }
 
@@ -210,23 +742,41 @@ void m_insert(Map *m, const char *k, void *data) {
     m_set_value_at_elem(m, elem, data);
 }
 
+void m_insert(Map *m, const char *k, void *data) {
+    size_t len = strlen(k);
+    m_insert_prehashed(m, k, len, m_hash(k, len), data);
+}
+
 void m_free(Map *m) {
-    for (size_t b_idx = 0; b_idx < m->_bucket_count; b_idx++) {
-        void *c_elem = *(void **) m_bucket_at(m, b_idx);
-        void *n_elem = NULL;
-        while (c_elem != NULL) {
-            n_elem = *(void **) c_elem;
+    if (m->_snapshot != NULL) {
+        // the mapping, and the Map itself, belong to the snapshot's
+        // allocator; values in the file are never cleaned up
+        a_free(m->_allocator, (void *) m->_snapshot, (size_t) m->_snapshot->_size);
+        a_free(m->_allocator, m, sizeof(Map));
+        return;
+    }
 
-            if (m->_cleanup_fn)
-                m->_cleanup_fn(NULL, m_value_from_elem(m, c_elem), NULL);
+    m_finish_resize(m);
 
-            free(c_elem);
-            c_elem = n_elem;
+    // elements go with the slab, so they only have to be visited to run
+    // the cleanup function
+    if (m->_cleanup_fn) {
+        for (size_t s_idx = 0; m_is_small(m) && s_idx < m->_length; s_idx++)
+            m->_cleanup_fn(NULL, m_value_from_elem(m, m->_small_elems[s_idx]), NULL);
+
+        for (size_t b_idx = 0; b_idx < m->_bucket_count; b_idx++) {
+            void *c_elem = *(void **) m_bucket_at(m, b_idx);
+            while (c_elem != NULL) {
+                m->_cleanup_fn(NULL, m_value_from_elem(m, c_elem), NULL);
+                c_elem = *(void **) c_elem;
+            }
         }
     }
+    m_slab_free(&m->_slab, m->_allocator);
 
-    free(m->_buckets);
-    free(m);
+    if (m->_buckets != NULL)
+        a_free(m->_allocator, m->_buckets, m->_bucket_count * sizeof(void *));
+    a_free(m->_allocator, m, sizeof(Map));
 }
 
 void map_union(char *k, void *d, void *aux) {
@@ -0,0 +1,192 @@
+#ifndef CMAPFILE_H
+#define CMAPFILE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "cmap.h"
+#include "cmmap.h"
+
+// Saving a Map as a snapshot file and opening one again. See
+// MapSnapshotHeader in cmap.h for the format. An opened snapshot is served
+// straight from the mapped pages: opening costs one mmap and a check of
+// the header, nothing is copied, and lookups allocate nothing.
+//
+// The bucket and entries a lookup or m_map reads are checked as they are
+// read, so a damaged file reads as missing bindings, never out of bounds.
+// m_snapshot_verify checks the whole file up front, at the cost of
+// reading all of it.
+
+void m_snapshot_collect(__attribute__((unused)) char *k, void *v, void *aux) {
+    MapElem *elem = m_elem_from_value(NULL, v);
+    v_push_back((Vector *) aux, &elem);
+}
+
+int m_snapshot_write_entry(FILE *f, Map *m, MapElem *elem) {
+    static const char padding[MAP_SNAPSHOT_ALIGNMENT] = {0};
+
+    MapElem header;
+    header._next = NULL;
+    header._hash = elem->_hash;
+    header._key_length = elem->_key_length;
+
+    size_t n = m_elem_size(m, elem->_key_length);
+    size_t pad = m_snapshot_entry_size(m, elem) - n;
+    if (fwrite(&header, sizeof(MapElem), 1, f) != 1) return -1;
+    if (m->_stride && fwrite(m_value_from_elem(m, elem), m->_stride, 1, f) != 1) return -1;
+    if (fwrite(m_key_from_elem(m, elem), elem->_key_length + 1, 1, f) != 1) return -1;
+    if (pad && fwrite(padding, pad, 1, f) != 1) return -1;
+    return 0;
+}
+
+// Writes every binding of m to path. Returns 0 on success and -1 if the
+// file could not be written.
+int m_save(Map *m, const char *path) {
+    Vector *elems = v_make(sizeof(MapElem *));
+    m_map(m, m_snapshot_collect, elems);
+    size_t n = v_size(elems);
+
+    size_t bucket_count = 1;
+    while (bucket_count < n) bucket_count *= 2;
+
+    // group the entries by bucket with a counting sort
+    uint64_t *offsets = (uint64_t *) calloc(bucket_count + 1, sizeof(uint64_t));
+    size_t *firsts = (size_t *) calloc(bucket_count + 1, sizeof(size_t));
+    MapElem **sorted = (MapElem **) malloc((n ? n : 1) * sizeof(MapElem *));
+    assert(offsets != NULL && firsts != NULL && sorted != NULL);
+
+    for (size_t e_idx = 0; e_idx < n; e_idx++) {
+        MapElem *elem = *(MapElem **) v_at(elems, e_idx);
+        size_t b_idx = (size_t) elem->_hash & (bucket_count - 1);
+        firsts[b_idx + 1]++;
+        offsets[b_idx + 1] += m_snapshot_entry_size(m, elem);
+    }
+    for (size_t b_idx = 0; b_idx < bucket_count; b_idx++) {
+        firsts[b_idx + 1] += firsts[b_idx];
+        offsets[b_idx + 1] += offsets[b_idx];
+    }
+    for (size_t e_idx = 0; e_idx < n; e_idx++) {
+        MapElem *elem = *(MapElem **) v_at(elems, e_idx);
+        sorted[firsts[(size_t) elem->_hash & (bucket_count - 1)]++] = elem;
+    }
+
+    MapSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header._magic, MAP_SNAPSHOT_MAGIC, sizeof(header._magic));
+    header._stride = m->_stride;
+    header._length = n;
+    header._bucket_count = bucket_count;
+    header._buckets_offset = sizeof(MapSnapshotHeader);
+    header._entries_offset = header._buckets_offset + (bucket_count + 1) * sizeof(uint64_t);
+    header._size = header._entries_offset + offsets[bucket_count];
+
+    int result = -1;
+    FILE *f = fopen(path, "wb");
+    if (f != NULL) {
+        result = 0;
+        if (fwrite(&header, sizeof(header), 1, f) != 1
+            || fwrite(offsets, sizeof(uint64_t), bucket_count + 1, f) != bucket_count + 1)
+            result = -1;
+        for (size_t e_idx = 0; result == 0 && e_idx < n; e_idx++)
+            result = m_snapshot_write_entry(f, m, sorted[e_idx]);
+        if (fclose(f) != 0) result = -1;
+    }
+
+    free(offsets);
+    free(firsts);
+    free(sorted);
+    v_free(elems);
+    return result;
+}
+
+// The checks m_open_mapped makes: the header and the offsets it holds,
+// and the two ends of the bucket offsets, all in constant time.
+bool m_snapshot_header_valid(const MapSnapshotHeader *header, size_t size) {
+    if (size < sizeof(MapSnapshotHeader)) return false;
+    if (memcmp(header->_magic, MAP_SNAPSHOT_MAGIC, sizeof(header->_magic)) != 0) return false;
+    if (header->_size != size || header->_stride > size) return false;
+
+    uint64_t bucket_count = header->_bucket_count;
+    if (bucket_count == 0 || (bucket_count & (bucket_count - 1)) != 0) return false;
+    if (bucket_count >= size / sizeof(uint64_t)) return false;
+    if (header->_buckets_offset % sizeof(uint64_t) != 0) return false;
+    if (header->_buckets_offset > size
+        || (bucket_count + 1) * sizeof(uint64_t) > size - header->_buckets_offset)
+        return false;
+    if (header->_entries_offset % MAP_SNAPSHOT_ALIGNMENT != 0) return false;
+    if (header->_entries_offset > size) return false;
+
+    const uint64_t *buckets =
+        (const uint64_t *) (((const char *) header) + header->_buckets_offset);
+    return buckets[0] == 0 && buckets[bucket_count] <= size - header->_entries_offset;
+}
+
+// Checks that bucket b's entries exactly fill its range, each one whole,
+// NUL terminated and hashed to b.
+bool m_snapshot_bucket_valid(Map *m, const char *entries, uint64_t b_idx,
+                             uint64_t start, uint64_t end, uint64_t *n_entries) {
+    uint64_t off = start;
+    while (off < end) {
+        MapElem *entry = m_snapshot_entry(m, entries, off, end);
+        if (entry == NULL) return false;
+        size_t entry_size = m_snapshot_entry_size(m, entry);
+        if (entry_size > end - off) return false;
+        if ((entry->_hash & (m->_snapshot->_bucket_count - 1)) != b_idx) return false;
+
+        off += entry_size;
+        (*n_entries)++;
+    }
+    return off == end;
+}
+
+// Checks every bucket and entry of an opened snapshot: that they are in
+// order and fill the file exactly, and that each entry hashes to its
+// bucket and the count matches the header. Reads the whole file.
+bool m_snapshot_verify(Map *m) {
+    assert(m->_snapshot != NULL);
+    const MapSnapshotHeader *header = m->_snapshot;
+    const uint64_t *buckets =
+        (const uint64_t *) (((const char *) header) + header->_buckets_offset);
+    const char *entries = ((const char *) header) + header->_entries_offset;
+
+    uint64_t n_entries = 0;
+    for (uint64_t b_idx = 0; b_idx < header->_bucket_count; b_idx++) {
+        if (buckets[b_idx] > buckets[b_idx + 1]) return false;
+        if (!m_snapshot_bucket_valid(m, entries, b_idx, buckets[b_idx], buckets[b_idx + 1],
+                                     &n_entries))
+            return false;
+    }
+    return n_entries == header->_length;
+}
+
+// Maps the snapshot at path and returns it as a read-only Map: m_get,
+// m_get_prehashed, m_map and m_size work as usual, m_insert and m_remove
+// must not be called. m_free unmaps the file. Returns NULL if the file
+// cannot be mapped or its header is not a snapshot's.
+Map *m_open_mapped(const char *path) {
+    MappedFile *mf = mf_open(path, false, 0, 1);
+    if (mf == NULL) return NULL;
+
+    const MapSnapshotHeader *header = (const MapSnapshotHeader *) mf->_base;
+    if (header == NULL || !m_snapshot_header_valid(header, mf->_mapped_size)) {
+        if (header == NULL) {
+            close(mf->_fd);
+            free(mf);
+        } else {
+            mf_free(mf->_base, mf->_mapped_size, mf);
+        }
+        return NULL;
+    }
+
+    Map *m = (Map *) a_alloc(&mf->_allocator, sizeof(Map));
+    assert(m != NULL);
+    m_init_with_allocator(m, (size_t) header->_stride, &mf->_allocator);
+    m->_snapshot = header;
+    m->_length = (size_t) header->_length;
+    return m;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef CMMAP_H
+#define CMMAP_H
+
+// mremap and MREMAP_MAYMOVE are GNU extensions. This only takes effect if
+// cmmap.h comes before any system header; otherwise growth falls back to
+// mapping the file afresh.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "callocator.h"
+#include "cvector.h"
+
+// A MappedFile is an Allocator whose one large block is a shared mapping of
+// a file. Reallocating that block grows the file with ftruncate and the
+// mapping with mremap (or a fresh mmap where mremap is unavailable). Any
+// other block it is asked for, such as the Vector header itself, comes from
+// malloc. The MappedFile frees itself once the mapping and every block it
+// handed out have been released.
+typedef struct {
+    Allocator _allocator;
+
+    int _fd;
+    void *_base;
+    size_t _mapped_size;
+    bool _writable;
+
+    // element size and live length of the owning container, used to trim
+    // the file to its contents when the mapping is released
+    size_t _stride;
+    const size_t *_length;
+
+    size_t _n_blocks;
+} MappedFile;
+
+void mf_release_if_unused(MappedFile *mf) {
+    if (mf->_base == NULL && mf->_fd < 0 && mf->_n_blocks == 0)
+        free(mf);
+}
+
+void *mf_alloc(size_t n, void *ctx) {
+    MappedFile *mf = (MappedFile *) ctx;
+    void *p = malloc(n);
+    if (p != NULL) mf->_n_blocks++;
+    return p;
+}
+
+void *mf_map(MappedFile *mf, size_t n) {
+    void *p = mmap(NULL, n, mf->_writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, mf->_fd, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void *mf_realloc(void *p, size_t old_n, size_t new_n, void *ctx) {
+    MappedFile *mf = (MappedFile *) ctx;
+    if (p != mf->_base || p == NULL) {
+        // an ordinary heap block
+        void *new_p = realloc(p, new_n);
+        if (p == NULL && new_p != NULL) mf->_n_blocks++;
+        return new_p;
+    }
+
+    assert(mf->_writable);
+    (void) old_n;
+    if (ftruncate(mf->_fd, (off_t) new_n) != 0) return NULL;
+
+#ifdef MREMAP_MAYMOVE
+    void *new_base = mremap(mf->_base, mf->_mapped_size, new_n, MREMAP_MAYMOVE);
+    if (new_base == MAP_FAILED) return NULL;
+#else
+    // map the new size first, so that on failure the old mapping is
+    // still there for the vector
+    void *new_base = mf_map(mf, new_n);
+    if (new_base == NULL) return NULL;
+    munmap(mf->_base, mf->_mapped_size);
+#endif
+
+    mf->_base = new_base;
+    mf->_mapped_size = new_n;
+    return new_base;
+}
+
+void mf_free(void *p, __attribute__((unused)) size_t n, void *ctx) {
+    MappedFile *mf = (MappedFile *) ctx;
+    if (p == NULL) return;
+
+    if (p != mf->_base) {
+        free(p);
+        mf->_n_blocks--;
+        mf_release_if_unused(mf);
+        return;
+    }
+
+    munmap(mf->_base, mf->_mapped_size);
+    if (mf->_writable && mf->_length != NULL) {
+        // drop the unused capacity at the end of the file
+        int result = ftruncate(mf->_fd, (off_t) (*mf->_length * mf->_stride));
+        (void) result;
+    }
+    close(mf->_fd);
+    mf->_base = NULL;
+    mf->_fd = -1;
+    mf_release_if_unused(mf);
+}
+
+MappedFile *mf_make(int fd, bool writable, size_t stride) {
+    MappedFile *mf = (MappedFile *) malloc(sizeof(MappedFile));
+    assert(mf != NULL);
+
+    mf->_allocator._alloc = mf_alloc;
+    mf->_allocator._realloc = mf_realloc;
+    mf->_allocator._free = mf_free;
+    mf->_allocator._ctx = mf;
+
+    mf->_fd = fd;
+    mf->_base = NULL;
+    mf->_mapped_size = 0;
+    mf->_writable = writable;
+    mf->_stride = stride;
+    mf->_length = NULL;
+    mf->_n_blocks = 0;
+    return mf;
+}
+
+// Maps the whole file at path. Returns NULL if it cannot be opened or
+// mapped. An empty read-only file maps to a NULL base.
+MappedFile *mf_open(const char *path, bool writable, size_t min_size, size_t stride) {
+    int fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    if (writable && size < min_size) {
+        if (ftruncate(fd, (off_t) min_size) != 0) {
+            close(fd);
+            return NULL;
+        }
+        size = min_size;
+    }
+
+    MappedFile *mf = mf_make(fd, writable, stride);
+    if (size > 0) {
+        mf->_base = mf_map(mf, size);
+        if (mf->_base == NULL) {
+            close(fd);
+            free(mf);
+            return NULL;
+        }
+        mf->_mapped_size = size;
+    }
+    return mf;
+}
+
+// File-backed vectors. The file holds the elements back to back and
+// nothing else, so its length in elements is its size divided by the
+// stride. Writable vectors grow the file as they grow and trim it to their
+// length in v_free. Read-only vectors serve v_at and v_map straight from
+// the page cache without copying, and cannot grow.
+
+Vector *v_mmap_wrap(MappedFile *mf, size_t length) {
+    Vector *v = (Vector *) a_alloc(&mf->_allocator, sizeof(Vector));
+    assert(v != NULL);
+
+    v->_allocator = &mf->_allocator;
+    v->_data = mf->_base;
+    v->_stride = mf->_stride;
+    v->_length = length;
+    v->_capacity = mf->_mapped_size / mf->_stride;
+    v->_inline_capacity = 0;
+    v->_cleanup_fn = NULL;
+
+    mf->_length = &v->_length;
+    return v;
+}
+
+// Creates (or truncates) the file at path and returns an empty vector
+// backed by it.
+Vector *v_mmap_create(const char *path, size_t stride) {
+    assert(stride > 0);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return NULL;
+    close(fd);
+
+    MappedFile *mf = mf_open(path, true, DEFAULT_VECTOR_SIZE * stride, stride);
+    if (mf == NULL) return NULL;
+    return v_mmap_wrap(mf, 0);
+}
+
+// Opens an existing file of elements. Read-only vectors must not be
+// written through; writable ones can be appended to.
+Vector *v_mmap_open(const char *path, size_t stride, bool writable) {
+    assert(stride > 0);
+
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+    size_t length = (size_t) st.st_size / stride;
+
+    size_t min_size = 0;
+    if (writable)
+        min_size = (length > DEFAULT_VECTOR_SIZE ? length : DEFAULT_VECTOR_SIZE) * stride;
+
+    MappedFile *mf = mf_open(path, writable, min_size, stride);
+    if (mf == NULL) return NULL;
+    return v_mmap_wrap(mf, length);
+}
+
+bool v_is_mmapped(const Vector *v) {
+    return v->_allocator != NULL && v->_allocator->_alloc == mf_alloc;
+}
+
+// Passes an madvise hint (MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, ...)
+// for the vector's elements.
+int v_mmap_advise(Vector *v, int advice) {
+    assert(v_is_mmapped(v));
+    if (v->_data == NULL || v_size(v) == 0) return 0;
+    return madvise(v->_data, v_size(v) * v->_stride, advice);
+}
+
+int v_mmap_advise_sequential(Vector *v) {
+    return v_mmap_advise(v, MADV_SEQUENTIAL);
+}
+
+// Flushes written elements to the file.
+int v_mmap_sync(Vector *v) {
+    assert(v_is_mmapped(v));
+    if (v->_data == NULL || v_size(v) == 0) return 0;
+    return msync(v->_data, v_size(v) * v->_stride, MS_SYNC);
+}
+
+#endif
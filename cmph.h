@@ -0,0 +1,223 @@
+#ifndef CMPH_H
+#define CMPH_H
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "callocator.h"
+#include "cmap.h"
+
+// A PerfectHash is a read-only string map built once from a fixed set of
+// keys. It uses a minimal perfect hash in the hash-and-displace style:
+// keys are hashed into buckets of about PERFECT_HASH_KEYS_PER_BUCKET keys,
+// and every bucket stores the seed that sends its keys to slots no other
+// key uses. There are exactly as many slots as keys, and a lookup is one
+// hash, one seed load and one slot probe, whether or not the key is
+// present.
+//
+// Keys are copied, values (stride bytes each) are copied in from an array
+// in the same order as the keys. Keys must be distinct: ph_make returns
+// NULL for a key set with duplicates, as it does for the (astronomically
+// unlikely) set in which two keys share all 64 bits of their hash.
+#define PERFECT_HASH_KEYS_PER_BUCKET 4
+
+typedef struct {
+    uint64_t _hash;
+    char *_key;
+} PerfectHashEntry;
+
+typedef struct {
+    size_t _length;
+    size_t _stride;
+
+    size_t _n_buckets;
+    uint32_t *_seeds;
+
+    // _length slots each
+    PerfectHashEntry *_entries;
+    char *_values;
+
+    const Allocator *_allocator;
+} PerfectHash;
+
+// Maps a hash onto [0, n) with a multiply instead of a division.
+size_t ph_reduce(uint64_t hash, size_t n) {
+#ifdef __SIZEOF_INT128__
+    return (size_t) (((__uint128_t) hash * n) >> 64);
+#else
+    return (size_t) (hash % n);
+#endif
+}
+
+size_t ph_bucket(PerfectHash *ph, uint64_t hash) {
+    return ph_reduce(hash, ph->_n_buckets);
+}
+
+size_t ph_slot(uint64_t hash, uint32_t seed, size_t n) {
+    return ph_reduce(m_hash_mix(hash ^ MAP_HASH_P2, MAP_HASH_P1 ^ ((uint64_t) seed * MAP_HASH_P0)), n);
+}
+
+// Tries seeds for the keys of one bucket (indices into hashes) until they
+// all land on distinct free slots, then marks those slots taken and sets
+// *seed. Returns false if no seed can place them.
+bool ph_place_bucket(const uint64_t *hashes, const size_t *members, size_t n_members,
+                     bool *taken, size_t *slots, size_t n, uint32_t *seed) {
+    // keys with equal hashes land on the same slot for every seed; equal
+    // keys always do, so this is also where duplicates are caught
+    for (size_t a_idx = 0; a_idx < n_members; a_idx++)
+        for (size_t b_idx = a_idx + 1; b_idx < n_members; b_idx++)
+            if (hashes[members[a_idx]] == hashes[members[b_idx]]) return false;
+
+    for (uint32_t s = 0;; s++) {
+        size_t placed = 0;
+        for (; placed < n_members; placed++) {
+            size_t slot = ph_slot(hashes[members[placed]], s, n);
+            if (taken[slot]) break;
+            taken[slot] = true;
+            slots[placed] = slot;
+        }
+        if (placed == n_members) {
+            *seed = s;
+            return true;
+        }
+
+        for (size_t p_idx = 0; p_idx < placed; p_idx++)
+            taken[slots[p_idx]] = false;
+        if (s == UINT32_MAX) return false;
+    }
+}
+
+void ph_free(PerfectHash *ph);
+
+// Returns NULL if keys holds a duplicate.
+PerfectHash *ph_make_with_allocator(size_t stride, const char **keys, const void *values,
+                                    size_t n, const Allocator *a) {
+    PerfectHash *ph = (PerfectHash *) a_alloc(a, sizeof(PerfectHash));
+    assert(ph != NULL);
+
+    ph->_length = n;
+    ph->_stride = stride;
+    ph->_allocator = a;
+    ph->_n_buckets = n / PERFECT_HASH_KEYS_PER_BUCKET + 1;
+    ph->_seeds = (uint32_t *) a_calloc(a, ph->_n_buckets, sizeof(uint32_t));
+    ph->_entries = (PerfectHashEntry *) a_calloc(a, n ? n : 1, sizeof(PerfectHashEntry));
+    ph->_values = (char *) a_calloc(a, n ? n : 1, stride ? stride : 1);
+    assert(ph->_seeds != NULL && ph->_entries != NULL && ph->_values != NULL);
+
+    // scratch space for the build
+    uint64_t *hashes = (uint64_t *) malloc((n + 1) * sizeof(uint64_t));
+    size_t *firsts = (size_t *) calloc(ph->_n_buckets + 1, sizeof(size_t));
+    size_t *members = (size_t *) malloc((n + 1) * sizeof(size_t));
+    size_t *order = (size_t *) malloc(ph->_n_buckets * sizeof(size_t));
+    size_t *by_size = (size_t *) calloc(n + 2, sizeof(size_t));
+    size_t *slots = (size_t *) malloc((n + 1) * sizeof(size_t));
+    bool *taken = (bool *) calloc(n + 1, sizeof(bool));
+    assert(hashes && firsts && members && order && by_size && slots && taken);
+
+    // group the keys by bucket with a counting sort
+    for (size_t k_idx = 0; k_idx < n; k_idx++) {
+        hashes[k_idx] = m_hash_string(keys[k_idx]);
+        firsts[ph_bucket(ph, hashes[k_idx]) + 1]++;
+    }
+    for (size_t b_idx = 0; b_idx < ph->_n_buckets; b_idx++)
+        firsts[b_idx + 1] += firsts[b_idx];
+    for (size_t k_idx = 0; k_idx < n; k_idx++) {
+        size_t b_idx = ph_bucket(ph, hashes[k_idx]);
+        members[firsts[b_idx]++] = k_idx;
+    }
+    for (size_t b_idx = ph->_n_buckets; b_idx > 0; b_idx--)
+        firsts[b_idx] = firsts[b_idx - 1];
+    firsts[0] = 0;
+
+    // and place the biggest buckets first, while most slots are free:
+    // by_size[s] counts the buckets of at least s keys, which is where the
+    // buckets of exactly s keys end in order
+    for (size_t b_idx = 0; b_idx < ph->_n_buckets; b_idx++)
+        by_size[firsts[b_idx + 1] - firsts[b_idx]]++;
+    for (size_t size = n; size > 0; size--)
+        by_size[size - 1] += by_size[size];
+    for (size_t b_idx = 0; b_idx < ph->_n_buckets; b_idx++) {
+        size_t size = firsts[b_idx + 1] - firsts[b_idx];
+        order[--by_size[size]] = b_idx;
+    }
+    bool placed = true;
+    for (size_t o_idx = 0; placed && o_idx < ph->_n_buckets; o_idx++) {
+        size_t b_idx = order[o_idx];
+        size_t first = firsts[b_idx], n_members = firsts[b_idx + 1] - first;
+        if (n_members == 0) break;
+
+        placed = ph_place_bucket(hashes, members + first, n_members, taken, slots, n,
+                                 ph->_seeds + b_idx);
+        if (!placed) break;
+        for (size_t m_idx = 0; m_idx < n_members; m_idx++) {
+            size_t k_idx = members[first + m_idx];
+            size_t len = strlen(keys[k_idx]);
+            PerfectHashEntry *entry = ph->_entries + slots[m_idx];
+
+            entry->_hash = hashes[k_idx];
+            entry->_key = (char *) a_alloc(a, len + 1);
+            assert(entry->_key != NULL);
+            memcpy(entry->_key, keys[k_idx], len + 1);
+            memcpy(ph->_values + slots[m_idx] * stride,
+                   ((const char *) values) + k_idx * stride, stride);
+        }
+    }
+
+    free(hashes);
+    free(firsts);
+    free(members);
+    free(order);
+    free(by_size);
+    free(slots);
+    free(taken);
+    if (!placed) {
+        ph_free(ph);
+        return NULL;
+    }
+    return ph;
+}
+
+PerfectHash *ph_make(size_t stride, const char **keys, const void *values, size_t n) {
+    return ph_make_with_allocator(stride, keys, values, n, NULL);
+}
+
+size_t ph_size(PerfectHash *ph) {
+    return ph->_length;
+}
+
+void *ph_get_prehashed(PerfectHash *ph, const char *k, uint64_t hash) {
+    if (ph->_length == 0) return NULL;
+
+    size_t slot = ph_slot(hash, ph->_seeds[ph_bucket(ph, hash)], ph->_length);
+    PerfectHashEntry *entry = ph->_entries + slot;
+    if (entry->_hash != hash || strcmp(entry->_key, k) != 0) return NULL;
+    return ph->_values + slot * ph->_stride;
+}
+
+void *ph_get(PerfectHash *ph, const char *k) {
+    return ph_get_prehashed(ph, k, m_hash_string(k));
+}
+
+void ph_map(PerfectHash *ph, MapMappableFn f, void *aux) {
+    for (size_t s_idx = 0; s_idx < ph->_length; s_idx++)
+        f(ph->_entries[s_idx]._key, ph->_values + s_idx * ph->_stride, aux);
+}
+
+void ph_free(PerfectHash *ph) {
+    const Allocator *a = ph->_allocator;
+    size_t n = ph->_length;
+    for (size_t s_idx = 0; s_idx < n; s_idx++) {
+        // NULL in the slots a failed build never filled
+        char *k = ph->_entries[s_idx]._key;
+        if (k != NULL) a_free(a, k, strlen(k) + 1);
+    }
+    a_free(a, ph->_seeds, ph->_n_buckets * sizeof(uint32_t));
+    a_free(a, ph->_entries, (n ? n : 1) * sizeof(PerfectHashEntry));
+    a_free(a, ph->_values, (n ? n : 1) * (ph->_stride ? ph->_stride : 1));
+    a_free(a, ph, sizeof(PerfectHash));
+}
+
+#endif
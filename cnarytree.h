@@ -5,6 +5,8 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "callocator.h"
+
 typedef void (*NAryCleanupFn)(void *);
 typedef void (*NAryMappableFn)(void *, void *);
 
@@ -30,14 +32,18 @@ void nary_add_as_sibling(void *left_cell, void *new_sibling) {
     *nary_sibling(last_cell) = new_sibling;
 }
 
-void *nary_cell_make(size_t stride) {
-    void *cell = malloc(stride + (2 * sizeof(void *)));
+void *nary_cell_make_with_allocator(size_t stride, const Allocator *a) {
+    void *cell = a_alloc(a, stride + (2 * sizeof(void *)));
     assert(cell != NULL);
     *nary_sibling(cell) = NULL;
     *nary_child(cell) = NULL;
     return cell;
 }
 
+void *nary_cell_make(size_t stride) {
+    return nary_cell_make_with_allocator(stride, NULL);
+}
+
 void nary_map(void *cell, NAryMappableFn f, void *aux) {
     if (cell == NULL) return;
 
@@ -46,23 +52,38 @@ void nary_map(void *cell, NAryMappableFn f, void *aux) {
     nary_map(*nary_sibling(cell), f, aux);
 }
 
-void nary_free(void *cell, NAryCleanupFn f) {
+// Cells do not record their size, so freeing through an allocator takes the
+// stride the cells were made with.
+void nary_free_with_allocator(void *cell, NAryCleanupFn f, size_t stride,
+                              const Allocator *a) {
     if (cell == NULL) return;
 
     if (f != NULL) f(nary_data(cell));
-    nary_free(*nary_sibling(cell), f);
-    nary_free(*nary_child(cell), f);
-    free(cell);
+    nary_free_with_allocator(*nary_sibling(cell), f, stride, a);
+    nary_free_with_allocator(*nary_child(cell), f, stride, a);
+    a_free(a, cell, stride + (2 * sizeof(void *)));
 }
 
-void nary_free_children(void *cell, NAryCleanupFn f) {
-    nary_free(*nary_child(cell), f);
+void nary_free(void *cell, NAryCleanupFn f) {
+    nary_free_with_allocator(cell, f, 0, NULL);
+}
+
+void nary_free_children_with_allocator(void *cell, NAryCleanupFn f, size_t stride,
+                                       const Allocator *a) {
+    nary_free_with_allocator(*nary_child(cell), f, stride, a);
     *nary_child(cell) = NULL;
 }
-void nary_add_as_child(void *left_cell, void *new_child, NAryCleanupFn f) {
-    nary_free_children(left_cell, f);
+void nary_free_children(void *cell, NAryCleanupFn f) {
+    nary_free_children_with_allocator(cell, f, 0, NULL);
+}
+void nary_add_as_child_with_allocator(void *left_cell, void *new_child, NAryCleanupFn f,
+                                      size_t stride, const Allocator *a) {
+    nary_free_children_with_allocator(left_cell, f, stride, a);
     *nary_child(left_cell) = new_child;
 }
+void nary_add_as_child(void *left_cell, void *new_child, NAryCleanupFn f) {
+    nary_add_as_child_with_allocator(left_cell, new_child, f, 0, NULL);
+}
 
 void nary_add_among_children(void *parent_cell, void *new_child) {
     if (*nary_child(parent_cell) == NULL) {
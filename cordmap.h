@@ -0,0 +1,337 @@
+#ifndef CORDMAP_H
+#define CORDMAP_H
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "callocator.h"
+#include "cmap.h"
+
+// An OrderedMap is a string map laid out like CPython's compact dicts.
+// Bindings live in a dense entry array in insertion order, so iterating is
+// a linear scan and always visits bindings in the order they were first
+// inserted. Lookups go through a separate open-addressed index of entry
+// numbers, whose slots are only as wide as the entry count needs (one byte
+// for up to 253 entries). Keys are packed into one shared buffer.
+//
+// Removal leaves a hole in the entry array; holes are squeezed out when
+// the entry array next fills up. Pointers returned by om_get are valid
+// until the next insert.
+#define ORDERED_MAP_MIN_INDEX_SIZE 8
+#define ORDERED_MAP_DELETED_ENTRY SIZE_MAX
+
+typedef struct {
+    uint64_t _hash;
+    size_t _key_offset;
+    size_t _key_length;
+} OrderedMapEntry;
+
+typedef struct {
+    size_t _length;
+    size_t _stride;
+
+    MapMappableFn _cleanup_fn;
+
+    // entries, each an OrderedMapEntry followed by the value
+    char *_entries;
+    size_t _entry_stride;
+    size_t _n_entries;
+    size_t _entry_capacity;
+
+    // index slots hold an entry number, or the two largest values of the
+    // slot width for empty and deleted slots
+    void *_index;
+    size_t _index_size;
+    size_t _index_width;
+
+    char *_keys;
+    size_t _keys_used;
+    size_t _keys_capacity;
+
+    const Allocator *_allocator;
+} OrderedMap;
+
+uint64_t om_index_empty(OrderedMap *m) {
+    return m->_index_width == 8 ? UINT64_MAX
+        : (((uint64_t) 1) << (8 * m->_index_width)) - 1;
+}
+
+uint64_t om_index_deleted(OrderedMap *m) {
+    return om_index_empty(m) - 1;
+}
+
+uint64_t om_index_get(OrderedMap *m, size_t slot) {
+    switch (m->_index_width) {
+    case 1: return ((uint8_t *) m->_index)[slot];
+    case 2: return ((uint16_t *) m->_index)[slot];
+    case 4: return ((uint32_t *) m->_index)[slot];
+    default: return ((uint64_t *) m->_index)[slot];
+    }
+}
+
+void om_index_set(OrderedMap *m, size_t slot, uint64_t v) {
+    switch (m->_index_width) {
+    case 1: ((uint8_t *) m->_index)[slot] = (uint8_t) v; break;
+    case 2: ((uint16_t *) m->_index)[slot] = (uint16_t) v; break;
+    case 4: ((uint32_t *) m->_index)[slot] = (uint32_t) v; break;
+    default: ((uint64_t *) m->_index)[slot] = v; break;
+    }
+}
+
+OrderedMapEntry *om_entry_at(OrderedMap *m, size_t e_idx) {
+    return (OrderedMapEntry *) (m->_entries + e_idx * m->_entry_stride);
+}
+
+void *om_value_from_entry(__attribute__((unused)) OrderedMap *m, OrderedMapEntry *e) {
+    return e + 1;
+}
+
+char *om_key_from_entry(OrderedMap *m, OrderedMapEntry *e) {
+    return m->_keys + e->_key_offset;
+}
+
+bool om_entry_is_deleted(OrderedMapEntry *e) {
+    return e->_key_offset == ORDERED_MAP_DELETED_ENTRY;
+}
+
+// Entries fill at most two thirds of the index, so probes stay short and
+// always reach an empty slot.
+size_t om_entry_capacity_for(size_t index_size) {
+    return index_size * 2 / 3;
+}
+
+// Sets up an empty index and entry array of the given index size.
+void om_allocate(OrderedMap *m, size_t index_size) {
+    m->_index_size = index_size;
+    m->_entry_capacity = om_entry_capacity_for(index_size);
+    m->_n_entries = 0;
+
+    m->_index_width = 8;
+    if (m->_entry_capacity < UINT8_MAX - 1) m->_index_width = 1;
+    else if (m->_entry_capacity < UINT16_MAX - 1) m->_index_width = 2;
+    else if (m->_entry_capacity < UINT32_MAX - 1) m->_index_width = 4;
+
+    m->_index = a_alloc(m->_allocator, index_size * m->_index_width);
+    m->_entries = (char *) a_alloc(m->_allocator, m->_entry_capacity * m->_entry_stride);
+    assert(m->_index != NULL && m->_entries != NULL);
+    // every byte 0xFF is the empty marker at any width
+    memset(m->_index, 0xFF, index_size * m->_index_width);
+}
+
+void om_init_with_allocator(OrderedMap *m, size_t stride, const Allocator *a) {
+    m->_allocator = a;
+    m->_cleanup_fn = NULL;
+    m->_stride = stride;
+    m->_length = 0;
+
+    size_t value_size = (stride + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    m->_entry_stride = sizeof(OrderedMapEntry) + value_size;
+
+    m->_keys = NULL;
+    m->_keys_used = 0;
+    m->_keys_capacity = 0;
+
+    om_allocate(m, ORDERED_MAP_MIN_INDEX_SIZE);
+}
+
+void om_init(OrderedMap *m, size_t stride) {
+    om_init_with_allocator(m, stride, NULL);
+}
+
+OrderedMap *om_make_with_allocator(size_t stride, const Allocator *a) {
+    OrderedMap *m = (OrderedMap *) a_alloc(a, sizeof(OrderedMap));
+    assert(m != NULL);
+
+    om_init_with_allocator(m, stride, a);
+    return m;
+}
+
+OrderedMap *om_make(size_t stride) {
+    return om_make_with_allocator(stride, NULL);
+}
+
+size_t om_size(OrderedMap *m) {
+    return m->_length;
+}
+
+// Returns the index slot holding k, or the index size if k is not bound.
+// In that case *insert_slot is set to the slot a new binding should use.
+size_t om_find_slot(OrderedMap *m, const char *k, size_t len, uint64_t hash,
+                    size_t *insert_slot) {
+    size_t mask = m->_index_size - 1;
+    uint64_t empty = om_index_empty(m), deleted = om_index_deleted(m);
+    size_t first_deleted = m->_index_size;
+
+    for (size_t slot = (size_t) hash & mask;; slot = (slot + 1) & mask) {
+        uint64_t e_idx = om_index_get(m, slot);
+        if (e_idx == empty) {
+            if (insert_slot != NULL)
+                *insert_slot = first_deleted < m->_index_size ? first_deleted : slot;
+            return m->_index_size;
+        }
+        if (e_idx == deleted) {
+            if (first_deleted == m->_index_size) first_deleted = slot;
+            continue;
+        }
+
+        OrderedMapEntry *e = om_entry_at(m, (size_t) e_idx);
+        if (e->_hash == hash && e->_key_length == len
+            && memcmp(om_key_from_entry(m, e), k, len) == 0)
+            return slot;
+    }
+}
+
+void *om_get_prehashed(OrderedMap *m, const char *k, size_t len, uint64_t hash) {
+    size_t slot = om_find_slot(m, k, len, hash, NULL);
+    if (slot == m->_index_size) return NULL;
+    return om_value_from_entry(m, om_entry_at(m, (size_t) om_index_get(m, slot)));
+}
+
+void *om_get(OrderedMap *m, const char *k) {
+    size_t len = strlen(k);
+    return om_get_prehashed(m, k, len, m_hash(k, len));
+}
+
+// Rebuilds the map with an index sized for the live bindings plus room to
+// grow, dropping deleted entries and the key bytes they held.
+void om_rebuild(OrderedMap *m) {
+    size_t index_size = ORDERED_MAP_MIN_INDEX_SIZE;
+    while (om_entry_capacity_for(index_size) < (m->_length + 1) * 3 / 2 + 1)
+        index_size *= 2;
+
+    char *old_entries = m->_entries;
+    size_t old_n_entries = m->_n_entries;
+    size_t old_entry_capacity = m->_entry_capacity;
+    char *old_keys = m->_keys;
+    size_t old_keys_capacity = m->_keys_capacity;
+
+    a_free(m->_allocator, m->_index, m->_index_size * m->_index_width);
+    om_allocate(m, index_size);
+
+    size_t keys_capacity = old_keys_capacity ? old_keys_capacity : 64;
+    m->_keys = (char *) a_alloc(m->_allocator, keys_capacity);
+    assert(m->_keys != NULL);
+    m->_keys_capacity = keys_capacity;
+    m->_keys_used = 0;
+
+    size_t mask = m->_index_size - 1;
+    for (size_t e_idx = 0; e_idx < old_n_entries; e_idx++) {
+        OrderedMapEntry *old_e = (OrderedMapEntry *) (old_entries + e_idx * m->_entry_stride);
+        if (om_entry_is_deleted(old_e)) continue;
+
+        OrderedMapEntry *e = om_entry_at(m, m->_n_entries);
+        memcpy(e, old_e, m->_entry_stride);
+        e->_key_offset = m->_keys_used;
+        memcpy(m->_keys + m->_keys_used, old_keys + old_e->_key_offset, old_e->_key_length + 1);
+        m->_keys_used += old_e->_key_length + 1;
+
+        size_t slot = (size_t) e->_hash & mask;
+        while (om_index_get(m, slot) != om_index_empty(m))
+            slot = (slot + 1) & mask;
+        om_index_set(m, slot, m->_n_entries);
+        m->_n_entries++;
+    }
+
+    a_free(m->_allocator, old_entries, old_entry_capacity * m->_entry_stride);
+    if (old_keys != NULL)
+        a_free(m->_allocator, old_keys, old_keys_capacity);
+}
+
+size_t om_store_key(OrderedMap *m, const char *k, size_t len) {
+    if (m->_keys_used + len + 1 > m->_keys_capacity) {
+        size_t capacity = m->_keys_capacity ? m->_keys_capacity : 64;
+        while (capacity < m->_keys_used + len + 1) capacity *= 2;
+        char *keys = (char *) a_realloc(m->_allocator, m->_keys, m->_keys_capacity, capacity);
+        assert(keys != NULL);
+        m->_keys = keys;
+        m->_keys_capacity = capacity;
+    }
+
+    size_t offset = m->_keys_used;
+    memcpy(m->_keys + offset, k, len + 1);
+    m->_keys_used += len + 1;
+    return offset;
+}
+
+// Rebinding an existing key keeps its place in the iteration order.
+void om_insert_prehashed(OrderedMap *m, const char *k, size_t len, uint64_t hash,
+                         void *data) {
+    size_t insert_slot;
+    size_t slot = om_find_slot(m, k, len, hash, &insert_slot);
+    if (slot != m->_index_size) {
+        OrderedMapEntry *e = om_entry_at(m, (size_t) om_index_get(m, slot));
+        if (m->_cleanup_fn != NULL)
+            m->_cleanup_fn(NULL, om_value_from_entry(m, e), NULL);
+        memcpy(om_value_from_entry(m, e), data, m->_stride);
+        return;
+    }
+
+    if (m->_n_entries == m->_entry_capacity) {
+        om_rebuild(m);
+        om_find_slot(m, k, len, hash, &insert_slot);
+    }
+
+    OrderedMapEntry *e = om_entry_at(m, m->_n_entries);
+    e->_hash = hash;
+    e->_key_length = len;
+    e->_key_offset = om_store_key(m, k, len);
+    memcpy(om_value_from_entry(m, e), data, m->_stride);
+
+    om_index_set(m, insert_slot, m->_n_entries);
+    m->_n_entries++;
+    m->_length++;
+}
+
+void om_insert(OrderedMap *m, const char *k, void *data) {
+    size_t len = strlen(k);
+    om_insert_prehashed(m, k, len, m_hash(k, len), data);
+}
+
+void om_remove(OrderedMap *m, const char *k) {
+    size_t len = strlen(k);
+    size_t slot = om_find_slot(m, k, len, m_hash(k, len), NULL);
+    if (slot == m->_index_size) return;
+
+    OrderedMapEntry *e = om_entry_at(m, (size_t) om_index_get(m, slot));
+    if (m->_cleanup_fn != NULL)
+        m->_cleanup_fn(NULL, om_value_from_entry(m, e), NULL);
+
+    e->_key_offset = ORDERED_MAP_DELETED_ENTRY;
+    om_index_set(m, slot, om_index_deleted(m));
+    m->_length--;
+}
+
+// Visits bindings in insertion order.
+void om_map(OrderedMap *m, MapMappableFn f, void *aux) {
+    for (size_t e_idx = 0; e_idx < m->_n_entries; e_idx++) {
+        OrderedMapEntry *e = om_entry_at(m, e_idx);
+        if (om_entry_is_deleted(e)) continue;
+        f(om_key_from_entry(m, e), om_value_from_entry(m, e), aux);
+    }
+}
+
+void om_free(OrderedMap *m) {
+    for (size_t e_idx = 0; m->_cleanup_fn && e_idx < m->_n_entries; e_idx++) {
+        OrderedMapEntry *e = om_entry_at(m, e_idx);
+        if (!om_entry_is_deleted(e))
+            m->_cleanup_fn(NULL, om_value_from_entry(m, e), NULL);
+    }
+
+    a_free(m->_allocator, m->_index, m->_index_size * m->_index_width);
+    a_free(m->_allocator, m->_entries, m->_entry_capacity * m->_entry_stride);
+    if (m->_keys != NULL)
+        a_free(m->_allocator, m->_keys, m->_keys_capacity);
+    a_free(m->_allocator, m, sizeof(OrderedMap));
+}
+
+// MapMappableFn that inserts each binding it visits into the OrderedMap
+// passed as aux, e.g. m_map(frame, ordered_map_union, om).
+void ordered_map_union(char *k, void *d, void *aux) {
+    OrderedMap *to = (OrderedMap *) aux;
+    om_insert(to, k, d);
+}
+
+#endif
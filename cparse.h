@@ -10,6 +10,11 @@
 #include "cvector.h"
 #include "cmap.h"
 
+// most combinators refer to a handful of subparsers and produce a handful of
+// values per node, so their vectors start out inline
+#define PARSER_INLINE_LABELS 4
+#define PARSER_INLINE_EMITS 8
+
 typedef struct {
     size_t _start;
     size_t _end;
@@ -19,8 +24,21 @@ typedef struct {
 typedef struct {
     Map *_parser_map;
     bool _strict;
+
+    // binding trees are built and torn down within one parser_parse call,
+    // so they can live on an arena
+    const Allocator *_allocator;
 } ParserEnv;
 
+void *parser_binding_make(ParserEnv *pe) {
+    return nary_cell_make_with_allocator(sizeof(ParserBinding), pe->_allocator);
+}
+
+void parser_binding_free(ParserEnv *pe, void *binding_tree) {
+    nary_free_with_allocator(binding_tree, NULL, sizeof(ParserBinding),
+                             pe->_allocator);
+}
+
 struct ParserCombinator;
 
 typedef void *(*BindsFn)(ParserEnv *, Vector *, size_t, struct ParserCombinator *);
@@ -51,7 +69,7 @@ void *concat_combines(Vector *v) {
     return vv;
 }
 
-void *match_category_binds(__attribute__((unused)) ParserEnv *pe,
+void *match_category_binds(ParserEnv *pe,
                            Vector *tokens, size_t start, ParserCombinator *self) {
     Vector *aux = self->_aux;
     if (start == v_size(tokens)) return NULL;
@@ -60,7 +78,7 @@ void *match_category_binds(__attribute__((unused)) ParserEnv *pe,
     Token *token = (Token *) v_at(tokens, start);
     if (strcmp(category, token->_category->_category_label) == 0) {
         // matched
-        void *cell = nary_cell_make(sizeof(ParserBinding));
+        void *cell = parser_binding_make(pe);
         ParserBinding *binding = (ParserBinding *) nary_data(cell);
         binding->_start = start;
         binding->_end = start + 1;
@@ -69,7 +87,7 @@ void *match_category_binds(__attribute__((unused)) ParserEnv *pe,
     return NULL;
 }
 
-void *match_exact_symbol_binds(__attribute__((unused)) ParserEnv *pe,
+void *match_exact_symbol_binds(ParserEnv *pe,
                                Vector *tokens, size_t start, ParserCombinator *self) {
     Vector *aux = self->_aux;
     if (start == v_size(tokens)) return NULL;
@@ -79,7 +97,7 @@ void *match_exact_symbol_binds(__attribute__((unused)) ParserEnv *pe,
     if (strcmp("IDENTIFIER", token->_category->_category_label) == 0
         && strcmp(symbol, token->_value) == 0) {
         // matched
-        void *cell = nary_cell_make(sizeof(ParserBinding));
+        void *cell = parser_binding_make(pe);
         ParserBinding *binding = (ParserBinding *) nary_data(cell);
         binding->_start = start;
         binding->_end = start + 1;
@@ -98,7 +116,7 @@ void *match_category_emits(__attribute__((unused)) ParserEnv *pe,
 
 void *any_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator *self) {
     Vector *aux = self->_aux;
-    void *cell = nary_cell_make(sizeof(ParserBinding));
+    void *cell = parser_binding_make(pe);
     ParserBinding *binding = (ParserBinding *) nary_data(cell);
     binding->_start = start;
 
@@ -121,13 +139,13 @@ void *any_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator *s
         }
     }
 
-    nary_free(cell, NULL);
+    parser_binding_free(pe, cell);
     return NULL;
 }
 
 void *seq_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator *self) {
     Vector *aux = self->_aux;
-    void *cell = nary_cell_make(sizeof(ParserBinding));
+    void *cell = parser_binding_make(pe);
     ParserBinding *binding = (ParserBinding *) nary_data(cell);
     binding->_start = start;
     for (size_t parser_idx = 0; parser_idx < v_size(aux); parser_idx++) {
@@ -139,7 +157,7 @@ void *seq_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator *s
 
         // failed to run a parser, quit
         if (subcell == NULL) {
-            nary_free(cell, NULL);
+            parser_binding_free(pe, cell);
             return NULL;
         }
 
@@ -153,7 +171,7 @@ void *seq_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator *s
 
 void *many0_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator *self) {
     Vector *aux = self->_aux;
-    void *cell = nary_cell_make(sizeof(ParserBinding));
+    void *cell = parser_binding_make(pe);
     ParserBinding *binding = (ParserBinding *) nary_data(cell);
     binding->_start = start;
     char * parser_label = *((char **) v_at(aux, 0));
@@ -180,7 +198,7 @@ void *many0_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator
 
 void *many1_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator *self) {
     Vector *aux = self->_aux;
-    void *cell = nary_cell_make(sizeof(ParserBinding));
+    void *cell = parser_binding_make(pe);
     ParserBinding *binding = (ParserBinding *) nary_data(cell);
     binding->_start = start;
     char * parser_label = *((char **) v_at(aux, 0));
@@ -203,7 +221,7 @@ void *many1_binds(ParserEnv *pe, Vector *tokens, size_t start, ParserCombinator
     }
 
     if (found == 0) {
-        nary_free(cell, NULL);
+        parser_binding_free(pe, cell);
         return NULL;
     }
 
@@ -222,7 +240,7 @@ void *any_emits(ParserEnv *pe, Vector *tokens, void *binding_tree, ParserCombina
 
 void *seq_emits(ParserEnv *pe, Vector *tokens, void *binding_tree, ParserCombinator *self) {
     Vector *aux = self->_aux;
-    Vector *v = v_make(sizeof(void *));
+    Vector *v = v_make_inline(sizeof(void *), PARSER_INLINE_EMITS);
     void *data;
     void *subbinding_tree = *nary_child(binding_tree);
     for (size_t parser_idx = 0; parser_idx < v_size(aux); parser_idx++) {
@@ -244,7 +262,7 @@ void *many0_emits(ParserEnv *pe, Vector *tokens, void *binding_tree, ParserCombi
     void *subbinding_tree = *nary_child(binding_tree);
     void *data;
 
-    Vector *v = v_make(sizeof(void *));
+    Vector *v = v_make_inline(sizeof(void *), PARSER_INLINE_EMITS);
 
     char * parser_label = *((char **) v_at(aux, 0));
     ParserCombinator *parser =
@@ -265,7 +283,7 @@ ParserCombinator *seq_parser(const char *label, CombinerFn combines, ...) {
     ParserCombinator *p = (ParserCombinator *) malloc(sizeof(ParserCombinator));
     p->_parser_label = strdup(label);
 
-    p->_aux = v_make(sizeof(char *));
+    p->_aux = v_make_inline(sizeof(char *), PARSER_INLINE_LABELS);
     p->_aux->_cleanup_fn = vector_generic_free;
 
     va_list arg_list;
@@ -292,7 +310,7 @@ ParserCombinator *many0_parser(const char *label, CombinerFn combines, const cha
 
     char *subparser_dup = strdup(subparser);
 
-    p->_aux = v_make(sizeof(char *));
+    p->_aux = v_make_inline(sizeof(char *), PARSER_INLINE_LABELS);
     p->_aux->_cleanup_fn = vector_generic_free;
 
 
@@ -311,7 +329,7 @@ ParserCombinator *many1_parser(const char *label, CombinerFn combines, const cha
 
     char *subparser_dup = strdup(subparser);
 
-    p->_aux = v_make(sizeof(char *));
+    p->_aux = v_make_inline(sizeof(char *), PARSER_INLINE_LABELS);
     p->_aux->_cleanup_fn = vector_generic_free;
 
 
@@ -328,7 +346,7 @@ ParserCombinator *any_parser(const char *label, ...) {
     ParserCombinator *p = (ParserCombinator *) malloc(sizeof(ParserCombinator));
     p->_parser_label = strdup(label);
 
-    p->_aux = v_make(sizeof(char *));
+    p->_aux = v_make_inline(sizeof(char *), PARSER_INLINE_LABELS);
     p->_aux->_cleanup_fn = vector_generic_free;
 
     va_list arg_list;
@@ -355,7 +373,7 @@ ParserCombinator *atomic_parser(const char *label, const char *category,
     p->_parser_label = strdup(label);
     char *category_dup = strdup(category);
 
-    p->_aux = v_make(sizeof(char *));
+    p->_aux = v_make_inline(sizeof(char *), PARSER_INLINE_LABELS);
     p->_aux->_cleanup_fn = vector_generic_free;
 
     v_push_back(p->_aux, &category_dup);
@@ -372,7 +390,7 @@ ParserCombinator *symbol_parser(const char *label, const char *symbol,
     p->_parser_label = strdup(label);
     char *symbol_dup = strdup(symbol);
 
-    p->_aux = v_make(sizeof(char *));
+    p->_aux = v_make_inline(sizeof(char *), PARSER_INLINE_LABELS);
     p->_aux->_cleanup_fn = vector_generic_free;
 
     v_push_back(p->_aux, &symbol_dup);
@@ -399,6 +417,7 @@ ParserEnv *parser_env_make() {
     ParserEnv *pe = (ParserEnv *) malloc(sizeof(ParserEnv));
     assert(pe != NULL);
     pe->_strict = true;
+    pe->_allocator = NULL;
     pe->_parser_map = m_make(sizeof(ParserCombinator *));
     pe->_parser_map->_cleanup_fn = parser_cleanup_fn;
     return pe;
@@ -431,12 +450,12 @@ void *parser_parse(ParserEnv *pe, const char* parser_label, Vector *tokens) {
         // consume all tokens!
         ParserBinding *binding = (ParserBinding *) nary_data(binding_tree);
         if (binding->_end != v_size(tokens)) {
-            nary_free(binding_tree, NULL);
+            parser_binding_free(pe, binding_tree);
             return NULL;
         }
     }
     void *emitted = parser->_emit(pe, tokens, binding_tree, parser);
-    nary_free(binding_tree, NULL);
+    parser_binding_free(pe, binding_tree);
     return emitted;
 }
 
@@ -13,8 +13,11 @@
 #include "cparse.h"
 #include "cbignum.h"
 #include "clex.h"
+#include "chamt.h"
+#include "cmph.h"
 
 #define MAXIMUM_STACK_DEPTH 100
+#define SCHEME_INLINE_ARGS 4
 
 typedef enum {
     SCHEME_READY,
@@ -73,7 +76,7 @@ typedef struct SchemeObject {
         } _primitive_procedure;
         struct {
             struct SchemeObject *_body;
-            Vector *_env;
+            Hamt *_env;
             Vector *_req_args;
             Vector *_opt_args;
             struct SchemeObject *_rest;
@@ -83,6 +86,8 @@ typedef struct SchemeObject {
     } _data;
 } SchemeObject;
 
+DEFINE_TYPED_VECTOR(SchemeObjectVector, sov, SchemeObject *)
+
 void scheme_fails(struct SchemeEnv *se, const char *msg);
 
 void arity_check(SchemeObject *f, SchemeObject *args);
@@ -360,7 +365,7 @@ typedef struct SchemeEnv {
     LexerEnv *_lexer;
     ParserEnv *_parser;
     Map *_symbol_table;
-    Map *_special_form_table;
+    PerfectHash *_special_form_table;
     Vector *_lexical_environment_stack;
     size_t _n_lambdas;
 } SchemeEnv;
@@ -409,9 +414,8 @@ SchemeObject *scheme_generic_combines_internal(void **data, size_t non_null_elem
 void *scheme_generic_combines(Vector *v) {
     size_t n_elems = v_size(v);
     if (n_elems == 0) return NULL;
-    size_t non_null_elems = 0;
-    for (size_t idx = 0; idx < n_elems; idx++)
-        if (*(void **) v_at(v, idx) != NULL) non_null_elems++;
+    void *null_elem = NULL;
+    size_t non_null_elems = n_elems - v_count_eq(v, &null_elem);
     void *o = scheme_generic_combines_internal((void **)v->_data, non_null_elems);
     v_free(v);
     return o;
@@ -460,9 +464,8 @@ SchemeObject *scheme_generic_combines_with_tail_internal(void **data,
 SchemeObject *scheme_generic_combines_with_tail(Vector *v, SchemeObject *tail) {
     size_t n_elems = v_size(v);
     if (n_elems == 0) return NULL;
-    size_t non_null_elems = 0;
-    for (size_t idx = 0; idx < n_elems; idx++)
-        if (*(void **) v_at(v, idx) != NULL) non_null_elems++;
+    void *null_elem = NULL;
+    size_t non_null_elems = n_elems - v_count_eq(v, &null_elem);
     void *o = scheme_generic_combines_with_tail_internal((void **)v->_data, non_null_elems, tail);
     v_free(v);
     return o;
@@ -509,9 +512,8 @@ void *scheme_cond_else_combines(Vector *v) {
 void *scheme_last_vec_combines(Vector *v) {
     size_t n_elems = v_size(v);
     if (n_elems == 0) return NULL;
-    size_t non_null_elems = 0;
-    for (size_t idx = 0; idx < n_elems; idx++)
-        if (*(void **) v_at(v, idx) != NULL) non_null_elems++;
+    void *null_elem = NULL;
+    size_t non_null_elems = n_elems - v_count_eq(v, &null_elem);
     void *o = scheme_last_vec_combines_internal((void **)v->_data, non_null_elems);
     v_free(v);
     return o;
@@ -719,7 +721,7 @@ void add_primitives_to_symbol_table(Map *symbol_table);
 
 bool scheme_is_special_form_symbol(SchemeEnv *se, SchemeObject *obj) {
     if (obj->_type != SCHEME_SYMBOL) return false;
-    return m_get(se->_special_form_table, obj->_data._symbol._value) != NULL;
+    return ph_get(se->_special_form_table, obj->_data._symbol._value) != NULL;
 }
 
 SchemeObject *scheme_eval(SchemeEnv *se, SchemeObject *form);
@@ -826,12 +828,16 @@ char *scheme_generate_lambda_name(SchemeEnv *se) {
 void scheme_lambda_compile_parameters(SchemeEnv *se,
                                       SchemeObject *proc,
                                       SchemeObject *args) {
-    proc->_data._compound_procedure._req_args = v_make(sizeof(SchemeObject *));
-    proc->_data._compound_procedure._opt_args = v_make(sizeof(SchemeObject *));
-    Vector *req_args = proc->_data._compound_procedure._req_args;
-    Vector *opt_args = proc->_data._compound_procedure._opt_args;
+    proc->_data._compound_procedure._req_args =
+        v_make_inline(sizeof(SchemeObject *), SCHEME_INLINE_ARGS);
+    proc->_data._compound_procedure._opt_args =
+        v_make_inline(sizeof(SchemeObject *), SCHEME_INLINE_ARGS);
+    SchemeObjectVector *req_args =
+        sov_from_vector(proc->_data._compound_procedure._req_args);
+    SchemeObjectVector *opt_args =
+        sov_from_vector(proc->_data._compound_procedure._opt_args);
     proc->_data._compound_procedure._rest = NULL;
-    Vector *appending = req_args;
+    SchemeObjectVector *appending = req_args;
     bool in_optionals = false;
     while (args->_type != SCHEME_EMPTY_LIST) {
         SchemeObject *ec = car(args);
@@ -850,39 +856,30 @@ void scheme_lambda_compile_parameters(SchemeEnv *se,
             proc->_data._compound_procedure._rest = car(args);
             return;
         } else {
-            v_push_back(appending, &ec);
+            sov_push_back(appending, ec);
         }
         args = cdr(args);
     }
 }
 
-void compile_closing_env(char *k, void *d, void *aux) {
-    Vector *to = (Vector *) aux;
-    SchemeObject *record = (SchemeObject *) malloc(sizeof(SchemeObject));
-    record->_type = SCHEME_PAIR;
-    SchemeObject *symbol = (SchemeObject *) malloc(sizeof(SchemeObject));
-    symbol->_type = SCHEME_SYMBOL;
-    symbol->_data._symbol._value = strdup(k);
-    set_car(record, symbol);
-    set_cdr(record, *((SchemeObject **) d));
-    v_push_back(to, &record);
+// Every lexical frame is a persistent map of everything lexically visible
+// at that depth, so closing over the current environment shares the top
+// frame instead of copying its bindings.
+Hamt *scheme_current_lexical_environment(SchemeEnv *se) {
+    size_t depth = v_size(se->_lexical_environment_stack);
+    if (depth == 0) return hm_make(sizeof(SchemeObject *));
+    return hm_retain(*(Hamt **) v_at(se->_lexical_environment_stack, depth - 1));
 }
 
-Vector *scheme_build_closing_environment(SchemeEnv *se) {
-    Vector *compiled_closing_env = v_make(sizeof(SchemeObject *));
-    Map *uncompiled_closing_env = m_make(sizeof(SchemeObject *));
-
-    // generate unique most specific closing environment
-    for (size_t idx = 0; idx < v_size(se->_lexical_environment_stack); idx++) {
-        Map *lenv = *(Map **) v_at(se->_lexical_environment_stack, idx);
-        m_map(lenv, map_union, uncompiled_closing_env);
-    }
-
-    // compile to vector
-    m_map(uncompiled_closing_env, compile_closing_env, compiled_closing_env);
+Hamt *scheme_build_closing_environment(SchemeEnv *se) {
+    return scheme_current_lexical_environment(se);
+}
 
-    m_free(uncompiled_closing_env);
-    return compiled_closing_env;
+// Binds k in the frame being built, replacing *lenv with the new version.
+void scheme_bind(Hamt **lenv, const char *k, void *data) {
+    Hamt *bound = hm_insert(*lenv, k, data);
+    hm_release(*lenv);
+    *lenv = bound;
 }
 
 SchemeObject *scheme_lambda_special_form(SchemeEnv *se,
@@ -907,14 +904,16 @@ SchemeObject *scheme_lambda_special_form(SchemeEnv *se,
     return new_proc;
 }
 
-void scheme_push_lexical_environment(SchemeEnv *se, Map *lenv) {
+// The stack takes over the reference to lenv.
+void scheme_push_lexical_environment(SchemeEnv *se, Hamt *lenv) {
     v_push_back(se->_lexical_environment_stack, &lenv);
 }
 
 void scheme_pop_lexical_environment(SchemeEnv *se) {
     assert(v_size(se->_lexical_environment_stack) >= 1);
-    v_remove(se->_lexical_environment_stack,
-             v_size(se->_lexical_environment_stack) - 1);
+    size_t top = v_size(se->_lexical_environment_stack) - 1;
+    hm_release(*(Hamt **) v_at(se->_lexical_environment_stack, top));
+    v_remove(se->_lexical_environment_stack, top);
 }
 
 SchemeObject *scheme_let_special_form(SchemeEnv *se,
@@ -926,21 +925,23 @@ SchemeObject *scheme_let_special_form(SchemeEnv *se,
     }
 
     SchemeObject *inits = car(args);
-    Map *lenv = m_make(sizeof(SchemeObject *));
+    Hamt *lenv = scheme_current_lexical_environment(se);
 
     while (inits->_type != SCHEME_EMPTY_LIST) {
         if (inits->_type != SCHEME_PAIR && inits->_type != SCHEME_EMPTY_LIST) {
             scheme_fails(se, "That's no list...");
+            hm_release(lenv);
             return NULL;
         }
         SchemeObject *pair = car(inits);
         if (pair->_type != SCHEME_PAIR || cdr(pair)->_type != SCHEME_PAIR) {
             scheme_fails(se, "Invalid binding expression in let.");
+            hm_release(lenv);
             return NULL;
         }
         inits = cdr(inits);
         SchemeObject *reffed = scheme_eval(se, car(cdr(pair)));
-        m_insert(lenv, car(pair)->_data._symbol._value, &reffed);
+        scheme_bind(&lenv, car(pair)->_data._symbol._value, &reffed);
     }
 
     scheme_push_lexical_environment(se, lenv);
@@ -951,7 +952,6 @@ SchemeObject *scheme_let_special_form(SchemeEnv *se,
         exps = cdr(exps);
     }
     scheme_pop_lexical_environment(se);
-    m_free(lenv);
     return evaled;
 }
 
@@ -987,36 +987,27 @@ SchemeObject *scheme_define_special_form(SchemeEnv *se,
     return NULL;
 }
 
-void initialize_special_form_table(Map *special_form_table) {
-    SchemeProcedure procedure = scheme_if_special_form;
-    m_insert(special_form_table, "if", &procedure);
-
-    procedure = scheme_or_special_form;
-    m_insert(special_form_table, "or", &procedure);
-
-    procedure = scheme_and_special_form;
-    m_insert(special_form_table, "and", &procedure);
-
-    procedure = scheme_cond_special_form;
-    m_insert(special_form_table, "cond", &procedure);
-
-    procedure = scheme_define_special_form;
-    m_insert(special_form_table, "define", &procedure);
-
-    procedure = scheme_lambda_special_form;
-    m_insert(special_form_table, "lambda", &procedure);
-
-    procedure = scheme_let_special_form;
-    m_insert(special_form_table, "let", &procedure);
-
-    procedure = NULL;
-    m_insert(special_form_table, "begin", &procedure);
-
-    procedure = scheme_quote_special_form;
-    m_insert(special_form_table, "quote", &procedure);
-
-    procedure = NULL;
-    m_insert(special_form_table, "quasiquote", &procedure);
+// The special forms never change, so they get a perfect hash table: every
+// application of a symbol probes it exactly once.
+PerfectHash *make_special_form_table(void) {
+    const char *names[] = {
+        "if", "or", "and", "cond", "define", "lambda", "let",
+        "begin", "quote", "quasiquote",
+    };
+    SchemeProcedure procedures[] = {
+        scheme_if_special_form,
+        scheme_or_special_form,
+        scheme_and_special_form,
+        scheme_cond_special_form,
+        scheme_define_special_form,
+        scheme_lambda_special_form,
+        scheme_let_special_form,
+        NULL,
+        scheme_quote_special_form,
+        NULL,
+    };
+    return ph_make(sizeof(SchemeProcedure), names, procedures,
+                   sizeof(names) / sizeof(names[0]));
 }
 
 void scheme_env_free(SchemeEnv *se);
@@ -1027,12 +1018,13 @@ SchemeEnv *scheme_env_make(const char *stdlib_location) {
 
     se->_n_lambdas = 0;
 
-    se->_lexical_environment_stack = v_make(sizeof(Map *));
+    se->_lexical_environment_stack = v_make(sizeof(Hamt *));
 
     se->_symbol_table = m_make(sizeof(SchemeObject *));
+    m_set_incremental_resize(se->_symbol_table, true);
     add_primitives_to_symbol_table(se->_symbol_table);
-    se->_special_form_table = m_make(sizeof(SchemeObject *));
-    initialize_special_form_table(se->_special_form_table);
+    se->_special_form_table = make_special_form_table();
+    assert(se->_special_form_table != NULL);
 
     se->_lexer = lexer_make();
     lexer_add_category(se->_lexer, "IDENTIFIER");
@@ -1593,7 +1585,9 @@ void scheme_env_free(SchemeEnv *se) {
     lexer_free(se->_lexer);
     parser_env_free(se->_parser);
     m_free(se->_symbol_table);
-    m_free(se->_special_form_table);
+    ph_free(se->_special_form_table);
+    while (v_size(se->_lexical_environment_stack) > 0)
+        scheme_pop_lexical_environment(se);
     v_free(se->_lexical_environment_stack);
     free(se);
 }
@@ -1626,22 +1620,35 @@ SchemeObject *scheme_map(SchemeEnv *se, SchemeObject *list, SchemeTransforms f)
     return new_list;
 }
 
-SchemeObject *scheme_lexical_lookup(SchemeEnv *se,
-                                    SchemeObject *symbol) {
+// The symbol is hashed once and the hash reused for every frame.
+SchemeObject *scheme_lexical_lookup_hashed(SchemeEnv *se, const char *name,
+                                           size_t len, uint64_t hash) {
     for (size_t idx = v_size(se->_lexical_environment_stack); idx --> 0;) {
-        Map *lenv = *(Map **) v_at(se->_lexical_environment_stack, idx);
-        SchemeObject **p_resolution = (SchemeObject **) m_get(lenv, symbol->_data._symbol._value);
+        Hamt *lenv = *(Hamt **) v_at(se->_lexical_environment_stack, idx);
+        SchemeObject **p_resolution = (SchemeObject **)
+            hm_get_prehashed(lenv, name, len, hash);
         if (p_resolution) return *p_resolution;
     }
     return NULL;
 }
 
+SchemeObject *scheme_lexical_lookup(SchemeEnv *se,
+                                    SchemeObject *symbol) {
+    const char *name = symbol->_data._symbol._value;
+    size_t len = strlen(name);
+    return scheme_lexical_lookup_hashed(se, name, len, m_hash(name, len));
+}
+
 SchemeObject *scheme_symbol_lookup(SchemeEnv *se,
                                    SchemeObject *symbol) {
-    SchemeObject *lexical_resolution = scheme_lexical_lookup(se, symbol);
+    const char *name = symbol->_data._symbol._value;
+    size_t len = strlen(name);
+    uint64_t hash = m_hash(name, len);
+
+    SchemeObject *lexical_resolution = scheme_lexical_lookup_hashed(se, name, len, hash);
     if (lexical_resolution) return lexical_resolution;
     SchemeObject **p_resolution = (SchemeObject **)
-        m_get(se->_symbol_table, symbol->_data._symbol._value);
+        m_get_prehashed(se->_symbol_table, name, len, hash);
     return p_resolution ? *p_resolution : NULL;
 }
 
@@ -1651,55 +1658,50 @@ SchemeObject *scheme_apply_primitive(SchemeEnv *se,
     return f->_data._primitive_procedure._fn(se, rest);
 }
 
-void scheme_add_to_lexical_environment(Map *lenv, SchemeObject *pattern,
+void scheme_add_to_lexical_environment(Hamt **lenv, SchemeObject *pattern,
                                        SchemeObject **p_unbound_args) {
     if (pattern->_type == SCHEME_SYMBOL) {
         SchemeObject *to_be_bound = car(*p_unbound_args);
-        m_insert(lenv, pattern->_data._symbol._value, &to_be_bound);
+        scheme_bind(lenv, pattern->_data._symbol._value, &to_be_bound);
         *p_unbound_args = cdr(*p_unbound_args);
     } else {
         assert(pattern->_type == SCHEME_PAIR);
         if ((*p_unbound_args)->_type == SCHEME_EMPTY_LIST) {
-            m_insert(lenv, car(pattern)->_data._symbol._value, cadr(pattern));
+            scheme_bind(lenv, car(pattern)->_data._symbol._value, cadr(pattern));
             // do not attempt to modify p_unbound_args
         } else {
             SchemeObject *to_be_bound = car(*p_unbound_args);
-            m_insert(lenv, car(pattern)->_data._symbol._value, &to_be_bound);
+            scheme_bind(lenv, car(pattern)->_data._symbol._value, &to_be_bound);
             *p_unbound_args = cdr(*p_unbound_args);
         }
     }
 }
 
-void scheme_add_closing_env(void *d, void *aux) {
-    Map *to = (Map *) aux;
-    SchemeObject *record = *((SchemeObject **) d);
-    SchemeObject *reffed = cdr(record);
-    m_insert(to, car(record)->_data._symbol._value, &reffed);
-}
-
-Map *scheme_build_lambda_lexical_environment(SchemeObject *proc,
+Hamt *scheme_build_lambda_lexical_environment(SchemeObject *proc,
                                              SchemeObject *unbound_args) {
     size_t n_unbound_args = scheme_length(unbound_args);
-    Vector *req_args = proc->_data._compound_procedure._req_args;
-    Vector *opt_args = proc->_data._compound_procedure._opt_args;
-    if (n_unbound_args < v_size(req_args)) {
+    SchemeObjectVector *req_args =
+        sov_from_vector(proc->_data._compound_procedure._req_args);
+    SchemeObjectVector *opt_args =
+        sov_from_vector(proc->_data._compound_procedure._opt_args);
+    if (n_unbound_args < sov_size(req_args)) {
         printf("Insufficient required aruguments to ");
         scheme_object_fprint(stdout, proc);
         printf("At least %zu required, %zu found.\n",
-               v_size(req_args), n_unbound_args);
+               sov_size(req_args), n_unbound_args);
         assert(0);
     }
 
-    Map *lenv = m_make(sizeof(SchemeObject *));
-    v_map(proc->_data._compound_procedure._env, scheme_add_closing_env, lenv);
+    // arguments are bound on top of the captured environment, sharing it
+    Hamt *lenv = hm_retain(proc->_data._compound_procedure._env);
 
-    for (size_t v_idx = 0; v_idx < v_size(req_args); v_idx++) {
-        scheme_add_to_lexical_environment(lenv, *(SchemeObject **)
-                                          v_at(req_args, v_idx), &unbound_args);
+    for (size_t v_idx = 0; v_idx < sov_size(req_args); v_idx++) {
+        scheme_add_to_lexical_environment(&lenv, sov_get(req_args, v_idx),
+                                          &unbound_args);
     }
-    for (size_t v_idx = 0; v_idx < v_size(opt_args); v_idx++) {
-        scheme_add_to_lexical_environment(lenv, *(SchemeObject **)
-                                          v_at(opt_args, v_idx), &unbound_args);
+    for (size_t v_idx = 0; v_idx < sov_size(opt_args); v_idx++) {
+        scheme_add_to_lexical_environment(&lenv, sov_get(opt_args, v_idx),
+                                          &unbound_args);
     }
     if (unbound_args->_type != SCHEME_EMPTY_LIST) {
         if (proc->_data._compound_procedure._rest == NULL) {
@@ -1709,7 +1711,7 @@ Map *scheme_build_lambda_lexical_environment(SchemeObject *proc,
             assert(0);
         }
         SchemeObject *rest_obj = proc->_data._compound_procedure._rest;
-        m_insert(lenv, rest_obj->_data._symbol._value, &unbound_args);
+        scheme_bind(&lenv, rest_obj->_data._symbol._value, &unbound_args);
     }
     return lenv;
 }
@@ -1717,7 +1719,7 @@ Map *scheme_build_lambda_lexical_environment(SchemeObject *proc,
 SchemeObject *scheme_apply_compound(SchemeEnv *se,
                                     SchemeObject *f,
                                     SchemeObject *rest) {
-    Map *lenv = scheme_build_lambda_lexical_environment(f, rest);
+    Hamt *lenv = scheme_build_lambda_lexical_environment(f, rest);
     scheme_push_lexical_environment(se, lenv);
     SchemeObject *body = f->_data._compound_procedure._body;
     SchemeObject *evaled = NULL;
@@ -1726,7 +1728,6 @@ SchemeObject *scheme_apply_compound(SchemeEnv *se,
         body = cdr(body);
     }
     scheme_pop_lexical_environment(se);
-    m_free(lenv);
     return evaled;
 }
 
@@ -1748,7 +1749,7 @@ SchemeObject *scheme_eval_special_form(__attribute__((unused)) SchemeEnv *se,
                                        __attribute__((unused)) SchemeObject *special_form_symbol,
                                        __attribute__((unused)) SchemeObject *rest) {
     SchemeProcedure proc = *(SchemeProcedure *)
-        m_get(se->_special_form_table, special_form_symbol->_data._symbol._value);
+        ph_get(se->_special_form_table, special_form_symbol->_data._symbol._value);
 
     if (proc == NULL) {
         printf("Don't know how to eval the special form %s.\n",
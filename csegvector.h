@@ -0,0 +1,123 @@
+#ifndef CSEGVECTOR_H
+#define CSEGVECTOR_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdbool.h>
+
+#include "cvector.h"
+
+// A SegmentedVector stores its elements in segments that double in size:
+// segment k holds (SEGMENTED_VECTOR_BASE << k) elements. Growing allocates
+// one more segment and never moves existing elements, so pointers returned
+// by sv_at and sv_push_back stay valid for the life of the vector. Indexing
+// is O(1): the segment is found from the position of the highest set bit.
+#define SEGMENTED_VECTOR_BASE_SHIFT 4
+#define SEGMENTED_VECTOR_BASE (((size_t) 1) << SEGMENTED_VECTOR_BASE_SHIFT)
+#define SEGMENTED_VECTOR_MAX_SEGMENTS 48
+
+typedef struct {
+    void *_segments[SEGMENTED_VECTOR_MAX_SEGMENTS];
+    size_t _n_segments;
+    size_t _length;
+    size_t _stride;
+
+    VectorMappableFn _cleanup_fn;
+} SegmentedVector;
+
+void sv_init(SegmentedVector *v, size_t stride) {
+    assert(stride > 0);
+
+    v->_stride = stride;
+    v->_length = 0;
+    v->_n_segments = 0;
+    v->_cleanup_fn = NULL;
+}
+
+SegmentedVector *sv_make(size_t stride) {
+    SegmentedVector *v = (SegmentedVector *) malloc(sizeof(SegmentedVector));
+    assert(v != NULL);
+    sv_init(v, stride);
+    return v;
+}
+
+size_t sv_size(const SegmentedVector *v) {
+    return v->_length;
+}
+
+size_t sv_segment_capacity(size_t segment) {
+    return SEGMENTED_VECTOR_BASE << segment;
+}
+
+// Elements before segment k number BASE * (2^k - 1), so for index i the
+// segment is floor(log2(i / BASE + 1)).
+void *sv_at_unsafe(const SegmentedVector *v, size_t idx) {
+    size_t biased = (idx >> SEGMENTED_VECTOR_BASE_SHIFT) + 1;
+    size_t segment = (sizeof(unsigned long long) * 8 - 1)
+        - (size_t) __builtin_clzll((unsigned long long) biased);
+    size_t offset = idx - (((((size_t) 1) << segment) - 1)
+                           << SEGMENTED_VECTOR_BASE_SHIFT);
+    return (void *) (((char *) v->_segments[segment]) + offset * v->_stride);
+}
+
+void *sv_at(const SegmentedVector *v, size_t idx) {
+    assert(idx < sv_size(v));
+    return sv_at_unsafe(v, idx);
+}
+
+size_t sv_capacity(const SegmentedVector *v) {
+    return ((((size_t) 1) << v->_n_segments) - 1) << SEGMENTED_VECTOR_BASE_SHIFT;
+}
+
+// Copies data into the next slot and returns its stable address.
+void *sv_push_back(SegmentedVector *v, const void *data) {
+    if (v->_length == sv_capacity(v)) {
+        assert(v->_n_segments < SEGMENTED_VECTOR_MAX_SEGMENTS);
+        void *segment = malloc(sv_segment_capacity(v->_n_segments) * v->_stride);
+        assert(segment != NULL);
+        v->_segments[v->_n_segments++] = segment;
+    }
+
+    void *dest = sv_at_unsafe(v, v->_length);
+    memcpy(dest, data, v->_stride);
+    v->_length++;
+    return dest;
+}
+
+void *sv_find(SegmentedVector *v, VectorPredicateFn pred, const void *aux) {
+    size_t idx = 0;
+    for (size_t segment = 0; segment < v->_n_segments && idx < v->_length; segment++) {
+        char *current = (char *) v->_segments[segment];
+        size_t n = sv_segment_capacity(segment);
+        for (size_t s_idx = 0; s_idx < n && idx < v->_length; s_idx++, idx++) {
+            if (pred((void *) current, aux))
+                return current;
+            current += v->_stride;
+        }
+    }
+    return NULL;
+}
+
+void sv_map(SegmentedVector *v, VectorMappableFn f, void *aux) {
+    size_t idx = 0;
+    for (size_t segment = 0; segment < v->_n_segments && idx < v->_length; segment++) {
+        char *current = (char *) v->_segments[segment];
+        size_t n = sv_segment_capacity(segment);
+        for (size_t s_idx = 0; s_idx < n && idx < v->_length; s_idx++, idx++) {
+            f((void *) current, aux);
+            current += v->_stride;
+        }
+    }
+}
+
+void sv_free(SegmentedVector *v) {
+    if (v->_cleanup_fn)
+        sv_map(v, v->_cleanup_fn, NULL);
+    for (size_t segment = 0; segment < v->_n_segments; segment++)
+        free(v->_segments[segment]);
+    free(v);
+}
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef CSPLAYTREE_H
+#define CSPLAYTREE_H
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// A SplayTree keeps its values (stride bytes each) sorted by a comparator:
+// every find, insert and remove splays the node it reaches to the root,
+// top-down on the way from the root, so every operation takes amortized
+// O(log n) time and recently used values stay near the top.
+//
+// Only runs of sorted or repeated accesses are faster for it than for
+// BTree in cbtree.h (bench/splay.c): each one is a step or two from the
+// last. Random and even Zipfian lookups walk a pointer per level, and
+// rewriting the path on every find costs more than the skew saves, so
+// BTree is the better general purpose ordered container.
+//
+// Values that compare equal are all kept; a new one goes after the ones
+// already in the tree.
+typedef struct SplayTreeNodeStruct {
+    struct SplayTreeNodeStruct *_p_tree;
+
+    struct SplayTreeNodeStruct *_l_tree;
+    struct SplayTreeNodeStruct *_r_tree;
+
+    // points just past the node, where the value is stored
+    void *_data;
+} SplayTreeNode;
+
+// shared with cbtree.h
+#ifndef TREE_FN_TYPES
+#define TREE_FN_TYPES
+typedef void (*TreeMappableFn)(void *, void*);
+// Called as comp(a, b) with pointers to two values; returns a negative
+// number, zero or a positive number as a sorts before, with or after b.
+typedef int (*TreeComparatorFn)(void *, void*);
+#endif
+
+typedef struct {
+    size_t _stride;
+    size_t _length;
+
+    TreeMappableFn _cleanup_fn;
+    TreeComparatorFn _comp;
+
+    // NULL while the tree is empty
+    SplayTreeNode *_tree;
+} SplayTree;
+
+SplayTree *st_make(size_t stride, TreeComparatorFn comp) {
+    assert(stride);
+    assert(comp != NULL);
+
+    SplayTree *t = (SplayTree *) malloc(sizeof(SplayTree));
+    assert(t != NULL);
+    t->_stride = stride;
+    t->_length = 0;
+
+    t->_tree = NULL;
+    t->_cleanup_fn = NULL;
+    t->_comp = comp;
+
+    return t;
+}
+
+size_t st_size(SplayTree *t) {
+    return t->_length;
+}
+
+void st_write_value(SplayTree *t, SplayTreeNode *n, void *data) {
+    memcpy(n->_data, data, t->_stride);
+}
+
+SplayTreeNode *st_make_node(SplayTree *t, SplayTreeNode *parent, void *data) {
+    SplayTreeNode *n = (SplayTreeNode *) malloc(sizeof(SplayTreeNode) + t->_stride);
+    assert(n != NULL);
+
+    n->_p_tree = parent;
+    n->_l_tree = NULL;
+    n->_r_tree = NULL;
+    n->_data = n + 1;
+    st_write_value(t, n, data);
+    return n;
+}
+
+// Compares data with n's value; with equal_goes_right, an equal value
+// counts as greater, so a search passes over all the equal values.
+int st_splay_comp(SplayTree *t, void *data, SplayTreeNode *n, bool equal_goes_right) {
+    int c = t->_comp(data, n->_data);
+    return c == 0 && equal_goes_right ? 1 : c;
+}
+
+// Top-down splay: searches for data from the root and makes the node the
+// search ends on the new root, in one pass. Nodes the path leaves on its
+// right are linked, in order, into a tree of larger values and those on
+// its left into a tree of smaller ones; two steps in the same direction
+// rotate first, which is what halves the depth of the path. At the end
+// the two side trees become the root's subtrees. Parent pointers are kept
+// up for the in-order walks. The tree must not be empty.
+//
+// The search stops at a node that compares equal unless equal_goes_right,
+// in which case it ends next to the place a new equal value goes, after
+// the others. Returns the comparison of data with the new root.
+int st_splay(SplayTree *t, void *data, bool equal_goes_right) {
+    // header._r_tree collects the smaller values, header._l_tree the larger
+    SplayTreeNode header = {NULL, NULL, NULL, NULL};
+    SplayTreeNode *l = &header;
+    SplayTreeNode *r = &header;
+    SplayTreeNode *n = t->_tree;
+    int c = st_splay_comp(t, data, n, equal_goes_right);
+
+    while (c != 0) {
+        if (c < 0) {
+            SplayTreeNode *y = n->_l_tree;
+            if (y == NULL) break;
+            int c_y = st_splay_comp(t, data, y, equal_goes_right);
+            if (c_y < 0) {
+                // zig-zig: rotate right, then carry on from y
+                n->_l_tree = y->_r_tree;
+                if (n->_l_tree) n->_l_tree->_p_tree = n;
+                y->_r_tree = n;
+                n->_p_tree = y;
+                n = y;
+                c = c_y;
+                y = n->_l_tree;
+                if (y == NULL) break;
+                c_y = st_splay_comp(t, data, y, equal_goes_right);
+            }
+            // n and its right subtree are all larger than data
+            r->_l_tree = n;
+            n->_p_tree = r;
+            r = n;
+            n = y;
+            c = c_y;
+        } else {
+            SplayTreeNode *y = n->_r_tree;
+            if (y == NULL) break;
+            int c_y = st_splay_comp(t, data, y, equal_goes_right);
+            if (c_y > 0) {
+                // zag-zag: rotate left
+                n->_r_tree = y->_l_tree;
+                if (n->_r_tree) n->_r_tree->_p_tree = n;
+                y->_l_tree = n;
+                n->_p_tree = y;
+                n = y;
+                c = c_y;
+                y = n->_r_tree;
+                if (y == NULL) break;
+                c_y = st_splay_comp(t, data, y, equal_goes_right);
+            }
+            l->_r_tree = n;
+            n->_p_tree = l;
+            l = n;
+            n = y;
+            c = c_y;
+        }
+    }
+
+    l->_r_tree = n->_l_tree;
+    if (l->_r_tree) l->_r_tree->_p_tree = l;
+    r->_l_tree = n->_r_tree;
+    if (r->_l_tree) r->_l_tree->_p_tree = r;
+    n->_l_tree = header._r_tree;
+    if (n->_l_tree) n->_l_tree->_p_tree = n;
+    n->_r_tree = header._l_tree;
+    if (n->_r_tree) n->_r_tree->_p_tree = n;
+    n->_p_tree = NULL;
+    t->_tree = n;
+    return c;
+}
+
+SplayTreeNode *st_first_node(SplayTreeNode *s) {
+    if (s == NULL) return NULL;
+    while (s->_l_tree) s = s->_l_tree;
+    return s;
+}
+
+SplayTreeNode *st_last_node(SplayTreeNode *s) {
+    if (s == NULL) return NULL;
+    while (s->_r_tree) s = s->_r_tree;
+    return s;
+}
+
+// The in-order successor of s, or NULL after the last node.
+SplayTreeNode *st_next_node(SplayTreeNode *s) {
+    if (s->_r_tree) return st_first_node(s->_r_tree);
+    while (s->_p_tree && s->_p_tree->_r_tree == s) s = s->_p_tree;
+    return s->_p_tree;
+}
+
+// Visits every value in order. Walks the parent pointers rather than
+// recursing, since a splay tree can be as deep as it is long.
+void st_map(SplayTree *t, TreeMappableFn f, void *aux) {
+    for (SplayTreeNode *s = st_first_node(t->_tree); s != NULL; s = st_next_node(s))
+        f(s->_data, aux);
+}
+
+void st_free_node(SplayTreeNode *s, TreeMappableFn cleanup) {
+    // post-order without recursion: descend to a leaf, free it, and carry
+    // on from its parent
+    while (s != NULL) {
+        if (s->_l_tree) {
+            s = s->_l_tree;
+            continue;
+        }
+        if (s->_r_tree) {
+            s = s->_r_tree;
+            continue;
+        }
+
+        SplayTreeNode *p = s->_p_tree;
+        if (p != NULL) {
+            if (p->_l_tree == s) p->_l_tree = NULL;
+            else p->_r_tree = NULL;
+        }
+        if (cleanup != NULL) cleanup(s->_data, NULL);
+        free(s);
+        s = p;
+    }
+}
+
+// Returns the value that compares equal to data, or NULL. The search
+// splays the tree, so the node it ends on becomes the root.
+void *st_find(SplayTree *t, void *data) {
+    if (t->_tree == NULL) return NULL;
+    if (st_splay(t, data, false) != 0) return NULL;
+    return t->_tree->_data;
+}
+
+void st_free(SplayTree *t) {
+    st_free_node(t->_tree, t->_cleanup_fn);
+    free(t);
+}
+
+// Splits the tree around data and puts the new node on top.
+void st_insert(SplayTree *t, void *data) {
+    SplayTreeNode *new_node = st_make_node(t, NULL, data);
+    t->_length++;
+    if (t->_tree == NULL) {
+        t->_tree = new_node;
+        return;
+    }
+
+    // the root ends up being the last value not after data, or the first
+    // one after it
+    int c = st_splay(t, data, true);
+    SplayTreeNode *root = t->_tree;
+    if (c < 0) {
+        new_node->_l_tree = root->_l_tree;
+        new_node->_r_tree = root;
+        root->_l_tree = NULL;
+    } else {
+        new_node->_r_tree = root->_r_tree;
+        new_node->_l_tree = root;
+        root->_r_tree = NULL;
+    }
+    if (new_node->_l_tree) new_node->_l_tree->_p_tree = new_node;
+    if (new_node->_r_tree) new_node->_r_tree->_p_tree = new_node;
+    t->_tree = new_node;
+}
+
+// Removes one value that compares equal to data, if there is one.
+void st_remove(SplayTree *t, void *data) {
+    if (t->_tree == NULL) return;
+    if (st_splay(t, data, false) != 0) return;
+
+    SplayTreeNode *s = t->_tree;
+    SplayTreeNode *l = s->_l_tree;
+    SplayTreeNode *r = s->_r_tree;
+    if (l == NULL) {
+        t->_tree = r;
+        if (r) r->_p_tree = NULL;
+    } else {
+        // nothing on the left comes after data, so splaying it for data
+        // past the equal values brings up its largest value, which has no
+        // right child and can take the right subtree
+        l->_p_tree = NULL;
+        t->_tree = l;
+        st_splay(t, data, true);
+        t->_tree->_r_tree = r;
+        if (r) r->_p_tree = t->_tree;
+    }
+
+    if (t->_cleanup_fn != NULL) t->_cleanup_fn(s->_data, NULL);
+    free(s);
+    t->_length--;
+}
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef CSWISSMAP_H
+#define CSWISSMAP_H
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "callocator.h"
+#include "cmap.h"
+
+// An open-addressing string map in the style of Abseil's Swiss tables.
+// Every slot has one control byte: EMPTY, DELETED, or the low 7 bits of
+// the key's hash when the slot is full. Lookups probe whole groups of 16
+// slots, comparing all 16 control bytes against the hash tag with a single
+// SSE2 compare, and only touch keys whose tag matches. Keys, hashes and
+// values live in flat arrays indexed by slot. A key of up to
+// SWISS_INLINE_KEY_SIZE bytes, NUL included, is stored in its slot; only
+// longer keys are allocated separately, with the slot holding the pointer.
+//
+// The interface mirrors Map: sm_get returns a pointer to the stored value
+// (valid until the next insert), sm_insert replaces existing values after
+// running the cleanup function on them, and sm_map visits every binding.
+#define SWISS_GROUP_SIZE 16
+#define SWISS_DEFAULT_CAPACITY 32
+#define SWISS_MAX_LOAD_NUMERATOR 7
+#define SWISS_MAX_LOAD_DENOMINATOR 8
+
+#define SWISS_CTRL_EMPTY ((int8_t) -128)
+#define SWISS_CTRL_DELETED ((int8_t) -2)
+
+// The last byte of an inline key is always 0 (the NUL or padding); it is 1
+// when the slot holds a pointer to an out-of-line key instead.
+#define SWISS_INLINE_KEY_SIZE 16
+
+typedef struct {
+    char _bytes[SWISS_INLINE_KEY_SIZE];
+} SwissKey;
+
+typedef struct {
+    size_t _length;
+    size_t _stride;
+
+    MapMappableFn _cleanup_fn;
+
+    size_t _capacity;
+    size_t _n_deleted;
+    int8_t *_ctrl;
+    SwissKey *_keys;
+    uint64_t *_hashes;
+    char *_values;
+
+    const Allocator *_allocator;
+} SwissMap;
+
+bool sm_key_is_inline(const SwissKey *key) {
+    return key->_bytes[SWISS_INLINE_KEY_SIZE - 1] == 0;
+}
+
+char *sm_key(SwissKey *key) {
+    if (sm_key_is_inline(key)) return key->_bytes;
+    char *out_of_line;
+    memcpy(&out_of_line, key->_bytes, sizeof(char *));
+    return out_of_line;
+}
+
+void sm_key_set(SwissMap *m, SwissKey *key, const char *k, size_t key_size) {
+    memset(key->_bytes, 0, SWISS_INLINE_KEY_SIZE);
+    if (key_size <= SWISS_INLINE_KEY_SIZE) {
+        memcpy(key->_bytes, k, key_size);
+        return;
+    }
+
+    char *out_of_line = (char *) a_alloc(m->_allocator, key_size);
+    assert(out_of_line != NULL);
+    memcpy(out_of_line, k, key_size);
+    memcpy(key->_bytes, &out_of_line, sizeof(char *));
+    key->_bytes[SWISS_INLINE_KEY_SIZE - 1] = 1;
+}
+
+int8_t sm_tag(uint64_t hash) {
+    return (int8_t) (hash & 0x7F);
+}
+
+size_t sm_group_count(const SwissMap *m) {
+    return m->_capacity / SWISS_GROUP_SIZE;
+}
+
+// Bit i of the result is set when control byte i of the group equals c.
+uint32_t sm_group_match(const int8_t *group, int8_t c) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < SWISS_GROUP_SIZE; i++)
+        if (group[i] == c) mask |= ((uint32_t) 1) << i;
+    return mask;
+#endif
+}
+
+// Bit i is set when slot i of the group is EMPTY or DELETED, which are the
+// only control values with the high bit set.
+uint32_t sm_group_match_free(const int8_t *group) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint32_t) _mm_movemask_epi8(ctrl);
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < SWISS_GROUP_SIZE; i++)
+        if (group[i] < 0) mask |= ((uint32_t) 1) << i;
+    return mask;
+#endif
+}
+
+void sm_allocate(SwissMap *m, size_t capacity) {
+    assert(capacity % SWISS_GROUP_SIZE == 0);
+
+    m->_capacity = capacity;
+    m->_n_deleted = 0;
+    m->_ctrl = (int8_t *) a_alloc(m->_allocator, capacity);
+    m->_keys = (SwissKey *) a_alloc(m->_allocator, capacity * sizeof(SwissKey));
+    m->_hashes = (uint64_t *) a_alloc(m->_allocator, capacity * sizeof(uint64_t));
+    m->_values = (char *) a_alloc(m->_allocator, capacity * m->_stride);
+    assert(m->_ctrl && m->_keys && m->_hashes && m->_values);
+    memset(m->_ctrl, SWISS_CTRL_EMPTY, capacity);
+}
+
+void sm_release_arrays(SwissMap *m) {
+    a_free(m->_allocator, m->_ctrl, m->_capacity);
+    a_free(m->_allocator, m->_keys, m->_capacity * sizeof(SwissKey));
+    a_free(m->_allocator, m->_hashes, m->_capacity * sizeof(uint64_t));
+    a_free(m->_allocator, m->_values, m->_capacity * m->_stride);
+}
+
+void sm_init_with_allocator(SwissMap *m, size_t stride, const Allocator *a) {
+    m->_allocator = a;
+    m->_cleanup_fn = NULL;
+    m->_stride = stride;
+    m->_length = 0;
+    sm_allocate(m, SWISS_DEFAULT_CAPACITY);
+}
+
+void sm_init(SwissMap *m, size_t stride) {
+    sm_init_with_allocator(m, stride, NULL);
+}
+
+SwissMap *sm_make_with_allocator(size_t stride, const Allocator *a) {
+    SwissMap *m = (SwissMap *) a_alloc(a, sizeof(SwissMap));
+    assert(m != NULL);
+
+    sm_init_with_allocator(m, stride, a);
+    return m;
+}
+
+SwissMap *sm_make(size_t stride) {
+    return sm_make_with_allocator(stride, NULL);
+}
+
+size_t sm_size(SwissMap *m) {
+    return m->_length;
+}
+
+void *sm_value_at(SwissMap *m, size_t slot) {
+    return m->_values + slot * m->_stride;
+}
+
+// Groups are probed in triangular order (g, g+1, g+3, g+6, ...), which
+// visits every group when the group count is a power of two. A key can only
+// be in a later group if every group before it was full when it was
+// inserted, so the first group with an EMPTY slot ends the search.
+size_t sm_find_slot(SwissMap *m, const char *k, uint64_t hash) {
+    size_t mask = sm_group_count(m) - 1;
+    size_t group = (size_t) (hash >> 7) & mask;
+    int8_t tag = sm_tag(hash);
+
+    for (size_t step = 1; step <= sm_group_count(m); step++) {
+        const int8_t *ctrl = m->_ctrl + group * SWISS_GROUP_SIZE;
+        uint32_t candidates = sm_group_match(ctrl, tag);
+        while (candidates) {
+            size_t slot = group * SWISS_GROUP_SIZE + __builtin_ctz(candidates);
+            if (m->_hashes[slot] == hash && strcmp(sm_key(m->_keys + slot), k) == 0)
+                return slot;
+            candidates &= candidates - 1;
+        }
+        if (sm_group_match(ctrl, SWISS_CTRL_EMPTY))
+            return m->_capacity;
+        group = (group + step) & mask;
+    }
+    return m->_capacity;
+}
+
+size_t sm_find_free_slot(SwissMap *m, uint64_t hash) {
+    size_t mask = sm_group_count(m) - 1;
+    size_t group = (size_t) (hash >> 7) & mask;
+
+    for (size_t step = 1; step <= sm_group_count(m); step++) {
+        uint32_t free_slots = sm_group_match_free(m->_ctrl + group * SWISS_GROUP_SIZE);
+        if (free_slots)
+            return group * SWISS_GROUP_SIZE + __builtin_ctz(free_slots);
+        group = (group + step) & mask;
+    }
+    assert(0);
+    return m->_capacity;
+}
+
+void *sm_get(SwissMap *m, const char *k) {
+    size_t slot = sm_find_slot(m, k, m_hash_string(k));
+    return slot == m->_capacity ? NULL : sm_value_at(m, slot);
+}
+
+// Claims a free slot for hash and copies the value in; the caller fills in
+// the key.
+size_t sm_place(SwissMap *m, uint64_t hash, const void *data) {
+    size_t slot = sm_find_free_slot(m, hash);
+    if (m->_ctrl[slot] == SWISS_CTRL_DELETED) m->_n_deleted--;
+    m->_ctrl[slot] = sm_tag(hash);
+    m->_hashes[slot] = hash;
+    memcpy(sm_value_at(m, slot), data, m->_stride);
+    return slot;
+}
+
+// Rebuilds the table with room for the current elements plus growth,
+// dropping all tombstones on the way.
+void sm_rehash(SwissMap *m, size_t capacity) {
+    SwissMap old = *m;
+    sm_allocate(m, capacity);
+
+    for (size_t slot = 0; slot < old._capacity; slot++) {
+        if (old._ctrl[slot] < 0) continue;
+        size_t new_slot = sm_place(m, old._hashes[slot], old._values + slot * old._stride);
+        m->_keys[new_slot] = old._keys[slot];
+    }
+
+    sm_release_arrays(&old);
+}
+
+void sm_ensure_space(SwissMap *m) {
+    size_t used = m->_length + m->_n_deleted + 1;
+    if (used * SWISS_MAX_LOAD_DENOMINATOR <= m->_capacity * SWISS_MAX_LOAD_NUMERATOR)
+        return;
+
+    // if tombstones make up much of the load, rehashing in place frees them
+    if ((m->_length + 1) * 2 * SWISS_MAX_LOAD_DENOMINATOR
+        <= m->_capacity * SWISS_MAX_LOAD_NUMERATOR)
+        sm_rehash(m, m->_capacity);
+    else
+        sm_rehash(m, m->_capacity * 2);
+}
+
+void sm_free_key(SwissMap *m, size_t slot) {
+    SwissKey *key = m->_keys + slot;
+    if (sm_key_is_inline(key)) return;
+    char *out_of_line = sm_key(key);
+    a_free(m->_allocator, out_of_line, strlen(out_of_line) + 1);
+}
+
+void sm_insert(SwissMap *m, const char *k, void *data) {
+    uint64_t hash = m_hash_string(k);
+    size_t slot = sm_find_slot(m, k, hash);
+    if (slot != m->_capacity) {
+        if (m->_cleanup_fn != NULL)
+            m->_cleanup_fn(NULL, sm_value_at(m, slot), NULL);
+        memcpy(sm_value_at(m, slot), data, m->_stride);
+        return;
+    }
+
+    sm_ensure_space(m);
+    slot = sm_place(m, hash, data);
+    sm_key_set(m, m->_keys + slot, k, strlen(k) + 1);
+    m->_length++;
+}
+
+void sm_remove(SwissMap *m, const char *k) {
+    size_t slot = sm_find_slot(m, k, m_hash_string(k));
+    if (slot == m->_capacity) return;
+
+    if (m->_cleanup_fn != NULL)
+        m->_cleanup_fn(NULL, sm_value_at(m, slot), NULL);
+    sm_free_key(m, slot);
+    m->_length--;
+
+    // a group that still has an EMPTY slot never made a probe move past it,
+    // so the slot can go straight back to EMPTY instead of a tombstone
+    size_t group = slot / SWISS_GROUP_SIZE;
+    if (sm_group_match(m->_ctrl + group * SWISS_GROUP_SIZE, SWISS_CTRL_EMPTY)) {
+        m->_ctrl[slot] = SWISS_CTRL_EMPTY;
+    } else {
+        m->_ctrl[slot] = SWISS_CTRL_DELETED;
+        m->_n_deleted++;
+    }
+}
+
+void sm_map(SwissMap *m, MapMappableFn f, void *aux) {
+    for (size_t slot = 0; slot < m->_capacity; slot++) {
+        if (m->_ctrl[slot] < 0) continue;
+        f(sm_key(m->_keys + slot), sm_value_at(m, slot), aux);
+    }
+}
+
+void sm_free(SwissMap *m) {
+    for (size_t slot = 0; slot < m->_capacity; slot++) {
+        if (m->_ctrl[slot] < 0) continue;
+        if (m->_cleanup_fn)
+            m->_cleanup_fn(NULL, sm_value_at(m, slot), NULL);
+        sm_free_key(m, slot);
+    }
+
+    sm_release_arrays(m);
+    a_free(m->_allocator, m, sizeof(SwissMap));
+}
+
+#endif
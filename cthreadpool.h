@@ -0,0 +1,269 @@
+#ifndef CTHREADPOOL_H
+#define CTHREADPOOL_H
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cvector.h"
+
+// vectors shorter than this are mapped/filtered on the calling thread, and
+// no chunk handed to a worker is smaller than this; bench/parallel.c
+// measures where the batch overhead drops below ~10% of a cheap map
+#ifndef VECTOR_PARALLEL_MIN_CHUNK
+#define VECTOR_PARALLEL_MIN_CHUNK 16384
+#endif
+// chunks per participating thread, so that uneven chunks still balance
+#define VECTOR_PARALLEL_CHUNKS_PER_THREAD 4
+
+typedef void (*ThreadPoolTaskFn)(size_t, void *);
+
+// A fixed set of worker threads running one batch of tasks at a time.
+// tp_run hands out task indices [0, n_tasks) to the workers and to the
+// calling thread, and returns once every task has finished.
+typedef struct {
+    pthread_t *_threads;
+    size_t _n_threads;
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _work_ready;
+    pthread_cond_t _work_done;
+
+    ThreadPoolTaskFn _task_fn;
+    void *_task_aux;
+    size_t _n_tasks;
+    size_t _next_task;
+    size_t _n_finished;
+    size_t _generation;
+    bool _shutdown;
+} ThreadPool;
+
+// Runs tasks of the current batch until none are left. Called with the
+// lock held, returns with the lock held.
+void tp_drain_tasks(ThreadPool *tp) {
+    while (tp->_next_task < tp->_n_tasks) {
+        size_t task_idx = tp->_next_task++;
+        pthread_mutex_unlock(&tp->_lock);
+        tp->_task_fn(task_idx, tp->_task_aux);
+        pthread_mutex_lock(&tp->_lock);
+
+        tp->_n_finished++;
+        if (tp->_n_finished == tp->_n_tasks)
+            pthread_cond_broadcast(&tp->_work_done);
+    }
+}
+
+void *tp_worker(void *p) {
+    ThreadPool *tp = (ThreadPool *) p;
+    size_t seen_generation = 0;
+
+    pthread_mutex_lock(&tp->_lock);
+    while (true) {
+        while (!tp->_shutdown && tp->_generation == seen_generation)
+            pthread_cond_wait(&tp->_work_ready, &tp->_lock);
+        if (tp->_shutdown) break;
+
+        seen_generation = tp->_generation;
+        tp_drain_tasks(tp);
+    }
+    pthread_mutex_unlock(&tp->_lock);
+    return NULL;
+}
+
+size_t tp_default_thread_count() {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return n_cpus > 1 ? (size_t) n_cpus - 1 : 0;
+}
+
+// Makes a pool with n_threads workers besides the calling thread. Pass
+// tp_default_thread_count() to use every online CPU.
+ThreadPool *tp_make(size_t n_threads) {
+    ThreadPool *tp = (ThreadPool *) malloc(sizeof(ThreadPool));
+    assert(tp != NULL);
+
+    tp->_n_threads = n_threads;
+    tp->_task_fn = NULL;
+    tp->_task_aux = NULL;
+    tp->_n_tasks = 0;
+    tp->_next_task = 0;
+    tp->_n_finished = 0;
+    tp->_generation = 0;
+    tp->_shutdown = false;
+
+    pthread_mutex_init(&tp->_lock, NULL);
+    pthread_cond_init(&tp->_work_ready, NULL);
+    pthread_cond_init(&tp->_work_done, NULL);
+
+    tp->_threads = (pthread_t *) malloc(sizeof(pthread_t) * (n_threads ? n_threads : 1));
+    assert(tp->_threads != NULL);
+    for (size_t t_idx = 0; t_idx < n_threads; t_idx++) {
+        int result = pthread_create(&tp->_threads[t_idx], NULL, tp_worker, tp);
+        assert(result == 0);
+        (void) result;
+    }
+    return tp;
+}
+
+size_t tp_size(ThreadPool *tp) {
+    return tp->_n_threads + 1;
+}
+
+void tp_run(ThreadPool *tp, size_t n_tasks, ThreadPoolTaskFn f, void *aux) {
+    if (n_tasks == 0) return;
+
+    pthread_mutex_lock(&tp->_lock);
+    tp->_task_fn = f;
+    tp->_task_aux = aux;
+    tp->_n_tasks = n_tasks;
+    tp->_next_task = 0;
+    tp->_n_finished = 0;
+    tp->_generation++;
+    pthread_cond_broadcast(&tp->_work_ready);
+
+    tp_drain_tasks(tp);
+    while (tp->_n_finished < tp->_n_tasks)
+        pthread_cond_wait(&tp->_work_done, &tp->_lock);
+    pthread_mutex_unlock(&tp->_lock);
+}
+
+void tp_free(ThreadPool *tp) {
+    pthread_mutex_lock(&tp->_lock);
+    tp->_shutdown = true;
+    pthread_cond_broadcast(&tp->_work_ready);
+    pthread_mutex_unlock(&tp->_lock);
+
+    for (size_t t_idx = 0; t_idx < tp->_n_threads; t_idx++)
+        pthread_join(tp->_threads[t_idx], NULL);
+
+    pthread_mutex_destroy(&tp->_lock);
+    pthread_cond_destroy(&tp->_work_ready);
+    pthread_cond_destroy(&tp->_work_done);
+    free(tp->_threads);
+    free(tp);
+}
+
+// Parallel vector operations split the vector into contiguous chunks, one
+// task per chunk. The mapped function or predicate is called concurrently
+// from several threads and must not touch shared state without its own
+// synchronization.
+
+typedef struct {
+    Vector *_v;
+    size_t _chunk_size;
+    VectorMappableFn _map_fn;
+    VectorPredicateFn _pred;
+    const void *_aux;
+    Vector **_chunk_outputs;
+    size_t *_chunk_offsets;
+    Vector *_output;
+} VectorParallelJob;
+
+size_t v_parallel_chunk_count(ThreadPool *tp, Vector *v, size_t *chunk_size) {
+    size_t n = v_size(v);
+    size_t n_chunks = tp_size(tp) * VECTOR_PARALLEL_CHUNKS_PER_THREAD;
+    if (n / n_chunks < VECTOR_PARALLEL_MIN_CHUNK)
+        n_chunks = n / VECTOR_PARALLEL_MIN_CHUNK;
+    if (n_chunks == 0) n_chunks = 1;
+
+    *chunk_size = (n + n_chunks - 1) / n_chunks;
+    return n_chunks;
+}
+
+void v_parallel_chunk_bounds(VectorParallelJob *job, size_t chunk_idx,
+                             size_t *start, size_t *end) {
+    *start = chunk_idx * job->_chunk_size;
+    *end = *start + job->_chunk_size;
+    if (*end > v_size(job->_v)) *end = v_size(job->_v);
+    if (*start > *end) *start = *end;
+}
+
+void v_map_parallel_task(size_t chunk_idx, void *aux) {
+    VectorParallelJob *job = (VectorParallelJob *) aux;
+    size_t start, end;
+    v_parallel_chunk_bounds(job, chunk_idx, &start, &end);
+
+    char *current = (char *) v_at_unsafe(job->_v, start);
+    for (size_t idx = start; idx < end; idx++) {
+        job->_map_fn((void *) current, (void *) job->_aux);
+        current += job->_v->_stride;
+    }
+}
+
+void v_map_parallel(ThreadPool *tp, Vector *v, VectorMappableFn f, void *aux) {
+    if (tp_size(tp) == 1 || v_size(v) < 2 * VECTOR_PARALLEL_MIN_CHUNK) {
+        v_map(v, f, aux);
+        return;
+    }
+
+    VectorParallelJob job;
+    job._v = v;
+    job._map_fn = f;
+    job._aux = aux;
+    size_t n_chunks = v_parallel_chunk_count(tp, v, &job._chunk_size);
+    tp_run(tp, n_chunks, v_map_parallel_task, &job);
+}
+
+void v_filter_parallel_select_task(size_t chunk_idx, void *aux) {
+    VectorParallelJob *job = (VectorParallelJob *) aux;
+    size_t start, end;
+    v_parallel_chunk_bounds(job, chunk_idx, &start, &end);
+
+    Vector *o = v_make(job->_v->_stride);
+    char *current = (char *) v_at_unsafe(job->_v, start);
+    for (size_t idx = start; idx < end; idx++) {
+        if (job->_pred((void *) current, job->_aux))
+            v_push_back(o, current);
+        current += job->_v->_stride;
+    }
+    job->_chunk_outputs[chunk_idx] = o;
+}
+
+void v_filter_parallel_merge_task(size_t chunk_idx, void *aux) {
+    VectorParallelJob *job = (VectorParallelJob *) aux;
+    Vector *chunk = job->_chunk_outputs[chunk_idx];
+    memcpy(v_at_unsafe(job->_output, job->_chunk_offsets[chunk_idx]),
+           chunk->_data, chunk->_stride * v_size(chunk));
+    v_free(chunk);
+}
+
+// Order-preserving: every chunk filters into its own vector, a prefix sum
+// over the chunk sizes gives each chunk its offset in the output, and the
+// chunks are then copied into place in parallel.
+Vector *v_filter_parallel(ThreadPool *tp, Vector *v, VectorPredicateFn pred,
+                          const void *aux) {
+    if (tp_size(tp) == 1 || v_size(v) < 2 * VECTOR_PARALLEL_MIN_CHUNK)
+        return v_filter(v, pred, aux);
+
+    VectorParallelJob job;
+    job._v = v;
+    job._pred = pred;
+    job._aux = aux;
+    size_t n_chunks = v_parallel_chunk_count(tp, v, &job._chunk_size);
+
+    job._chunk_outputs = (Vector **) malloc(sizeof(Vector *) * n_chunks);
+    job._chunk_offsets = (size_t *) malloc(sizeof(size_t) * n_chunks);
+    assert(job._chunk_outputs != NULL && job._chunk_offsets != NULL);
+
+    tp_run(tp, n_chunks, v_filter_parallel_select_task, &job);
+
+    size_t total = 0;
+    for (size_t chunk_idx = 0; chunk_idx < n_chunks; chunk_idx++) {
+        job._chunk_offsets[chunk_idx] = total;
+        total += v_size(job._chunk_outputs[chunk_idx]);
+    }
+
+    job._output = v_make_with_allocator(v->_stride, v->_allocator);
+    job._output->_cleanup_fn = NULL; // explicitly!
+    v_reserve(job._output, total);
+    job._output->_length = total;
+
+    tp_run(tp, n_chunks, v_filter_parallel_merge_task, &job);
+
+    free(job._chunk_outputs);
+    free(job._chunk_offsets);
+    return job._output;
+}
+
+#endif
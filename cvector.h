@@ -6,6 +6,14 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "callocator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CVECTOR_X86
+#endif
 
 #define DEFAULT_VECTOR_SIZE 16
 
@@ -17,32 +25,88 @@ typedef struct {
     size_t _length;
     size_t _capacity;
     size_t _stride;
+    size_t _inline_capacity;
 
     VectorMappableFn _cleanup_fn;
+    const Allocator *_allocator;
 } Vector;
 
+// Vectors made by v_make_inline keep their first _inline_capacity elements
+// in the same allocation as the Vector header, and only move to a separate
+// heap buffer once they outgrow it. The offset keeps inline elements as
+// aligned as a malloc'd buffer would be.
+#define VECTOR_INLINE_ALIGNMENT 16
+#define VECTOR_INLINE_OFFSET                                            \
+    (((sizeof(Vector) + VECTOR_INLINE_ALIGNMENT - 1)                    \
+      / VECTOR_INLINE_ALIGNMENT) * VECTOR_INLINE_ALIGNMENT)
+
 void vector_generic_free(void *p, __attribute__((unused)) void *aux) {
     free(*((void **) p));
 }
 
-void vec_init(Vector *v, size_t stride) {
+void vec_init_with_allocator(Vector *v, size_t stride, const Allocator *a) {
     assert(stride > 0);
 
+    v->_allocator = a;
     v->_stride = stride;
     v->_capacity = DEFAULT_VECTOR_SIZE;
-    v->_data = malloc(v->_capacity * stride);
+    v->_data = a_alloc(a, v->_capacity * stride);
     assert(v->_data != NULL);
     v->_length = 0;
+    v->_inline_capacity = 0;
     v->_cleanup_fn = NULL;
 }
 
+void vec_init(Vector *v, size_t stride) {
+    vec_init_with_allocator(v, stride, NULL);
+}
+
+Vector *v_make_with_allocator(size_t stride, const Allocator *a) {
+    Vector *v = (Vector *) a_alloc(a, sizeof(Vector));
+    assert(v != NULL);
+    vec_init_with_allocator(v, stride, a);
+    return v;
+}
+
 Vector *v_make(size_t stride) {
-    Vector *v = (Vector *) malloc(sizeof(Vector));
+    return v_make_with_allocator(stride, NULL);
+}
+
+void *v_inline_data(const Vector *v) {
+    return (void *) (((char *) v) + VECTOR_INLINE_OFFSET);
+}
+
+bool v_is_inline(const Vector *v) {
+    return v->_inline_capacity != 0 && v->_data == v_inline_data(v);
+}
+
+// Size of the block holding the Vector itself, including inline storage.
+size_t v_header_size(const Vector *v) {
+    if (v->_inline_capacity == 0) return sizeof(Vector);
+    return VECTOR_INLINE_OFFSET + v->_inline_capacity * v->_stride;
+}
+
+Vector *v_make_inline_with_allocator(size_t stride, size_t n_inline,
+                                     const Allocator *a) {
+    assert(stride > 0);
+    assert(n_inline > 0);
+
+    Vector *v = (Vector *) a_alloc(a, VECTOR_INLINE_OFFSET + n_inline * stride);
     assert(v != NULL);
-    vec_init(v, stride);
+    v->_allocator = a;
+    v->_stride = stride;
+    v->_capacity = n_inline;
+    v->_inline_capacity = n_inline;
+    v->_data = v_inline_data(v);
+    v->_length = 0;
+    v->_cleanup_fn = NULL;
     return v;
 }
 
+Vector *v_make_inline(size_t stride, size_t n_inline) {
+    return v_make_inline_with_allocator(stride, n_inline, NULL);
+}
+
 size_t v_size(const Vector *v) {
     return v->_length;
 }
@@ -68,8 +132,9 @@ void v_map(Vector *v, VectorMappableFn f, void *aux) {
 void v_free(Vector *v) {
     if (v->_cleanup_fn)
         v_map(v, v->_cleanup_fn, NULL);
-    free(v->_data);
-    free(v);
+    if (!v_is_inline(v))
+        a_free(v->_allocator, v->_data, v->_capacity * v->_stride);
+    a_free(v->_allocator, v, v_header_size(v));
 }
 
 void *v_at_unsafe(const Vector *v, size_t idx) {
@@ -87,12 +152,40 @@ void v_replace_at(Vector *v, void *data, size_t idx) {
 }
 
 void v_extend(Vector *v, size_t c) {
-    void *new_data = realloc(v->_data, v->_stride * c);
-    assert(v->_data != NULL);
+    if (v_is_inline(v)) {
+        // spill the inline elements to the heap, the inline space stays put
+        void *heap_data = a_alloc(v->_allocator, v->_stride * c);
+        assert(heap_data != NULL);
+        memcpy(heap_data, v->_data, v->_stride * v->_length);
+        v->_data = heap_data;
+        v->_capacity = c;
+        return;
+    }
+
+    void *new_data = a_realloc(v->_allocator, v->_data,
+                               v->_stride * v->_capacity, v->_stride * c);
+    assert(new_data != NULL);
     v->_data = new_data;
     v->_capacity = c;
 }
 
+// Grows to exactly c elements of capacity, never shrinks.
+void v_reserve(Vector *v, size_t c) {
+    if (c > v->_capacity)
+        v_extend(v, c);
+}
+
+// Grows geometrically until at least c elements fit, so that a sequence of
+// appends costs amortized O(1) reallocations per element.
+void v_ensure_capacity(Vector *v, size_t c) {
+    if (c <= v->_capacity) return;
+
+    size_t new_capacity = v->_capacity ? v->_capacity : DEFAULT_VECTOR_SIZE;
+    while (new_capacity < c)
+        new_capacity *= 2;
+    v_extend(v, new_capacity);
+}
+
 void v_remove(Vector *v, size_t idx) {
     void *d = v_at(v, idx);
     memmove(d, ((char *) d) + v->_stride, v->_stride * (v_size(v) - idx - 1));
@@ -107,8 +200,35 @@ void v_push_back(Vector *v, void *data) {
     v->_length++;
 }
 
+// Appends n contiguous elements starting at data with at most one resize.
+void v_push_back_n(Vector *v, const void *data, size_t n) {
+    if (n == 0) return;
+    v_ensure_capacity(v, v_size(v) + n);
+    memcpy(v_at_unsafe(v, v_size(v)), data, v->_stride * n);
+    v->_length += n;
+}
+
+// Sets the length to n. New elements are copies of fill, or zeroed if fill
+// is NULL. Like v_remove, truncation does not run the cleanup function on
+// the dropped elements.
+void v_resize(Vector *v, size_t n, const void *fill) {
+    if (n > v_size(v)) {
+        v_ensure_capacity(v, n);
+        char *current = (char *) v_at_unsafe(v, v_size(v));
+        if (fill == NULL) {
+            memset(current, 0, v->_stride * (n - v_size(v)));
+        } else {
+            for (size_t idx = v_size(v); idx < n; idx++) {
+                memcpy(current, fill, v->_stride);
+                current += v->_stride;
+            }
+        }
+    }
+    v->_length = n;
+}
+
 Vector *v_filter(Vector *v, VectorPredicateFn pred, const void *aux) {
-    Vector *o = v_make(v->_stride);
+    Vector *o = v_make_with_allocator(v->_stride, v->_allocator);
     o->_cleanup_fn = NULL; // explicitly!
 
     char *current = (char *) v->_data;
@@ -131,9 +251,720 @@ void *v_start(Vector *v) {
 
 void v_append(Vector *f, Vector *s) {
     assert(f->_stride == s->_stride);
-    if (f->_capacity < s->_length) v_extend(f, s->_length);
-    memcpy(v_end(f), v_start(s), s->_stride * s->_length);
-    f->_length += s->_length;
+    v_push_back_n(f, s->_data, s->_length);
+}
+
+
+// Equality kernels for vectors of 4- and 8-byte elements (ids, pointers,
+// integers). Each kernel compares a whole block of elements per instruction
+// and reports either the index of the first match (n if there is none) or
+// the number of matches. AVX2 is picked at runtime when the CPU has it,
+// SSE2 otherwise, and other targets get the scalar loops.
+
+size_t v_scalar_find_eq32(const void *data, size_t n, uint32_t key) {
+    const char *current = (const char *) data;
+    for (size_t idx = 0; idx < n; idx++) {
+        uint32_t e;
+        memcpy(&e, current + idx * sizeof(e), sizeof(e));
+        if (e == key) return idx;
+    }
+    return n;
+}
+
+size_t v_scalar_count_eq32(const void *data, size_t n, uint32_t key) {
+    const char *current = (const char *) data;
+    size_t count = 0;
+    for (size_t idx = 0; idx < n; idx++) {
+        uint32_t e;
+        memcpy(&e, current + idx * sizeof(e), sizeof(e));
+        count += (e == key);
+    }
+    return count;
+}
+
+size_t v_scalar_find_eq64(const void *data, size_t n, uint64_t key) {
+    const char *current = (const char *) data;
+    for (size_t idx = 0; idx < n; idx++) {
+        uint64_t e;
+        memcpy(&e, current + idx * sizeof(e), sizeof(e));
+        if (e == key) return idx;
+    }
+    return n;
+}
+
+size_t v_scalar_count_eq64(const void *data, size_t n, uint64_t key) {
+    const char *current = (const char *) data;
+    size_t count = 0;
+    for (size_t idx = 0; idx < n; idx++) {
+        uint64_t e;
+        memcpy(&e, current + idx * sizeof(e), sizeof(e));
+        count += (e == key);
+    }
+    return count;
+}
+
+#if defined(CVECTOR_X86) && defined(__SSE2__)
+#define CVECTOR_SSE2
+
+// SSE2 has no 64-bit compare: a 64-bit lane matches when both of its 32-bit
+// halves do, so AND the 32-bit result with itself with the halves swapped
+__m128i v_sse2_cmpeq64(__m128i a, __m128i b) {
+    __m128i eq32 = _mm_cmpeq_epi32(a, b);
+    return _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+size_t v_sse2_find_eq32(const void *data, size_t n, uint32_t key) {
+    const char *current = (const char *) data;
+    __m128i k = _mm_set1_epi32((int) key);
+    size_t idx = 0;
+    for (; idx + 4 <= n; idx += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (current + idx * 4));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, k)));
+        if (mask) return idx + __builtin_ctz(mask);
+    }
+    return idx + v_scalar_find_eq32(current + idx * 4, n - idx, key);
+}
+
+size_t v_sse2_count_eq32(const void *data, size_t n, uint32_t key) {
+    const char *current = (const char *) data;
+    __m128i k = _mm_set1_epi32((int) key);
+    size_t count = 0;
+    size_t idx = 0;
+    for (; idx + 4 <= n; idx += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (current + idx * 4));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, k)));
+        count += __builtin_popcount(mask);
+    }
+    return count + v_scalar_count_eq32(current + idx * 4, n - idx, key);
+}
+
+size_t v_sse2_find_eq64(const void *data, size_t n, uint64_t key) {
+    const char *current = (const char *) data;
+    __m128i k = _mm_set1_epi64x((long long) key);
+    size_t idx = 0;
+    for (; idx + 2 <= n; idx += 2) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (current + idx * 8));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(v_sse2_cmpeq64(block, k)));
+        if (mask) return idx + __builtin_ctz(mask);
+    }
+    return idx + v_scalar_find_eq64(current + idx * 8, n - idx, key);
+}
+
+size_t v_sse2_count_eq64(const void *data, size_t n, uint64_t key) {
+    const char *current = (const char *) data;
+    __m128i k = _mm_set1_epi64x((long long) key);
+    size_t count = 0;
+    size_t idx = 0;
+    for (; idx + 2 <= n; idx += 2) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (current + idx * 8));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(v_sse2_cmpeq64(block, k)));
+        count += __builtin_popcount(mask);
+    }
+    return count + v_scalar_count_eq64(current + idx * 8, n - idx, key);
+}
+#endif
+
+#if defined(CVECTOR_X86) && defined(__GNUC__)
+#define CVECTOR_AVX2
+
+__attribute__((target("avx2")))
+size_t v_avx2_find_eq32(const void *data, size_t n, uint32_t key) {
+    const char *current = (const char *) data;
+    __m256i k = _mm256_set1_epi32((int) key);
+    size_t idx = 0;
+    for (; idx + 8 <= n; idx += 8) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (current + idx * 4));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(block, k)));
+        if (mask) return idx + __builtin_ctz(mask);
+    }
+    return idx + v_scalar_find_eq32(current + idx * 4, n - idx, key);
+}
+
+__attribute__((target("avx2")))
+size_t v_avx2_count_eq32(const void *data, size_t n, uint32_t key) {
+    const char *current = (const char *) data;
+    __m256i k = _mm256_set1_epi32((int) key);
+    size_t count = 0;
+    size_t idx = 0;
+    for (; idx + 8 <= n; idx += 8) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (current + idx * 4));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(block, k)));
+        count += __builtin_popcount(mask);
+    }
+    return count + v_scalar_count_eq32(current + idx * 4, n - idx, key);
+}
+
+__attribute__((target("avx2")))
+size_t v_avx2_find_eq64(const void *data, size_t n, uint64_t key) {
+    const char *current = (const char *) data;
+    __m256i k = _mm256_set1_epi64x((long long) key);
+    size_t idx = 0;
+    for (; idx + 4 <= n; idx += 4) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (current + idx * 8));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(block, k)));
+        if (mask) return idx + __builtin_ctz(mask);
+    }
+    return idx + v_scalar_find_eq64(current + idx * 8, n - idx, key);
+}
+
+__attribute__((target("avx2")))
+size_t v_avx2_count_eq64(const void *data, size_t n, uint64_t key) {
+    const char *current = (const char *) data;
+    __m256i k = _mm256_set1_epi64x((long long) key);
+    size_t count = 0;
+    size_t idx = 0;
+    for (; idx + 4 <= n; idx += 4) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (current + idx * 8));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(block, k)));
+        count += __builtin_popcount(mask);
+    }
+    return count + v_scalar_count_eq64(current + idx * 8, n - idx, key);
+}
+#endif
+
+bool v_cpu_has_avx2() {
+#ifdef CVECTOR_AVX2
+    static int has_avx2 = -1;
+    if (has_avx2 < 0) {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return has_avx2 == 1;
+#else
+    return false;
+#endif
 }
 
+size_t v_find_eq_index(const Vector *v, const void *key) {
+    if (v->_stride == 4) {
+        uint32_t k;
+        memcpy(&k, key, sizeof(k));
+#ifdef CVECTOR_AVX2
+        if (v_cpu_has_avx2()) return v_avx2_find_eq32(v->_data, v->_length, k);
+#endif
+#ifdef CVECTOR_SSE2
+        return v_sse2_find_eq32(v->_data, v->_length, k);
+#else
+        return v_scalar_find_eq32(v->_data, v->_length, k);
+#endif
+    }
+    if (v->_stride == 8) {
+        uint64_t k;
+        memcpy(&k, key, sizeof(k));
+#ifdef CVECTOR_AVX2
+        if (v_cpu_has_avx2()) return v_avx2_find_eq64(v->_data, v->_length, k);
+#endif
+#ifdef CVECTOR_SSE2
+        return v_sse2_find_eq64(v->_data, v->_length, k);
+#else
+        return v_scalar_find_eq64(v->_data, v->_length, k);
+#endif
+    }
+
+    const char *current = (const char *) v->_data;
+    for (size_t idx = 0; idx < v->_length; idx++) {
+        if (memcmp(current, key, v->_stride) == 0) return idx;
+        current += v->_stride;
+    }
+    return v->_length;
+}
+
+// Returns the first element bytewise equal to key, or NULL.
+void *v_find_eq(Vector *v, const void *key) {
+    size_t idx = v_find_eq_index(v, key);
+    return idx < v_size(v) ? v_at(v, idx) : NULL;
+}
+
+// Counts the elements bytewise equal to key.
+size_t v_count_eq(const Vector *v, const void *key) {
+    if (v->_stride == 4) {
+        uint32_t k;
+        memcpy(&k, key, sizeof(k));
+#ifdef CVECTOR_AVX2
+        if (v_cpu_has_avx2()) return v_avx2_count_eq32(v->_data, v->_length, k);
+#endif
+#ifdef CVECTOR_SSE2
+        return v_sse2_count_eq32(v->_data, v->_length, k);
+#else
+        return v_scalar_count_eq32(v->_data, v->_length, k);
+#endif
+    }
+    if (v->_stride == 8) {
+        uint64_t k;
+        memcpy(&k, key, sizeof(k));
+#ifdef CVECTOR_AVX2
+        if (v_cpu_has_avx2()) return v_avx2_count_eq64(v->_data, v->_length, k);
+#endif
+#ifdef CVECTOR_SSE2
+        return v_sse2_count_eq64(v->_data, v->_length, k);
+#else
+        return v_scalar_count_eq64(v->_data, v->_length, k);
+#endif
+    }
+
+    const char *current = (const char *) v->_data;
+    size_t count = 0;
+    for (size_t idx = 0; idx < v->_length; idx++) {
+        count += (memcmp(current, key, v->_stride) == 0);
+        current += v->_stride;
+    }
+    return count;
+}
+
+// Every element that passes an equality filter is a copy of key, so the
+// result is sized by a single counting pass and filled in one go.
+Vector *v_filter_eq(Vector *v, const void *key) {
+    Vector *o = v_make_with_allocator(v->_stride, v->_allocator);
+    o->_cleanup_fn = NULL; // explicitly!
+    v_resize(o, v_count_eq(v, key), key);
+    return o;
+}
+
+// Ordering. Comparators follow the qsort convention: negative, zero or
+// positive as the first element sorts before, equal to or after the second.
+
+typedef int (*VectorComparatorFn)(const void *, const void *);
+
+#define VECTOR_INSERTION_SORT_THRESHOLD 16
+
+void v_swap_elems(char *a, char *b, size_t stride) {
+    char tmp[64];
+    while (stride > 0) {
+        size_t n = stride < sizeof(tmp) ? stride : sizeof(tmp);
+        memcpy(tmp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, tmp, n);
+        a += n;
+        b += n;
+        stride -= n;
+    }
+}
+
+void v_insertion_sort_range(char *base, size_t n, size_t stride,
+                            VectorComparatorFn comp) {
+    for (size_t idx = 1; idx < n; idx++) {
+        for (size_t j = idx; j > 0; j--) {
+            char *current = base + j * stride;
+            if (comp(current - stride, current) <= 0) break;
+            v_swap_elems(current - stride, current, stride);
+        }
+    }
+}
+
+void v_sift_down(char *base, size_t root, size_t n, size_t stride,
+                 VectorComparatorFn comp) {
+    while (2 * root + 1 < n) {
+        size_t child = 2 * root + 1;
+        if (child + 1 < n && comp(base + child * stride, base + (child + 1) * stride) < 0)
+            child++;
+        if (comp(base + root * stride, base + child * stride) >= 0) return;
+        v_swap_elems(base + root * stride, base + child * stride, stride);
+        root = child;
+    }
+}
+
+void v_heap_sort_range(char *base, size_t n, size_t stride,
+                       VectorComparatorFn comp) {
+    for (size_t idx = n / 2; idx --> 0;)
+        v_sift_down(base, idx, n, stride, comp);
+    for (size_t end = n; end --> 1;) {
+        v_swap_elems(base, base + end * stride, stride);
+        v_sift_down(base, 0, end, stride, comp);
+    }
+}
+
+// Quicksort with a median of three pivot, finishing small ranges with
+// insertion sort and switching to heapsort once the recursion gets deeper
+// than 2 log2 n, which bounds the worst case at O(n log n).
+void v_introsort_range(char *base, size_t n, size_t stride,
+                       VectorComparatorFn comp, size_t depth_limit) {
+    while (n > VECTOR_INSERTION_SORT_THRESHOLD) {
+        if (depth_limit == 0) {
+            v_heap_sort_range(base, n, stride, comp);
+            return;
+        }
+        depth_limit--;
+
+        char *lo = base;
+        char *mid = base + (n / 2) * stride;
+        char *hi = base + (n - 1) * stride;
+        if (comp(mid, lo) < 0) v_swap_elems(mid, lo, stride);
+        if (comp(hi, mid) < 0) {
+            v_swap_elems(hi, mid, stride);
+            if (comp(mid, lo) < 0) v_swap_elems(mid, lo, stride);
+        }
+        // park the pivot at the front so partitioning cannot move it
+        v_swap_elems(base, mid, stride);
+
+        size_t i = 1;
+        size_t j = n - 1;
+        while (true) {
+            while (comp(base + i * stride, base) < 0) i++;
+            while (comp(base, base + j * stride) < 0) j--;
+            if (i >= j) break;
+            v_swap_elems(base + i * stride, base + j * stride, stride);
+            i++;
+            j--;
+        }
+        v_swap_elems(base, base + j * stride, stride);
+
+        // recurse into the smaller side, loop on the larger one
+        size_t n_left = j;
+        size_t n_right = n - j - 1;
+        if (n_left < n_right) {
+            v_introsort_range(base, n_left, stride, comp, depth_limit);
+            base += (j + 1) * stride;
+            n = n_right;
+        } else {
+            v_introsort_range(base + (j + 1) * stride, n_right, stride, comp, depth_limit);
+            n = n_left;
+        }
+    }
+    v_insertion_sort_range(base, n, stride, comp);
+}
+
+size_t v_sort_depth_limit(size_t n) {
+    size_t depth = 0;
+    while (n > 1) {
+        n >>= 1;
+        depth++;
+    }
+    return 2 * depth;
+}
+
+void v_sort(Vector *v, VectorComparatorFn comp) {
+    v_introsort_range((char *) v->_data, v_size(v), v->_stride, comp,
+                      v_sort_depth_limit(v_size(v)));
+}
+
+// Bottom-up merge sort: equal elements keep their relative order.
+void v_stable_sort(Vector *v, VectorComparatorFn comp) {
+    size_t n = v_size(v);
+    size_t stride = v->_stride;
+    char *src = (char *) v->_data;
+
+    for (size_t start = 0; start < n; start += VECTOR_INSERTION_SORT_THRESHOLD) {
+        size_t run = n - start < VECTOR_INSERTION_SORT_THRESHOLD
+            ? n - start : VECTOR_INSERTION_SORT_THRESHOLD;
+        v_insertion_sort_range(src + start * stride, run, stride, comp);
+    }
+    if (n <= VECTOR_INSERTION_SORT_THRESHOLD) return;
+
+    char *dst = (char *) malloc(n * stride);
+    assert(dst != NULL);
+    char *buffer = dst;
+
+    for (size_t width = VECTOR_INSERTION_SORT_THRESHOLD; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                // take from the right run only when strictly smaller
+                if (comp(src + j * stride, src + i * stride) < 0)
+                    memcpy(dst + (k++) * stride, src + (j++) * stride, stride);
+                else
+                    memcpy(dst + (k++) * stride, src + (i++) * stride, stride);
+            }
+            memcpy(dst + k * stride, src + i * stride, (mid - i) * stride);
+            k += mid - i;
+            memcpy(dst + k * stride, src + j * stride, (hi - j) * stride);
+        }
+        char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != v->_data)
+        memcpy(v->_data, src, n * stride);
+    free(buffer);
+}
+
+// Stable LSD radix sort on an unsigned integer key of key_size bytes
+// (1, 2, 4 or 8, native byte order) stored key_offset bytes into each
+// element. Pointer keys sort by address. Signed keys sort correctly when
+// signed_key is set. Byte positions where every key agrees are skipped.
+void v_radix_sort(Vector *v, size_t key_offset, size_t key_size, bool signed_key) {
+    assert(key_size == 1 || key_size == 2 || key_size == 4 || key_size == 8);
+    assert(key_offset + key_size <= v->_stride);
+
+    size_t n = v_size(v);
+    size_t stride = v->_stride;
+    if (n < 2) return;
+
+    char *src = (char *) v->_data;
+    char *dst = (char *) malloc(n * stride);
+    assert(dst != NULL);
+    char *buffer = dst;
+
+    for (size_t byte = 0; byte < key_size; byte++) {
+        size_t counts[256];
+        memset(counts, 0, sizeof(counts));
+
+        // native byte order: on little endian targets byte 0 is least significant
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        size_t byte_offset = key_offset + key_size - 1 - byte;
+#else
+        size_t byte_offset = key_offset + byte;
+#endif
+        unsigned char flip = (signed_key && byte == key_size - 1) ? 0x80 : 0;
+
+        for (size_t idx = 0; idx < n; idx++)
+            counts[((unsigned char) src[idx * stride + byte_offset]) ^ flip]++;
+
+        if (counts[((unsigned char) src[byte_offset]) ^ flip] == n)
+            continue;
+
+        size_t total = 0;
+        for (size_t b = 0; b < 256; b++) {
+            size_t c = counts[b];
+            counts[b] = total;
+            total += c;
+        }
+        for (size_t idx = 0; idx < n; idx++) {
+            unsigned char b = ((unsigned char) src[idx * stride + byte_offset]) ^ flip;
+            memcpy(dst + (counts[b]++) * stride, src + idx * stride, stride);
+        }
+
+        char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != v->_data)
+        memcpy(v->_data, src, n * stride);
+    free(buffer);
+}
+
+// Index of the first element not ordered before key, v_size(v) if none.
+// The vector must be sorted by comp.
+size_t v_lower_bound(Vector *v, const void *key, VectorComparatorFn comp) {
+    size_t lo = 0;
+    size_t hi = v_size(v);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (comp(v_at_unsafe(v, mid), key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Index of the first element ordered after key, v_size(v) if none.
+size_t v_upper_bound(Vector *v, const void *key, VectorComparatorFn comp) {
+    size_t lo = 0;
+    size_t hi = v_size(v);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (comp(key, v_at_unsafe(v, mid)) < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+void *v_bsearch(Vector *v, const void *key, VectorComparatorFn comp) {
+    size_t idx = v_lower_bound(v, key, comp);
+    if (idx < v_size(v) && comp(v_at_unsafe(v, idx), key) == 0)
+        return v_at_unsafe(v, idx);
+    return NULL;
+}
+
+// Typed vectors share the representation of the generic Vector, but know
+// their element type at compile time: indexing is plain pointer arithmetic
+// and stores are direct assignments instead of stride-sized memcpy calls.
+//
+//     DEFINE_TYPED_VECTOR(TokenVector, tokv, Token)
+//
+// declares TokenVector together with tokv_make, tokv_push_back, tokv_at, ...
+// A typed vector can be handed to the generic API with tokv_as_vector, and a
+// generic Vector of the right stride can be adopted with tokv_from_vector.
+#define DEFINE_TYPED_VECTOR(name, prefix, type)                              \
+    typedef struct {                                                         \
+        Vector _v;                                                           \
+    } name;                                                                  \
+                                                                             \
+    typedef type name##Element;                                              \
+    typedef bool (*name##PredicateFn)(const name##Element *, const void *);  \
+    typedef void (*name##MappableFn)(type *, void *);                        \
+                                                                             \
+    name *prefix##_make() {                                                  \
+        name *v = (name *) malloc(sizeof(name));                             \
+        assert(v != NULL);                                                   \
+        vec_init(&v->_v, sizeof(type));                                      \
+        return v;                                                            \
+    }                                                                        \
+                                                                             \
+    Vector *prefix##_as_vector(name *v) {                                    \
+        return &v->_v;                                                       \
+    }                                                                        \
+                                                                             \
+    name *prefix##_from_vector(Vector *v) {                                  \
+        assert(v->_stride == sizeof(type));                                  \
+        return (name *) v;                                                   \
+    }                                                                        \
+                                                                             \
+    size_t prefix##_size(const name *v) {                                    \
+        return v->_v._length;                                                \
+    }                                                                        \
+                                                                             \
+    type *prefix##_data(const name *v) {                                     \
+        return (type *) v->_v._data;                                         \
+    }                                                                        \
+                                                                             \
+    type *prefix##_at(const name *v, size_t idx) {                           \
+        assert(idx < v->_v._length);                                         \
+        return prefix##_data(v) + idx;                                       \
+    }                                                                        \
+                                                                             \
+    type prefix##_get(const name *v, size_t idx) {                           \
+        return *prefix##_at(v, idx);                                         \
+    }                                                                        \
+                                                                             \
+    void prefix##_push_back(name *v, type data) {                            \
+        if (v->_v._length == v->_v._capacity)                                \
+            v_extend(&v->_v, v->_v._capacity * 2);                           \
+        prefix##_data(v)[v->_v._length++] = data;                            \
+    }                                                                        \
+                                                                             \
+    type *prefix##_find(name *v, name##PredicateFn pred, const void *aux) {  \
+        type *data = prefix##_data(v);                                       \
+        for (size_t idx = 0; idx < v->_v._length; idx++) {                   \
+            if (pred(data + idx, aux))                                       \
+                return data + idx;                                           \
+        }                                                                    \
+        return NULL;                                                         \
+    }                                                                        \
+                                                                             \
+    void prefix##_map(name *v, name##MappableFn f, void *aux) {              \
+        type *data = prefix##_data(v);                                       \
+        for (size_t idx = 0; idx < v->_v._length; idx++)                     \
+            f(data + idx, aux);                                              \
+    }                                                                        \
+                                                                             \
+    name *prefix##_filter(name *v, name##PredicateFn pred, const void *aux) {\
+        name *o = prefix##_make();                                           \
+        type *data = prefix##_data(v);                                       \
+        for (size_t idx = 0; idx < v->_v._length; idx++) {                   \
+            if (pred(data + idx, aux))                                       \
+                prefix##_push_back(o, data[idx]);                            \
+        }                                                                    \
+        return o;                                                            \
+    }                                                                        \
+                                                                             \
+    void prefix##_free(name *v) {                                            \
+        v_free(&v->_v);                                                      \
+    }
+
+// Introsort for a typed vector with the ordering known at compile time, so
+// the comparison is inlined instead of called through a pointer. less(a, b)
+// takes two const element pointers and is true when a sorts before b.
+//
+//     DEFINE_TYPED_VECTOR_SORT(TokenVector, tokv, token_before)
+#define DEFINE_TYPED_VECTOR_SORT(name, prefix, less)                         \
+    void prefix##_insertion_sort_range(name##Element *base, size_t n) {      \
+        for (size_t idx = 1; idx < n; idx++) {                               \
+            name##Element e = base[idx];                                     \
+            size_t j = idx;                                                  \
+            for (; j > 0 && less(&e, &base[j - 1]); j--)                     \
+                base[j] = base[j - 1];                                       \
+            base[j] = e;                                                     \
+        }                                                                    \
+    }                                                                        \
+                                                                             \
+    void prefix##_sift_down(name##Element *base, size_t root, size_t n) {    \
+        while (2 * root + 1 < n) {                                           \
+            size_t child = 2 * root + 1;                                     \
+            if (child + 1 < n && less(&base[child], &base[child + 1]))       \
+                child++;                                                     \
+            if (!less(&base[root], &base[child])) return;                    \
+            name##Element tmp = base[root];                                  \
+            base[root] = base[child];                                        \
+            base[child] = tmp;                                               \
+            root = child;                                                    \
+        }                                                                    \
+    }                                                                        \
+                                                                             \
+    void prefix##_introsort_range(name##Element *base, size_t n,             \
+                                  size_t depth_limit) {                      \
+        while (n > VECTOR_INSERTION_SORT_THRESHOLD) {                        \
+            if (depth_limit == 0) {                                          \
+                for (size_t idx = n / 2; idx --> 0;)                         \
+                    prefix##_sift_down(base, idx, n);                        \
+                for (size_t end = n; end --> 1;) {                           \
+                    name##Element tmp = base[0];                             \
+                    base[0] = base[end];                                     \
+                    base[end] = tmp;                                         \
+                    prefix##_sift_down(base, 0, end);                        \
+                }                                                            \
+                return;                                                      \
+            }                                                                \
+            depth_limit--;                                                   \
+                                                                             \
+            name##Element tmp;                                               \
+            size_t mid = n / 2;                                              \
+            if (less(&base[mid], &base[0])) {                                \
+                tmp = base[mid]; base[mid] = base[0]; base[0] = tmp;         \
+            }                                                                \
+            if (less(&base[n - 1], &base[mid])) {                            \
+                tmp = base[n - 1]; base[n - 1] = base[mid]; base[mid] = tmp; \
+                if (less(&base[mid], &base[0])) {                            \
+                    tmp = base[mid]; base[mid] = base[0]; base[0] = tmp;     \
+                }                                                            \
+            }                                                                \
+            tmp = base[mid]; base[mid] = base[0]; base[0] = tmp;             \
+                                                                             \
+            size_t i = 1;                                                    \
+            size_t j = n - 1;                                                \
+            while (true) {                                                   \
+                while (less(&base[i], &base[0])) i++;                        \
+                while (less(&base[0], &base[j])) j--;                        \
+                if (i >= j) break;                                           \
+                tmp = base[i]; base[i] = base[j]; base[j] = tmp;             \
+                i++;                                                         \
+                j--;                                                         \
+            }                                                                \
+            tmp = base[0]; base[0] = base[j]; base[j] = tmp;                 \
+                                                                             \
+            if (j < n - j - 1) {                                             \
+                prefix##_introsort_range(base, j, depth_limit);              \
+                base += j + 1;                                               \
+                n -= j + 1;                                                  \
+            } else {                                                         \
+                prefix##_introsort_range(base + j + 1, n - j - 1,            \
+                                         depth_limit);                       \
+                n = j;                                                       \
+            }                                                                \
+        }                                                                    \
+        prefix##_insertion_sort_range(base, n);                              \
+    }                                                                        \
+                                                                             \
+    void prefix##_sort(name *v) {                                            \
+        prefix##_introsort_range(prefix##_data(v), prefix##_size(v),         \
+                                 v_sort_depth_limit(prefix##_size(v)));      \
+    }                                                                        \
+                                                                             \
+    size_t prefix##_lower_bound(name *v, const name##Element *key) {         \
+        name##Element *data = prefix##_data(v);                              \
+        size_t lo = 0;                                                       \
+        size_t hi = prefix##_size(v);                                        \
+        while (lo < hi) {                                                    \
+            size_t mid = lo + (hi - lo) / 2;                                 \
+            if (less(&data[mid], key))                                       \
+                lo = mid + 1;                                                \
+            else                                                             \
+                hi = mid;                                                    \
+        }                                                                    \
+        return lo;                                                           \
+    }                                                                        \
+                                                                             \
+    name##Element *prefix##_bsearch(name *v, const name##Element *key) {     \
+        size_t idx = prefix##_lower_bound(v, key);                           \
+        if (idx < prefix##_size(v) && !less(key, prefix##_at(v, idx)))       \
+            return prefix##_at(v, idx);                                      \
+        return NULL;                                                         \
+    }
+
 #endif
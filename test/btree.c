@@ -0,0 +1,274 @@
+// BTree against a sorted reference array, under random inserts and
+// removes over a small key range so that runs of equal values span leaves
+// and separators. After every batch the whole structure is checked: fill
+// bounds, equal leaf depths, separators bounding their subtrees, and the
+// leaf links. Lower and upper bounds, cursor steps in both directions and
+// t_range_map are compared with the reference too, on the empty tree as
+// well. Runs with values so large that every node holds the minimum of
+// BTREE_MIN_CAPACITY, which makes splits, borrows, merges and root changes
+// happen at every level, and with small values, each over a narrow and a
+// wide key range.
+#undef NDEBUG
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "cbtree.h"
+
+#define N_OPS 200000
+#define MAX_VALUES 4000
+
+// compared on _key only; _seq tells equal values apart
+typedef struct {
+    long _key;
+    long _seq;
+    char _pad[48];
+} Value;
+
+// the keys the tree should hold, sorted
+static long ref[MAX_VALUES];
+static size_t n_ref;
+
+int compare_keys(void *a, void *b) {
+    long x = ((Value *) a)->_key;
+    long y = ((Value *) b)->_key;
+    return (x > y) - (x < y);
+}
+
+long key_at(BTree *t, BTreeNode *n, size_t idx) {
+    return ((Value *) t_value_at(t, n, idx))->_key;
+}
+
+// Index of the first reference key not before key, or with strict, the
+// first one after it.
+size_t ref_bound(long key, bool strict) {
+    size_t lo = 0, hi = n_ref;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ref[mid] < key || (strict && ref[mid] == key)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+typedef struct {
+    int _leaf_depth;
+    BTreeNode *_last_leaf;
+    size_t _n_values;
+} CheckState;
+
+// Checks the subtree at n, whose values must lie within [lo, hi].
+void check_node(BTree *t, BTreeNode *n, long lo, long hi, int depth, CheckState *s) {
+    if (n != t->_root) assert(n->_n >= t_min_fill(t, n));
+    assert(n->_n <= t_capacity(t, n));
+    for (size_t idx = 0; idx < n->_n; idx++) {
+        assert(key_at(t, n, idx) >= lo && key_at(t, n, idx) <= hi);
+        if (idx > 0) assert(key_at(t, n, idx - 1) <= key_at(t, n, idx));
+    }
+
+    if (n->_leaf) {
+        if (s->_leaf_depth < 0) s->_leaf_depth = depth;
+        assert(s->_leaf_depth == depth);
+        assert(n->_prev == s->_last_leaf);
+        if (s->_last_leaf != NULL) assert(s->_last_leaf->_next == n);
+        s->_last_leaf = n;
+        s->_n_values += n->_n;
+        return;
+    }
+
+    // child i holds values between separators i - 1 and i, both inclusive
+    for (size_t c_idx = 0; c_idx <= n->_n; c_idx++) {
+        long c_lo = c_idx > 0 ? key_at(t, n, c_idx - 1) : lo;
+        long c_hi = c_idx < n->_n ? key_at(t, n, c_idx) : hi;
+        check_node(t, t_children(n)[c_idx], c_lo, c_hi, depth + 1, s);
+    }
+}
+
+static size_t n_visited;
+
+void check_visit(void *v, __attribute__((unused)) void *aux) {
+    assert(n_visited < n_ref);
+    assert(((Value *) v)->_key == ref[n_visited++]);
+}
+
+void check(BTree *t) {
+    assert(t_size(t) == n_ref);
+    if (n_ref == 0) {
+        assert(t->_root == NULL);
+        return;
+    }
+
+    CheckState s = {-1, NULL, 0};
+    check_node(t, t->_root, LONG_MIN, LONG_MAX, 0, &s);
+    assert(s._last_leaf->_next == NULL);
+    assert(s._n_values == n_ref);
+
+    n_visited = 0;
+    t_map(t, check_visit, NULL);
+    assert(n_visited == n_ref);
+}
+
+// The cursor at reference index idx, which is the end past the last one,
+// must hold that key; stepping forward and back from it must follow the
+// reference, and stepping back from the first value gives the end.
+void check_cursor_at(BTreeCursor c, size_t idx) {
+    if (idx == n_ref) {
+        assert(!t_cursor_valid(&c));
+        return;
+    }
+    assert(t_cursor_valid(&c));
+    assert(((Value *) t_cursor_value(&c))->_key == ref[idx]);
+
+    BTreeCursor forward = c;
+    for (size_t step = 1; step <= 6; step++) {
+        t_cursor_next(&forward);
+        if (idx + step == n_ref) {
+            assert(!t_cursor_valid(&forward));
+            break;
+        }
+        assert(((Value *) t_cursor_value(&forward))->_key == ref[idx + step]);
+    }
+
+    BTreeCursor back = c;
+    for (size_t step = 1; step <= 6; step++) {
+        t_cursor_prev(&back);
+        if (step > idx) {
+            assert(!t_cursor_valid(&back));
+            break;
+        }
+        assert(((Value *) t_cursor_value(&back))->_key == ref[idx - step]);
+    }
+}
+
+static size_t range_next;
+
+void check_range_visit(void *v, __attribute__((unused)) void *aux) {
+    assert(range_next < n_ref);
+    assert(((Value *) v)->_key == ref[range_next++]);
+}
+
+// Lower and upper bounds for every key in the range and just outside it,
+// and t_range_map over ranges that are empty, reversed, or cross leaves.
+void check_bounds(BTree *t, long key_range) {
+    for (long key = -1; key <= key_range; key++) {
+        Value v = {key, 0, {0}};
+        check_cursor_at(t_lower_bound(t, &v), ref_bound(key, false));
+        check_cursor_at(t_upper_bound(t, &v), ref_bound(key, true));
+    }
+
+    // the whole sequence both ways, across every leaf edge
+    size_t idx = 0;
+    for (BTreeCursor c = t_first(t); t_cursor_valid(&c); t_cursor_next(&c))
+        assert(((Value *) t_cursor_value(&c))->_key == ref[idx++]);
+    assert(idx == n_ref);
+    BTreeCursor c = t_end(t);
+    for (t_cursor_prev(&c); t_cursor_valid(&c); t_cursor_prev(&c))
+        assert(((Value *) t_cursor_value(&c))->_key == ref[--idx]);
+    assert(idx == 0);
+
+    long spans[] = {0, 1, 2, 7, key_range / 3, key_range + 2};
+    for (long lo = -2; lo <= key_range + 1; lo += 1 + key_range / 40) {
+        for (size_t s_idx = 0; s_idx < sizeof(spans) / sizeof(spans[0]); s_idx++) {
+            Value lo_v = {lo, 0, {0}}, hi_v = {lo + spans[s_idx], 0, {0}};
+            range_next = ref_bound(lo, false);
+            size_t end = ref_bound(hi_v._key, false);
+            t_range_map(t, &lo_v, &hi_v, check_range_visit, NULL);
+            assert(range_next == end);
+
+            // reversed: nothing
+            range_next = n_ref;
+            if (spans[s_idx] > 0) t_range_map(t, &hi_v, &lo_v, check_range_visit, NULL);
+            assert(range_next == n_ref);
+        }
+    }
+}
+
+void run(size_t stride, long key_range) {
+    BTree *t = t_make(stride, compare_keys);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    n_ref = 0;
+    check_bounds(t, key_range);
+
+    for (long op = 0; op < N_OPS; op++) {
+        uint64_t r = next_random(&state);
+        Value v = {(long) (r % (uint64_t) key_range), op, {0}};
+        // lean towards growing until the tree is big, then hover
+        bool grow = n_ref < MAX_VALUES / 2 ? (r >> 32) % 3 != 0 : (r >> 32) % 2 == 0;
+        if (n_ref == MAX_VALUES) grow = false;
+
+        if (grow) {
+            t_insert(t, &v);
+            size_t idx = ref_bound(v._key, true);
+            memmove(ref + idx + 1, ref + idx, (n_ref - idx) * sizeof(long));
+            ref[idx] = v._key;
+            n_ref++;
+        } else {
+            t_remove(t, &v);
+            size_t idx = ref_bound(v._key, false);
+            if (idx < n_ref && ref[idx] == v._key) {
+                memmove(ref + idx, ref + idx + 1, (n_ref - idx - 1) * sizeof(long));
+                n_ref--;
+            }
+        }
+
+        Value probe = {(long) ((r >> 16) % (uint64_t) key_range), 0, {0}};
+        Value *found = (Value *) t_find(t, &probe);
+        size_t idx = ref_bound(probe._key, false);
+        assert((found != NULL) == (idx < n_ref && ref[idx] == probe._key));
+        if (found != NULL) assert(found->_key == probe._key);
+
+        if (op % 997 == 0) check(t);
+        if (op % 40009 == 0) check_bounds(t, key_range);
+    }
+    check(t);
+    check_bounds(t, key_range);
+
+    // drain it, through every merge and root shrink down to empty
+    while (n_ref > 0) {
+        size_t idx = (size_t) (next_random(&state) % n_ref);
+        Value v = {ref[idx], 0, {0}};
+        t_remove(t, &v);
+        memmove(ref + idx, ref + idx + 1, (n_ref - idx - 1) * sizeof(long));
+        n_ref--;
+        if (n_ref % 97 == 0) check(t);
+        if (n_ref == 5) check_bounds(t, key_range);
+    }
+    check(t);
+    check_bounds(t, key_range);
+    printf("stride %2zu: %zu values per leaf, keys below %ld\n",
+           stride, t->_leaf_capacity, key_range);
+    t_free(t);
+}
+
+// Equal values stay in insertion order, across leaves.
+void check_insertion_order(void) {
+    BTree *t = t_make(sizeof(Value), compare_keys);
+    for (long seq = 0; seq < 500; seq++) {
+        Value v = {seq % 3, seq, {0}};
+        t_insert(t, &v);
+    }
+    long last_key = -1, last_seq = -1;
+    for (BTreeCursor c = t_first(t); t_cursor_valid(&c); t_cursor_next(&c)) {
+        Value *v = (Value *) t_cursor_value(&c);
+        if (v->_key == last_key) assert(v->_seq > last_seq);
+        else assert(v->_key > last_key);
+        last_key = v->_key;
+        last_seq = v->_seq;
+    }
+    t_free(t);
+}
+
+int main(void) {
+    BTree *probe = t_make(sizeof(Value), compare_keys);
+    assert(probe->_leaf_capacity == BTREE_MIN_CAPACITY);
+    assert(probe->_inner_capacity == BTREE_MIN_CAPACITY);
+    t_free(probe);
+
+    run(sizeof(Value), 50);
+    run(sizeof(Value), 100000);
+    run(2 * sizeof(long), 50);
+    run(2 * sizeof(long), 100000);
+    check_insertion_order();
+    return 0;
+}
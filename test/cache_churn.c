@@ -0,0 +1,53 @@
+// A bounded Cache under a long stream of inserts must stay within its
+// bounds, and so must the memory behind it: evicted entries' blocks are
+// reused by the entries that replace them, whatever the value size.
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "ccache.h"
+
+#define N_KEYS 20000
+#define MAX_BYTES (64 * 1024)
+#define WARMUP_OPS 50000
+#define N_OPS 400000
+
+void churn(size_t stride, CachePolicy policy) {
+    CountingAllocator ca;
+    counting_init(&ca);
+    Cache *c = ca_make_with_allocator(stride, policy, 0, MAX_BYTES, counting_allocator(&ca));
+    char *value = (char *) calloc(1, stride);
+    char key[64];
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t warm = 0;
+
+    for (size_t op = 0; op < WARMUP_OPS + N_OPS; op++) {
+        if (op == WARMUP_OPS) warm = ca._live;
+        uint64_t r = next_random(&state);
+        size_t k_idx = (size_t) (r % N_KEYS);
+        // key lengths vary, so entries fall in more than one size class
+        snprintf(key, sizeof(key), "key-%zu-%.*s", k_idx, (int) (k_idx % 24),
+                 "........................");
+        if (ca_get(c, key) == NULL) ca_insert(c, key, value);
+        assert(ca_bytes(c) <= MAX_BYTES);
+    }
+
+    printf("stride %4zu %s: %zu entries, %7zu bytes charged, %7zu live after warmup, %7zu after\n",
+           stride, policy == CACHE_LRU ? "LRU  " : "CLOCK", ca_size(c), ca_bytes(c), warm, ca._live);
+    assert(c->_evictions > 0);
+    assert(ca._live <= warm);
+
+    ca_free(c);
+    assert(ca._live == 0);
+    free(value);
+}
+
+int main(void) {
+    size_t strides[] = {8, 200, 300, 2000};
+    for (size_t s_idx = 0; s_idx < sizeof(strides) / sizeof(strides[0]); s_idx++) {
+        churn(strides[s_idx], CACHE_LRU);
+        churn(strides[s_idx], CACHE_CLOCK);
+    }
+    return 0;
+}
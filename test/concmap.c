@@ -0,0 +1,81 @@
+// ConcurrentMap readers racing writers: every value a reader gets back must
+// be one that was stored under that key, copied whole. Writers keep
+// inserting and removing, growing the shards through several resizes, so
+// optimistic reads keep running into changes.
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "cconcmap.h"
+
+#define N_KEYS 20000
+#define N_READERS 3
+#define N_WRITERS 2
+#define WRITER_ROUNDS 6
+
+static char keys[N_KEYS][16];
+static volatile bool writers_done;
+
+// all four fields the same, so a torn copy shows
+typedef struct {
+    long _a, _b, _c, _d;
+} Value;
+
+void *reader(void *p) {
+    ConcurrentMap *cm = (ConcurrentMap *) p;
+    size_t found = 0;
+    for (size_t i = 0; !writers_done || i < N_KEYS; i++) {
+        size_t k_idx = (i * 7919) % N_KEYS;
+        Value v;
+        if (!cm_get(cm, keys[k_idx], &v)) continue;
+        assert(v._a == v._b && v._b == v._c && v._c == v._d);
+        assert((size_t) (v._a % N_KEYS) == k_idx);
+        found++;
+    }
+    assert(found > 0);
+    return NULL;
+}
+
+void *writer(void *p) {
+    ConcurrentMap *cm = (ConcurrentMap *) p;
+    static long next_writer;
+    long w_idx = __atomic_fetch_add(&next_writer, 1, __ATOMIC_RELAXED);
+
+    for (long round = 0; round < WRITER_ROUNDS; round++) {
+        for (long k_idx = w_idx; k_idx < N_KEYS; k_idx += N_WRITERS) {
+            long x = k_idx + N_KEYS * (round + 1);
+            Value v = {x, x, x, x};
+            cm_insert(cm, keys[k_idx], &v);
+        }
+        // drop most keys again, so the slab reuses their elements
+        for (long k_idx = w_idx; k_idx < N_KEYS; k_idx += N_WRITERS)
+            if (k_idx % 4 != 0) cm_remove(cm, keys[k_idx]);
+    }
+    return NULL;
+}
+
+int main(void) {
+    for (int i = 0; i < N_KEYS; i++) snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+
+    // few shards, so that readers and writers meet often
+    ConcurrentMap *cm = cm_make(sizeof(Value), 2);
+    pthread_t readers[N_READERS], writers[N_WRITERS];
+    for (int t = 0; t < N_READERS; t++) pthread_create(&readers[t], NULL, reader, cm);
+    for (int t = 0; t < N_WRITERS; t++) pthread_create(&writers[t], NULL, writer, cm);
+
+    for (int t = 0; t < N_WRITERS; t++) pthread_join(writers[t], NULL);
+    writers_done = true;
+    for (int t = 0; t < N_READERS; t++) pthread_join(readers[t], NULL);
+
+    assert(cm_size(cm) == N_KEYS / 4);
+    for (int k_idx = 0; k_idx < N_KEYS; k_idx++) {
+        Value v;
+        bool present = cm_get(cm, keys[k_idx], &v);
+        assert(present == (k_idx % 4 == 0));
+        if (present) assert(v._a == k_idx + (long) N_KEYS * WRITER_ROUNDS);
+    }
+
+    cm_free(cm);
+    return 0;
+}
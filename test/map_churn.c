@@ -0,0 +1,59 @@
+// Insert and remove churn on Maps must not grow their memory: removed
+// elements go back to the slab and are reused, for small elements and for
+// ones bigger than the largest 16-byte size class alike.
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "cmap.h"
+
+#define N_KEYS 500
+#define N_OPS 200000
+
+// Keys of varying length, so elements land in several size classes.
+void make_key(char *buf, size_t size, uint64_t r) {
+    size_t k_idx = (size_t) (r % N_KEYS);
+    snprintf(buf, size, "key-%zu-%.*s", k_idx, (int) (k_idx % 40),
+             "........................................");
+}
+
+void churn(size_t stride) {
+    CountingAllocator ca;
+    counting_init(&ca);
+    Map *m = m_make_with_allocator(stride, counting_allocator(&ca));
+    char *value = (char *) calloc(1, stride);
+    char key[64];
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    // fill every key once, then churn and compare the footprint
+    for (size_t k_idx = 0; k_idx < N_KEYS; k_idx++) {
+        snprintf(key, sizeof(key), "key-%zu-%.*s", k_idx, (int) (k_idx % 40),
+                 "........................................");
+        m_insert(m, key, value);
+    }
+    size_t filled = ca._live;
+
+    for (size_t op = 0; op < N_OPS; op++) {
+        uint64_t r = next_random(&state);
+        make_key(key, sizeof(key), r);
+        if ((r >> 32) & 1) m_insert(m, key, value);
+        else m_remove(m, key);
+    }
+    assert(m_size(m) <= N_KEYS);
+    printf("stride %4zu: %8zu bytes after filling, %8zu after churn\n",
+           stride, filled, ca._live);
+    assert(ca._live <= filled);
+
+    m_free(m);
+    assert(ca._live == 0);
+    free(value);
+}
+
+int main(void) {
+    churn(sizeof(long));
+    churn(200);  // straddles the largest small class
+    churn(300);  // every element above it
+    churn(5000); // elements bigger than the first slab chunks
+    return 0;
+}
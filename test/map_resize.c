@@ -0,0 +1,142 @@
+// Map operations while an incremental resize is under way: m_get, m_remove
+// and m_map on keys whose old bucket has and has not been migrated yet.
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+
+#include "cmap.h"
+
+#define N_KEYS 4096
+
+static char keys[N_KEYS][16];
+
+uint64_t key_hash(int i) {
+    return m_hash(keys[i], strlen(keys[i]));
+}
+
+bool in_migrated_bucket(Map *m, int i) {
+    return (key_hash(i) & (m->_old_bucket_count - 1)) < m->_migrated_buckets;
+}
+
+// Old buckets this far past the migration point survive the resize step
+// the next operation takes before it looks the key up.
+bool in_unmigrated_bucket(Map *m, int i) {
+    size_t old_idx = key_hash(i) & (m->_old_bucket_count - 1);
+    return old_idx >= m->_migrated_buckets + INCREMENTAL_RESIZE_BUCKETS_PER_OP;
+}
+
+typedef struct {
+    Map *_map;
+    int _seen[N_KEYS];
+    size_t _visited;
+} Visit;
+
+void visit(char *k, void *v, void *aux) {
+    Visit *vis = (Visit *) aux;
+    int i = *(int *) v;
+    assert(strcmp(k, keys[i]) == 0);
+    vis->_seen[i]++;
+    vis->_visited++;
+
+    // lookups from inside m_map must not move buckets under the iteration
+    size_t migrated = vis->_map->_migrated_buckets;
+    assert(*(int *) m_get(vis->_map, k) == i);
+    assert(vis->_map->_migrated_buckets == migrated);
+}
+
+void check_map_visits(Map *m, const bool *present) {
+    Visit vis;
+    memset(&vis, 0, sizeof(vis));
+    vis._map = m;
+    m_map(m, visit, &vis);
+
+    assert(vis._visited == m_size(m));
+    for (int i = 0; i < N_KEYS; i++) assert(vis._seen[i] == (present[i] ? 1 : 0));
+}
+
+// Inserts keys until an insert starts a resize from at least 512 buckets,
+// big enough to stay in progress over many operations, and returns how
+// many keys went in.
+int fill_until_resizing(Map *m, bool *present) {
+    for (int i = 0; i < N_KEYS; i++) {
+        m_insert(m, keys[i], &i);
+        present[i] = true;
+        if (m_is_resizing(m) && m->_migrated_buckets == 0 && m->_old_bucket_count >= 512)
+            return i + 1;
+    }
+    assert(0);
+    return N_KEYS;
+}
+
+int main(void) {
+    for (int i = 0; i < N_KEYS; i++) snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+
+    Map *m = m_make(sizeof(int));
+    m_set_incremental_resize(m, true);
+    bool present[N_KEYS] = {false};
+    int n = fill_until_resizing(m, present);
+    assert(m->_migrated_buckets == 0);
+
+    // right after the resize started, every element is in the old array
+    check_map_visits(m, present);
+    assert(m->_migrated_buckets == 0);
+
+    // a few lookups move some, but not all, old buckets over
+    for (int i = 0; i < 8; i++) assert(*(int *) m_get(m, keys[i]) == i);
+    assert(m_is_resizing(m));
+    assert(m->_migrated_buckets > 0 && m->_migrated_buckets < m->_old_bucket_count);
+    check_map_visits(m, present);
+
+    // m_get finds keys on both sides of the migration point
+    int n_migrated = 0, n_unmigrated = 0;
+    for (int i = 0; i < n && m_is_resizing(m); i++) {
+        bool migrated = in_migrated_bucket(m, i), unmigrated = in_unmigrated_bucket(m, i);
+        if (!migrated && !unmigrated) continue;
+        n_migrated += migrated;
+        n_unmigrated += unmigrated;
+        assert(*(int *) m_get(m, keys[i]) == i);
+        if (n_migrated >= 4 && n_unmigrated >= 4) break;
+    }
+    assert(n_migrated >= 4 && n_unmigrated >= 4);
+
+    // m_remove from a migrated and from an unmigrated bucket
+    int removed_migrated = -1, removed_unmigrated = -1;
+    for (int i = 0; i < n && m_is_resizing(m); i++) {
+        if (!present[i]) continue;
+        if (removed_migrated < 0 && in_migrated_bucket(m, i)) removed_migrated = i;
+        else if (removed_unmigrated < 0 && in_unmigrated_bucket(m, i)) removed_unmigrated = i;
+        else continue;
+
+        size_t size = m_size(m);
+        m_remove(m, keys[i]);
+        present[i] = false;
+        assert(m_size(m) == size - 1);
+        assert(m_get(m, keys[i]) == NULL);
+        if (removed_migrated >= 0 && removed_unmigrated >= 0) break;
+    }
+    assert(removed_migrated >= 0 && removed_unmigrated >= 0);
+    assert(m_is_resizing(m));
+    check_map_visits(m, present);
+
+    // removing a missing key changes nothing, wherever it would have been
+    m_remove(m, "not-a-key");
+    m_remove(m, keys[removed_unmigrated]);
+    check_map_visits(m, present);
+
+    // a removed key can come back before the resize is over
+    m_insert(m, keys[removed_unmigrated], &removed_unmigrated);
+    present[removed_unmigrated] = true;
+    assert(*(int *) m_get(m, keys[removed_unmigrated]) == removed_unmigrated);
+    check_map_visits(m, present);
+
+    // let the lookups finish the migration and check everything again
+    while (m_is_resizing(m)) m_get(m, keys[0]);
+    check_map_visits(m, present);
+    for (int i = 0; i < n; i++) {
+        int *v = (int *) m_get(m, keys[i]);
+        assert(present[i] ? v != NULL && *v == i : v == NULL);
+    }
+
+    m_free(m);
+    return 0;
+}
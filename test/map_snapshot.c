@@ -0,0 +1,164 @@
+// Damaged snapshots must never be read out of bounds: m_open_mapped turns
+// down a broken header, lookups and m_map stop at the damage they run
+// into, and m_snapshot_verify turns down broken bucket offsets, entries
+// that overrun their bucket, bad key lengths and random byte flips.
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "bench.h"
+#include "cmapfile.h"
+
+#define N_KEYS 300
+
+static const char *path = "map_snapshot.tmp";
+
+void count(__attribute__((unused)) char *k, __attribute__((unused)) void *v, void *aux) {
+    (*(size_t *) aux)++;
+}
+
+char *read_file(size_t *size) {
+    FILE *f = fopen(path, "rb");
+    assert(f != NULL);
+    fseek(f, 0, SEEK_END);
+    *size = (size_t) ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = (char *) malloc(*size);
+    assert(fread(data, 1, *size, f) == *size);
+    fclose(f);
+    return data;
+}
+
+void write_file(const char *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    assert(f != NULL);
+    assert(fwrite(data, 1, size, f) == size);
+    fclose(f);
+}
+
+// Opens data as a snapshot and, if its header is accepted, reads all of
+// it. Returns how many keys were found, or -1 if it did not open; *valid
+// is set to whether it passed m_snapshot_verify.
+long read_all(const char *data, size_t size, bool *valid) {
+    write_file(data, size);
+    *valid = false;
+    Map *m = m_open_mapped(path);
+    if (m == NULL) return -1;
+
+    size_t n = 0;
+    m_map(m, count, &n);
+    long found = 0;
+    char key[32];
+    for (long i = 0; i < N_KEYS; i++) {
+        snprintf(key, sizeof(key), "key-%ld", i);
+        long *v = (long *) m_get(m, key);
+        if (v != NULL && *v == i) found++;
+    }
+    *valid = m_snapshot_verify(m);
+    if (*valid) assert(n == m_size(m));
+    m_free(m);
+    return found;
+}
+
+// Whether data opens and passes m_snapshot_verify.
+bool verifies(const char *data, size_t size) {
+    bool valid;
+    read_all(data, size, &valid);
+    return valid;
+}
+
+int main(void) {
+    Map *m = m_make(sizeof(long));
+    char key[32];
+    for (long i = 0; i < N_KEYS; i++) {
+        snprintf(key, sizeof(key), "key-%ld", i);
+        m_insert(m, key, &i);
+    }
+    assert(m_save(m, path) == 0);
+    m_free(m);
+
+    size_t size;
+    char *good = read_file(&size);
+    char *data = (char *) malloc(size);
+    const MapSnapshotHeader *header = (const MapSnapshotHeader *) good;
+    size_t n_buckets = (size_t) header->_bucket_count;
+    size_t buckets_offset = (size_t) header->_buckets_offset;
+    size_t entries_offset = (size_t) header->_entries_offset;
+    bool valid;
+    assert(read_all(good, size, &valid) == N_KEYS && valid);
+
+    // header damage is caught when opening
+    size_t header_fields[] = {offsetof(MapSnapshotHeader, _magic),
+                              offsetof(MapSnapshotHeader, _stride),
+                              offsetof(MapSnapshotHeader, _bucket_count),
+                              offsetof(MapSnapshotHeader, _buckets_offset),
+                              offsetof(MapSnapshotHeader, _entries_offset),
+                              offsetof(MapSnapshotHeader, _size)};
+    for (size_t f_idx = 0; f_idx < sizeof(header_fields) / sizeof(header_fields[0]); f_idx++) {
+        memcpy(data, good, size);
+        data[header_fields[f_idx] + 1] ^= 0x40;
+        assert(read_all(data, size, &valid) == -1);
+    }
+    memcpy(data, good, size);
+    ((uint64_t *) (data + buckets_offset))[n_buckets] += 8;
+    assert(read_all(data, size, &valid) == -1);
+    assert(read_all(good, size - 8, &valid) == -1);
+
+    // every place a bucket offset can go wrong
+    for (size_t b_idx = 0; b_idx <= n_buckets; b_idx++) {
+        uint64_t *buckets = (uint64_t *) (data + buckets_offset);
+        uint64_t bad[] = {0, 8, 1, ~(uint64_t) 0};
+        for (size_t v_idx = 0; v_idx < sizeof(bad) / sizeof(bad[0]); v_idx++) {
+            memcpy(data, good, size);
+            if (buckets[b_idx] == bad[v_idx]) continue;
+            buckets[b_idx] = bad[v_idx];
+            assert(!verifies(data, size));
+        }
+    }
+
+    // an out of order pair of buckets, each offset still in range
+    memcpy(data, good, size);
+    uint64_t *buckets = (uint64_t *) (data + buckets_offset);
+    size_t b_idx = 1;
+    while (buckets[b_idx] == buckets[b_idx + 1]) b_idx++;
+    uint64_t t = buckets[b_idx];
+    buckets[b_idx] = buckets[b_idx + 1];
+    buckets[b_idx + 1] = t;
+    assert(!verifies(data, size));
+
+    // key lengths that run past the entry, the bucket or the file
+    size_t bad_lengths[] = {1000, 1 << 20, ~(size_t) 0, 0};
+    for (size_t l_idx = 0; l_idx < sizeof(bad_lengths) / sizeof(bad_lengths[0]); l_idx++) {
+        memcpy(data, good, size);
+        MapElem *first = (MapElem *) (data + entries_offset);
+        first->_key_length = bad_lengths[l_idx];
+        assert(!verifies(data, size));
+        // only the damaged bucket loses keys
+        long found = read_all(data, size, &valid);
+        assert(found >= N_KEYS - 8 && found < N_KEYS);
+    }
+
+    // a length that disagrees with the entries
+    memcpy(data, good, size);
+    ((MapSnapshotHeader *) data)->_length++;
+    assert(!verifies(data, size));
+
+    // random damage is either caught or harmless
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t accepted = 0;
+    for (size_t round = 0; round < 2000; round++) {
+        memcpy(data, good, size);
+        for (size_t flip = 0; flip < 1 + round % 4; flip++) {
+            uint64_t r = next_random(&state);
+            data[r % size] ^= (char) (1 << (r >> 61));
+        }
+        accepted += verifies(data, size);
+    }
+    printf("%zu of 2000 damaged snapshots verified\n", accepted);
+
+    free(good);
+    free(data);
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// File-backed Vectors: create one and grow it through several remaps,
+// reopen the file read-only and check every element, then reopen it for
+// writing, append and check again. The file must end up trimmed to the
+// elements it holds.
+#undef NDEBUG
+// first, so that cmmap.h gets to turn on mremap
+#include "cmmap.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#if defined(__linux__) && !defined(MREMAP_MAYMOVE)
+#error "cmmap.h should grow mappings with mremap on Linux"
+#endif
+
+#define N_FIRST 100000
+#define N_MORE 50000
+
+static const char *path = "mmap_vector.tmp";
+
+typedef struct {
+    long _index;
+    long _square;
+} Pair;
+
+size_t file_size(void) {
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    return (size_t) st.st_size;
+}
+
+void check(Vector *v, size_t n) {
+    assert(v_size(v) == n);
+    for (size_t i = 0; i < n; i++) {
+        Pair *p = (Pair *) v_at(v, i);
+        assert(p->_index == (long) i);
+        assert(p->_square == (long) (i * i));
+    }
+}
+
+int main(void) {
+    Vector *v = v_mmap_create(path, sizeof(Pair));
+    assert(v != NULL && v_is_mmapped(v));
+    for (long i = 0; i < N_FIRST; i++) {
+        Pair p = {i, i * i};
+        v_push_back(v, &p);
+    }
+    check(v, N_FIRST);
+    assert(v_mmap_sync(v) == 0);
+    v_free(v);
+    assert(file_size() == N_FIRST * sizeof(Pair));
+
+    v = v_mmap_open(path, sizeof(Pair), false);
+    assert(v != NULL);
+    check(v, N_FIRST);
+    assert(v_mmap_advise_sequential(v) == 0);
+    v_free(v);
+    assert(file_size() == N_FIRST * sizeof(Pair));
+
+    v = v_mmap_open(path, sizeof(Pair), true);
+    assert(v != NULL);
+    check(v, N_FIRST);
+    for (long i = N_FIRST; i < N_FIRST + N_MORE; i++) {
+        Pair p = {i, i * i};
+        v_push_back(v, &p);
+    }
+    check(v, N_FIRST + N_MORE);
+    v_free(v);
+    assert(file_size() == (N_FIRST + N_MORE) * sizeof(Pair));
+
+    v = v_mmap_open(path, sizeof(Pair), false);
+    check(v, N_FIRST + N_MORE);
+    v_free(v);
+
+    assert(v_mmap_open("no/such/dir/file", sizeof(Pair), false) == NULL);
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,166 @@
+// OrderedMap against a reference list of bindings in insertion order:
+// iteration order after removes and the rebuilds that squeeze out their
+// holes, index slots widening from one byte to two and four, deleted index
+// slots being taken again, and every byte going back to the allocator.
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "cordmap.h"
+
+#define N_KEYS 3000
+#define N_OPS 300000
+
+// live keys in the order the map should visit them
+static long order[N_KEYS];
+static size_t n_order;
+static long values[N_KEYS];
+static bool bound[N_KEYS];
+
+static size_t n_visited;
+static size_t n_cleaned;
+
+void make_key(char *buf, size_t size, long k_idx) {
+    snprintf(buf, size, "k%ld", k_idx);
+}
+
+void check_visit(char *k, void *v, __attribute__((unused)) void *aux) {
+    char key[32];
+    assert(n_visited < n_order);
+    long k_idx = order[n_visited++];
+    make_key(key, sizeof(key), k_idx);
+    assert(strcmp(k, key) == 0);
+    assert(*(long *) v == values[k_idx]);
+}
+
+void count_cleanup(__attribute__((unused)) char *k, __attribute__((unused)) void *v,
+                   __attribute__((unused)) void *aux) {
+    n_cleaned++;
+}
+
+void check(OrderedMap *m) {
+    assert(om_size(m) == n_order);
+    n_visited = 0;
+    om_map(m, check_visit, NULL);
+    assert(n_visited == n_order);
+
+    char key[32];
+    for (long k_idx = 0; k_idx < N_KEYS; k_idx++) {
+        make_key(key, sizeof(key), k_idx);
+        long *v = (long *) om_get(m, key);
+        assert((v != NULL) == bound[k_idx]);
+        if (v != NULL) assert(*v == values[k_idx]);
+    }
+}
+
+void ref_remove(long k_idx) {
+    size_t o_idx = 0;
+    while (order[o_idx] != k_idx) o_idx++;
+    memmove(order + o_idx, order + o_idx + 1, (n_order - o_idx - 1) * sizeof(long));
+    n_order--;
+    bound[k_idx] = false;
+}
+
+size_t slot_of(OrderedMap *m, const char *k) {
+    size_t len = strlen(k);
+    return om_find_slot(m, k, len, m_hash(k, len), NULL);
+}
+
+int main(void) {
+    CountingAllocator ca;
+    counting_init(&ca);
+    OrderedMap *m = om_make_with_allocator(sizeof(long), counting_allocator(&ca));
+    m->_cleanup_fn = count_cleanup;
+    char key[32];
+
+    // growing from scratch, the index goes from one byte slots to two
+    bool seen_width[9] = {false};
+    for (long k_idx = 0; k_idx < N_KEYS; k_idx++) {
+        make_key(key, sizeof(key), k_idx);
+        values[k_idx] = k_idx * 10;
+        om_insert(m, key, values + k_idx);
+        order[n_order++] = k_idx;
+        bound[k_idx] = true;
+        seen_width[m->_index_width] = true;
+        if (m->_index_width == 1) assert(m->_n_entries <= UINT8_MAX - 2);
+    }
+    assert(seen_width[1] && seen_width[2]);
+    check(m);
+
+    // a removed key's index slot is the first one its reinsertion reuses
+    make_key(key, sizeof(key), 7);
+    size_t slot = slot_of(m, key);
+    om_remove(m, key);
+    ref_remove(7);
+    assert(om_index_get(m, slot) == om_index_deleted(m));
+    size_t insert_slot;
+    assert(om_find_slot(m, key, strlen(key), m_hash(key, strlen(key)), &insert_slot)
+           == m->_index_size);
+    assert(insert_slot == slot);
+    values[7] = -7;
+    om_insert(m, key, values + 7);
+    order[n_order++] = 7;
+    bound[7] = true;
+    assert(slot_of(m, key) == slot);
+    check(m);
+
+    // random churn: rebinding keeps a key's place, removing and binding
+    // again moves it to the end, and rebuilds keep the order
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t max_index_size = 0;
+    for (size_t op = 0; op < N_OPS; op++) {
+        uint64_t r = next_random(&state);
+        long k_idx = (long) (r % N_KEYS);
+        make_key(key, sizeof(key), k_idx);
+        if ((r >> 32) % 3 == 0) {
+            om_remove(m, key);
+            if (bound[k_idx]) ref_remove(k_idx);
+        } else {
+            values[k_idx] = (long) op;
+            om_insert(m, key, values + k_idx);
+            if (!bound[k_idx]) order[n_order++] = k_idx;
+            bound[k_idx] = true;
+        }
+        if (m->_index_size > max_index_size) max_index_size = m->_index_size;
+        if (op % 10007 == 0) check(m);
+    }
+    check(m);
+    // holes are squeezed out rather than growing the index without end
+    assert(max_index_size <= 8192);
+
+    // remove everything but one key, and churn another until the entry
+    // array fills: the rebuild shrinks the index back to one byte slots
+    for (long k_idx = 1; k_idx < N_KEYS; k_idx++) {
+        make_key(key, sizeof(key), k_idx);
+        om_remove(m, key);
+        if (bound[k_idx]) ref_remove(k_idx);
+    }
+    for (size_t round = 0; round < 10000; round++) {
+        make_key(key, sizeof(key), 1);
+        om_insert(m, key, values + 1);
+        om_remove(m, key);
+    }
+    assert(m->_index_width == 1);
+    check(m);
+
+    // large enough for four byte slots
+    OrderedMap *big = om_make(sizeof(long));
+    for (long i = 0; i < 50000; i++) {
+        snprintf(key, sizeof(key), "big%ld", i);
+        om_insert(big, key, &i);
+    }
+    assert(big->_index_width == 4);
+    for (long i = 0; i < 50000; i++) {
+        snprintf(key, sizeof(key), "big%ld", i);
+        assert(*(long *) om_get(big, key) == i);
+    }
+    om_free(big);
+
+    size_t live = om_size(m);
+    n_cleaned = 0;
+    om_free(m);
+    assert(n_cleaned == live);
+    assert(ca._live == 0);
+    return 0;
+}
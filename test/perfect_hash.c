@@ -0,0 +1,48 @@
+// PerfectHash: every key of a built table is found with its value and
+// nothing else is, and a key set with a duplicate is turned down with
+// NULL, leaving nothing allocated, rather than searched for a seed forever.
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "cmph.h"
+
+#define N_KEYS 10000
+
+int main(void) {
+    static char key_bytes[N_KEYS][16];
+    static const char *keys[N_KEYS];
+    static long values[N_KEYS];
+    for (long i = 0; i < N_KEYS; i++) {
+        snprintf(key_bytes[i], sizeof(key_bytes[i]), "k%ld", i);
+        keys[i] = key_bytes[i];
+        values[i] = i * 3;
+    }
+
+    CountingAllocator ca;
+    counting_init(&ca);
+    for (size_t n = 0; n <= N_KEYS; n = n ? n * 10 : 1) {
+        PerfectHash *ph = ph_make_with_allocator(sizeof(long), keys, values, n,
+                                                 counting_allocator(&ca));
+        assert(ph != NULL && ph_size(ph) == n);
+        for (size_t i = 0; i < n; i++)
+            assert(*(long *) ph_get(ph, keys[i]) == values[i]);
+        assert(ph_get(ph, "missing") == NULL);
+        if (n < N_KEYS) assert(ph_get(ph, keys[n]) == NULL);
+        ph_free(ph);
+        assert(ca._live == 0);
+    }
+
+    // a duplicate anywhere in the set, including next to its twin
+    size_t dup_at[] = {1, 2, 500, N_KEYS - 1};
+    for (size_t d_idx = 0; d_idx < sizeof(dup_at) / sizeof(dup_at[0]); d_idx++) {
+        const char *saved = keys[dup_at[d_idx]];
+        keys[dup_at[d_idx]] = keys[dup_at[d_idx] - 1];
+        assert(ph_make_with_allocator(sizeof(long), keys, values, N_KEYS,
+                                      counting_allocator(&ca)) == NULL);
+        assert(ca._live == 0);
+        keys[dup_at[d_idx]] = saved;
+    }
+    return 0;
+}